@@ -14,6 +14,7 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <assert.h>
 
 #include "kved.h"
 #include "kved_cpu.h"
@@ -36,800 +37,3633 @@ const uint8_t kved_data_type_size[] =
 	8,
 	8,
 #endif
+	0,
+	0,
 };
 
-/** @private */
-typedef struct kved_sector_stat_s
+static kved_t kved_default = { 0 };
+
+static void kved_lock_enter(kved_t *kv)
 {
-	uint16_t num_free_entries;    /**< @private */
-	uint16_t num_deleted_entries; /**< @private */
-	uint16_t num_used_entries;    /**< @private */
-	uint16_t num_total_entries;   /**< @private */
-} kved_sector_stat_t;
+	kv->lock->enter(kv->lock->arg);
+}
 
-/** @private */
-typedef struct kved_ctrl_s
+static void kved_lock_leave(kved_t *kv)
 {
-	uint16_t first_index;       /**< @private */
-	uint16_t first_free_index;  /**< @private */
-	uint16_t last_index;        /**< @private */
-	kved_sector_stat_t stats;   /**< @private */
-	kved_flash_sector_t sector; /**< @private */
-} kved_ctrl_t;
+	kv->lock->leave(kv->lock->arg);
+}
 
-static kved_ctrl_t ctrl = { 0 };
-static volatile bool started = false;
+// functions only reading the database may run concurrently, when supported by the lock
+static void kved_lock_read_enter(kved_t *kv)
+{
+	if(kv->lock->read_enter)
+		kv->lock->read_enter(kv->lock->arg);
+	else
+		kv->lock->enter(kv->lock->arg);
+}
 
-static void nv_sector_stats_erase(kved_sector_stat_t *stats)
+static void kved_lock_read_leave(kved_t *kv)
 {
-	stats->num_deleted_entries = 0;
-	stats->num_free_entries = 0;
-	stats->num_total_entries = 0;
-	stats->num_used_entries = 0;
+	if(kv->lock->read_leave)
+		kv->lock->read_leave(kv->lock->arg);
+	else
+		kv->lock->leave(kv->lock->arg);
 }
 
-#ifdef KVED_DEBUG
-const uint8_t *kved_data_type_label[] = 
-{ 
-	(uint8_t *)"U8",
-	(uint8_t *)"I8",
-	(uint8_t *)"U16",
-	(uint8_t *)"I16",
-	(uint8_t *)"U32",
-	(uint8_t *)"I32",
-	(uint8_t *)"FLT",
-	(uint8_t *)"STR",
-#if KVED_FLASH_WORD_SIZE == 8	
-	(uint8_t *)"U64",
-	(uint8_t *)"I64",
-	(uint8_t *)"DBL",
-#endif
-};
+static bool kved_ops_busy(kved_t *kv)
+{
+	return kv->flash->busy ? kv->flash->busy(kv->flash->arg) : false;
+}
 
-static void kved_print(kved_word_t val)
+// operations may end after returning (see kved_flash_busy), the flash is checked before each access
+static void kved_ops_wait(kved_t *kv)
 {
-	uint8_t *p = (uint8_t *) &val;
+	while(kved_ops_busy(kv))
+	{}
+}
 
-	p += KVED_FLASH_WORD_SIZE - 1;
-	for(uint8_t n = 0 ; n < sizeof(kved_word_t) ; n++, p--)
-		printf("%02X",*p);
+static void kved_ops_init(kved_t *kv)
+{
+	kv->flash->init(kv->flash->arg);
 }
 
-static void kved_print_ascii(kved_word_t val, size_t size, bool reverse)
+static bool kved_ops_sector_erase(kved_t *kv, kved_flash_sector_t sec)
 {
-	uint8_t *p = (uint8_t *) &val;
+	kved_ops_wait(kv);
 
-	if(reverse)
-		p += size - 1;
+	return kv->flash->sector_erase(kv->flash->arg,sec);
+}
 
-	for(uint8_t n = 0 ; n < size ; n++)
+static void kved_ops_data_write(kved_t *kv, kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	kved_ops_wait(kv);
+
+	kv->flash->data_write(kv->flash->arg,sec,index,data);
+}
+
+// first data, after key
+static void kved_ops_entry_write(kved_t *kv, kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	kved_ops_wait(kv);
+
+	if(kv->flash->entry_write)
 	{
-		if(isprint(*p))
-		{
-			printf("%c",*p);
-		}
-		else
-		{
-			printf(".");
-		}
+		kv->flash->entry_write(kv->flash->arg,sec,index,key,value);
+		return;
+	}
 
-		if(reverse)
-			p--;
-		else
-			p++;
+	kved_ops_data_write(kv,sec,index + 1,value);
+	kved_ops_data_write(kv,sec,index,key);
+}
+
+static void kved_ops_data_write_block(kved_t *kv, kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	kved_ops_wait(kv);
+
+	if(kv->flash->data_write_block)
+	{
+		kv->flash->data_write_block(kv->flash->arg,sec,index,buf,count);
+		return;
 	}
+
+	for(uint16_t n = 0 ; n < count ; n++)
+		kved_ops_data_write(kv,sec,index + n,buf[n]);
 }
 
-static void kved_internal_dump(kved_ctrl_t *ctrl)
+static kved_word_t kved_ops_data_read(kved_t *kv, kved_flash_sector_t sec, uint16_t index)
 {
-	bool first_free_printed = false;
-	kved_word_t hdr = kved_flash_data_read(ctrl->sector,0);
-	kved_word_t cnt = kved_flash_data_read(ctrl->sector,1);
+	kved_ops_wait(kv);
 
-#if KVED_FLASH_WORD_SIZE == 8
-	printf("HDR (SEC %c)     SIGNATURE        COUNTER\r\n",(ctrl->sector == 0 ? 'A' : 'B'));
-#else
-	printf("HDR (SEC %c)     SIGNAT.  COUNTER\r\n",(ctrl->sector == 0 ? 'A' : 'B'));
-#endif	
-	
-	printf("ITEM IDX TYP SZ ");
-	kved_print(hdr);
-	printf(" ");
-	kved_print(cnt);
-	printf("\r\n");
+	return kv->flash->data_read(kv->flash->arg,sec,index);
+}
 
-	for(uint16_t index = ctrl->first_index ; index <= ctrl->last_index && !first_free_printed; index += KVED_ENTRY_SIZE_IN_WORDS)
+static void kved_ops_data_read_block(kved_t *kv, kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	kved_ops_wait(kv);
+
+	if(kv->flash->data_read_block)
 	{
-		kved_word_t key = kved_flash_data_read(ctrl->sector,index);
-		kved_word_t val = kved_flash_data_read(ctrl->sector,index + 1);
+		kv->flash->data_read_block(kv->flash->arg,sec,index,buf,count);
+		return;
+	}
 
-		if(key == KVED_DELETED_ENTRY)
-		{
-			printf("DEL  ");
-		}
-		else if(key == KVED_FREE_ENTRY)
-		{
-			if(val == KVED_FREE_ENTRY)
-			{
-				printf("FREE ");
-				first_free_printed = true;
-			}
-			else
-			{
-				printf("ERR1 ");
-			}
-		}
-		else
-		{
-			printf("USED ");
-		}
+	for(uint16_t n = 0 ; n < count ; n++)
+		buf[n] = kved_ops_data_read(kv,sec,index + n);
+}
 
-		uint8_t size = KVED_HDR_MASK_SIZE(key);
-		uint8_t type = KVED_HDR_MASK_TYPE(key);
+static const kved_word_t *kved_ops_sector_address(kved_t *kv, kved_flash_sector_t sec)
+{
+	kved_ops_wait(kv);
 
-		if((val == KVED_FREE_ENTRY) || (key == KVED_DELETED_ENTRY))
-		{
-			printf("%03d        ",index);
-		}
-		else
-		{
-			printf("%03d %3s %02d ",index,(char *)kved_data_type_label[type],size);
-		}
-		kved_print(key);
-		printf(" ");
-		kved_print(val);
-		printf(" ");
-		kved_print_ascii(key,KVED_FLASH_WORD_SIZE,true);
-		printf(" ");
-		kved_print_ascii(val,KVED_FLASH_WORD_SIZE,type == KVED_DATA_TYPE_STRING ? false : true);
-		printf("\r\n");
-	}
+	return kv->flash->sector_address ? kv->flash->sector_address(kv->flash->arg,sec) : NULL;
+}
 
-	printf("TOTAL %d USED %d DELETED %d FREE %d\r\n\r\n",
-			ctrl->stats.num_total_entries,
-			ctrl->stats.num_used_entries,
-			ctrl->stats.num_deleted_entries,
-			ctrl->stats.num_free_entries);
+static uint32_t kved_ops_sector_size(kved_t *kv)
+{
+	return kv->flash->sector_size(kv->flash->arg);
 }
-#else
-static void kved_internal_dump(kved_ctrl_t *ctrl)
+
+static kved_flash_sector_t kved_sector_next(kved_flash_sector_t sec)
 {
+	return (kved_flash_sector_t)((sec + 1) % KVED_FLASH_NUM_SECTORS);
 }
-#endif
 
-static void kved_sector_stats_read(kved_ctrl_t *ctrl)
+// oldest sector in use, the newest one is ctrl->sector
+static kved_flash_sector_t kved_tail_sector(kved_ctrl_t *ctrl)
 {
-	// [0,NV_HDR_SIZE] ARE NOT VALID AS ENTRY INDEXES, THEY ARE RESERVED FOR HEADER
-	ctrl->first_index = KVED_HDR_SIZE_IN_WORDS;
-	ctrl->last_index = (kved_flash_sector_size()/KVED_FLASH_WORD_SIZE) - KVED_HDR_SIZE_IN_WORDS;
-	ctrl->first_free_index = 0;
+	return (kved_flash_sector_t)((ctrl->sector + KVED_FLASH_NUM_SECTORS + 1 - ctrl->num_sectors) % KVED_FLASH_NUM_SECTORS);
+}
 
-	nv_sector_stats_erase(&ctrl->stats);
+// sectors in use, from the oldest (0) to the newest one
+static kved_flash_sector_t kved_ring_sector(kved_ctrl_t *ctrl, uint8_t pos)
+{
+	return (kved_flash_sector_t)((kved_tail_sector(ctrl) + pos) % KVED_FLASH_NUM_SECTORS);
+}
 
-	for(uint16_t index = ctrl->first_index ; index <= ctrl->last_index ; index += KVED_ENTRY_SIZE_IN_WORDS)
-	{
-		kved_word_t key = kved_flash_data_read(ctrl->sector,index);
+static bool kved_sector_in_use(kved_ctrl_t *ctrl, kved_flash_sector_t sec)
+{
+	return ((sec + KVED_FLASH_NUM_SECTORS - kved_tail_sector(ctrl)) % KVED_FLASH_NUM_SECTORS) < ctrl->num_sectors;
+}
 
-		if(key == KVED_DELETED_ENTRY)
-		{
-			ctrl->stats.num_deleted_entries++;
-		}
-		else if(key == KVED_FREE_ENTRY)
-		{
-			ctrl->stats.num_free_entries++;
+static uint16_t kved_sector_entries(kved_ctrl_t *ctrl)
+{
+	return (ctrl->last_index - ctrl->first_index)/KVED_ENTRY_SIZE_IN_WORDS + 1;
+}
 
-			if(ctrl->first_free_index == 0)
-				ctrl->first_free_index = index;
-		}
-		else
-		{
-			ctrl->stats.num_used_entries++;
-		}
+// database indexes: sector and index in the sector as a single value, unique among all sectors
+static uint16_t kved_db_index(kved_ctrl_t *ctrl, kved_flash_sector_t sec, uint16_t index)
+{
+	return (uint16_t)(sec*(ctrl->last_index + KVED_ENTRY_SIZE_IN_WORDS) + index);
+}
 
-		ctrl->stats.num_total_entries++;
-	}
+static kved_flash_sector_t kved_db_index_sector(kved_ctrl_t *ctrl, uint16_t db_index)
+{
+	return (kved_flash_sector_t)(db_index/(ctrl->last_index + KVED_ENTRY_SIZE_IN_WORDS));
 }
 
-void kved_key_decode(kved_data_t *data, kved_word_t key)
+static uint16_t kved_db_index_offset(kved_ctrl_t *ctrl, uint16_t db_index)
 {
-	data->type = KVED_HDR_MASK_TYPE(key);
+	return db_index % (ctrl->last_index + KVED_ENTRY_SIZE_IN_WORDS);
+}
 
-	uint8_t *pkey = (uint8_t *) &key;
-	pkey += KVED_MAX_KEY_SIZE;
+static bool kved_db_index_is_valid(kved_ctrl_t *ctrl, uint16_t db_index)
+{
+	kved_flash_sector_t sec = kved_db_index_sector(ctrl,db_index);
+	uint16_t index = kved_db_index_offset(ctrl,db_index);
 
-	for(size_t p = 0 ; p < KVED_MAX_KEY_SIZE ; p++)
-		data->key[p] = *pkey--;
+	return (sec < KVED_FLASH_NUM_SECTORS) && kved_sector_in_use(ctrl,sec) &&
+		   (index >= ctrl->first_index) && (index <= ctrl->last_index) &&
+		   (((index - ctrl->first_index) % KVED_ENTRY_SIZE_IN_WORDS) == 0);
 }
 
-kved_word_t kved_key_encode(kved_data_t *data)
+static void kved_deleted_count(kved_ctrl_t *ctrl, kved_flash_sector_t sec)
 {
-	uint8_t *str_key = data->key;
-	uint8_t key[KVED_MAX_KEY_SIZE];
+	ctrl->stats.num_deleted_entries++;
 
-	strncpy((char *)key,(char *)data->key,KVED_MAX_KEY_SIZE);
+	if(sec == kved_tail_sector(ctrl))
+		ctrl->tail_deleted_entries++;
+}
 
-	uint8_t size = data->type == KVED_DATA_TYPE_STRING ? strnlen((char *)str_key,KVED_MAX_KEY_SIZE) : kved_data_type_size[data->type];
-	uint8_t hdr = (data->type << 4) | size;
+static void nv_sector_stats_erase(kved_sector_stat_t *stats)
+{
+	stats->num_deleted_entries = 0;
+	stats->num_free_entries = 0;
+	stats->num_total_entries = 0;
+	stats->num_used_entries = 0;
+}
 
-	kved_word_t encoded_key = 0;
-	uint8_t *pkey = (uint8_t *) &encoded_key;
-	pkey += KVED_MAX_KEY_SIZE;
+#if KVED_INDEX_SIZE > 0
+#define KVED_INDEX_MAX_ENTRIES (KVED_INDEX_SIZE - KVED_INDEX_SIZE/4)
 
-	for(size_t p = 0 ; p < KVED_MAX_KEY_SIZE ; p++)
-		*pkey-- = key[p];
-	
-	*pkey = hdr;
+static uint16_t kved_index_hash(kved_word_t key)
+{
+	// key is already masked, drop type/size byte and mix the label bits
+#if KVED_FLASH_WORD_SIZE == 8
+	uint32_t h = (uint32_t)(key >> 8) ^ (uint32_t)(key >> 40);
+#else
+	uint32_t h = (uint32_t)(key >> 8);
+#endif
+	h *= 0x9E3779B1UL;
+	h ^= h >> 16;
 
-	return encoded_key;
+	return (uint16_t)(h & (KVED_INDEX_SIZE - 1));
 }
 
-static bool kved_is_valid_key(kved_word_t key)
+static void kved_index_reset(kved_ctrl_t *ctrl)
+{
+	memset(&ctrl->index,0,sizeof(ctrl->index));
+}
+
+static uint16_t kved_index_lookup(kved_ctrl_t *ctrl, kved_word_t key)
 {
 	key = KVED_HDR_MASK_KEY(key);
 
-	return (key == KVED_HDR_MASK_KEY(KVED_SIGNATURE_ENTRY)) ||
-		   (key == KVED_HDR_MASK_KEY(KVED_DELETED_ENTRY)) ||
-		   (key == KVED_HDR_MASK_KEY(KVED_FREE_ENTRY)) ? false : true;
+	for(uint16_t pos = kved_index_hash(key) ; ctrl->index.entries[pos].index != KVED_INDEX_NOT_FOUND ; pos = (pos + 1) & (KVED_INDEX_SIZE - 1))
+	{
+		if(ctrl->index.entries[pos].key == key)
+			return ctrl->index.entries[pos].index;
+	}
+
+	return KVED_INDEX_NOT_FOUND;
 }
 
-static uint16_t kved_key_index_find(kved_word_t key)
+static void kved_index_insert(kved_ctrl_t *ctrl, kved_word_t key, uint16_t index)
 {
-	uint16_t key_index = KVED_INDEX_NOT_FOUND;
+	if(ctrl->index.overflow)
+		return;
+
+	key = KVED_HDR_MASK_KEY(key);
+
+	uint16_t pos = kved_index_hash(key);
+
+	while(ctrl->index.entries[pos].index != KVED_INDEX_NOT_FOUND)
+	{
+		// existing key, only its position has changed
+		if(ctrl->index.entries[pos].key == key)
+		{
+			ctrl->index.entries[pos].index = index;
+			return;
+		}
+
+		pos = (pos + 1) & (KVED_INDEX_SIZE - 1);
+	}
+
+	// too many keys for our RAM budget, lookups will scan the sector
+	// until the index is rebuilt (next sector switch or init)
+	if(ctrl->index.num_entries >= KVED_INDEX_MAX_ENTRIES)
+	{
+		ctrl->index.overflow = true;
+		return;
+	}
+
+	ctrl->index.entries[pos].key = key;
+	ctrl->index.entries[pos].index = index;
+	ctrl->index.num_entries++;
+}
+
+static void kved_index_remove(kved_ctrl_t *ctrl, kved_word_t key)
+{
+	if(ctrl->index.overflow)
+		return;
 
 	key = KVED_HDR_MASK_KEY(key);
 
-	for(uint16_t index = ctrl.first_index ; index <= ctrl.last_index ; index += KVED_ENTRY_SIZE_IN_WORDS)
+	uint16_t pos = kved_index_hash(key);
+
+	while(ctrl->index.entries[pos].key != key)
+	{
+		if(ctrl->index.entries[pos].index == KVED_INDEX_NOT_FOUND)
+			return;
+
+		pos = (pos + 1) & (KVED_INDEX_SIZE - 1);
+	}
+
+	// backward shift deletion: move up any entry in the same probe sequence
+	// so lookups never stop too early, no tombstones are required
+	uint16_t hole = pos;
+
+	for(pos = (pos + 1) & (KVED_INDEX_SIZE - 1) ; ctrl->index.entries[pos].index != KVED_INDEX_NOT_FOUND ; pos = (pos + 1) & (KVED_INDEX_SIZE - 1))
 	{
-		kved_word_t key_entry = kved_flash_data_read(ctrl.sector,index);
-		key_entry = KVED_HDR_MASK_KEY(key_entry);
+		uint16_t home = kved_index_hash(ctrl->index.entries[pos].key);
 
-		if(key == key_entry)
+		// entry can be moved if its home bucket is not in the (hole,pos] interval
+		if(((pos - home) & (KVED_INDEX_SIZE - 1)) >= ((pos - hole) & (KVED_INDEX_SIZE - 1)))
 		{
-			key_index = index;
-			break;
+			ctrl->index.entries[hole] = ctrl->index.entries[pos];
+			hole = pos;
 		}
 	}
 
-	return key_index;
+	ctrl->index.entries[hole].key = 0;
+	ctrl->index.entries[hole].index = KVED_INDEX_NOT_FOUND;
+	ctrl->index.num_entries--;
+}
+#else
+static void kved_index_reset(kved_ctrl_t *ctrl)
+{
 }
 
-static kved_word_t kved_value_encode(kved_data_t *data)
+static void kved_index_insert(kved_ctrl_t *ctrl, kved_word_t key, uint16_t index)
 {
-#if KVED_FLASH_WORD_SIZE == 8	
-	return data->value.u64;
+}
+
+static void kved_index_remove(kved_ctrl_t *ctrl, kved_word_t key)
+{
+}
+#endif
+
+#if KVED_BITMAP_ENTRIES > 0
+static uint8_t kved_bit_first_set(uint32_t val)
+{
+#if defined(__GNUC__)
+	return (uint8_t)__builtin_ctz(val);
 #else
-	return data->value.u32;
-#endif	
+	uint8_t bit = 0;
+
+	while((val & 1) == 0)
+	{
+		val >>= 1;
+		bit++;
+	}
+
+	return bit;
+#endif
 }
 
-static void kved_value_decode(kved_data_t *data, kved_word_t value)
+static void kved_used_map_reset(kved_ctrl_t *ctrl, uint16_t num_entries)
 {
-#if KVED_FLASH_WORD_SIZE == 8		
-	data->value.u64 = value;
+	memset(ctrl->used_map,0,sizeof(ctrl->used_map));
+	// sectors larger than the bitmap: iteration will scan the sectors
+	ctrl->used_map_valid = num_entries <= KVED_BITMAP_ENTRIES;
+}
+
+static void kved_used_map_set(kved_ctrl_t *ctrl, uint16_t db_index, bool used)
+{
+	if(!ctrl->used_map_valid)
+		return;
+
+	uint16_t entry = kved_db_index_sector(ctrl,db_index)*kved_sector_entries(ctrl) + 
+		(kved_db_index_offset(ctrl,db_index) - KVED_HDR_SIZE_IN_WORDS)/KVED_ENTRY_SIZE_IN_WORDS;
+
+	if(used)
+		ctrl->used_map[entry/32] |= (1UL << (entry % 32));
+	else
+		ctrl->used_map[entry/32] &= ~(1UL << (entry % 32));
+}
+
+static uint16_t kved_used_map_search(kved_ctrl_t *ctrl, uint16_t db_index)
+{
+	uint16_t sec_entries = kved_sector_entries(ctrl);
+	uint16_t index = kved_db_index_offset(ctrl,db_index);
+
+	// header words: start from the first entry
+	if(index < ctrl->first_index)
+		index = ctrl->first_index;
+
+	uint32_t entry = (uint32_t)kved_db_index_sector(ctrl,db_index)*sec_entries + (index - ctrl->first_index)/KVED_ENTRY_SIZE_IN_WORDS;
+
+	if(entry >= (uint32_t)KVED_FLASH_NUM_SECTORS*sec_entries)
+		return KVED_INDEX_NOT_FOUND;
+
+	uint16_t pos = entry/32;
+	// ignore entries before the starting point
+	uint32_t bits = ctrl->used_map[pos] & (UINT32_MAX << (entry % 32));
+
+	while(bits == 0)
+	{
+		if(++pos >= KVED_BITMAP_WORDS)
+			return KVED_INDEX_NOT_FOUND;
+
+		bits = ctrl->used_map[pos];
+	}
+
+	entry = pos*32 + kved_bit_first_set(bits);
+
+	// bits beyond the last entry are never set
+	return kved_db_index(ctrl,(kved_flash_sector_t)(entry/sec_entries),ctrl->first_index + (entry % sec_entries)*KVED_ENTRY_SIZE_IN_WORDS);
+}
 #else
-	data->value.u32 = value;
+static void kved_used_map_reset(kved_ctrl_t *ctrl, uint16_t num_entries)
+{
+}
+
+static void kved_used_map_set(kved_ctrl_t *ctrl, uint16_t db_index, bool used)
+{
+}
+#endif
+
+static uint32_t kved_bloom_hash(kved_word_t key)
+{
+	// two bit positions are taken from the low and high halves
+#if KVED_FLASH_WORD_SIZE == 8
+	uint32_t h = (uint32_t)(key >> 8) ^ (uint32_t)(key >> 40);
+#else
+	uint32_t h = (uint32_t)(key >> 8);
 #endif
+	h ^= h >> 16;
+	h *= 0x85EBCA6BUL;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35UL;
+	h ^= h >> 16;
+
+	return h;
 }
 
-static void kved_sector_switch(kved_ctrl_t *ctrl, kved_word_t cnt, kved_word_t upd_key, kved_word_t upd_value)
+#if KVED_BLOOM_BITS > 0
+// statistics are updated by concurrent readers (see kved_lock_ops_t), atomically when the CPU supports it
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4)
+#define KVED_BLOOM_STATS_INC(counter) __atomic_fetch_add(&(counter),1,__ATOMIC_RELAXED)
+#else
+#define KVED_BLOOM_STATS_INC(counter) (counter)++
+#endif
+
+static void kved_bloom_reset(kved_ctrl_t *ctrl)
 {
-	uint16_t next_index = KVED_HDR_SIZE_IN_WORDS;
-	uint16_t total_items = 0;
-	uint16_t used_items = 0;
-	kved_flash_sector_t next_sector = ctrl->sector == KVED_FLASH_SECTOR_A ? KVED_FLASH_SECTOR_B : KVED_FLASH_SECTOR_A;
+	memset(ctrl->bloom.bits,0,sizeof(ctrl->bloom.bits));
+}
+
+static void kved_bloom_insert(kved_ctrl_t *ctrl, kved_word_t key)
+{
+	uint32_t h = kved_bloom_hash(KVED_HDR_MASK_KEY(key));
+	uint16_t b1 = (uint16_t)(h & (KVED_BLOOM_BITS - 1));
+	uint16_t b2 = (uint16_t)((h >> 16) & (KVED_BLOOM_BITS - 1));
+
+	ctrl->bloom.bits[b1/32] |= 1UL << (b1 % 32);
+	ctrl->bloom.bits[b2/32] |= 1UL << (b2 % 32);
+}
+
+static bool kved_bloom_check(kved_ctrl_t *ctrl, kved_word_t key)
+{
+	uint32_t h = kved_bloom_hash(KVED_HDR_MASK_KEY(key));
+	uint16_t b1 = (uint16_t)(h & (KVED_BLOOM_BITS - 1));
+	uint16_t b2 = (uint16_t)((h >> 16) & (KVED_BLOOM_BITS - 1));
+
+	KVED_BLOOM_STATS_INC(ctrl->bloom.stats.lookups);
+
+	if((ctrl->bloom.bits[b1/32] & (1UL << (b1 % 32))) && (ctrl->bloom.bits[b2/32] & (1UL << (b2 % 32))))
+		return true;
+
+	KVED_BLOOM_STATS_INC(ctrl->bloom.stats.rejected);
+
+	return false;
+}
+
+static void kved_bloom_miss(kved_ctrl_t *ctrl)
+{
+	KVED_BLOOM_STATS_INC(ctrl->bloom.stats.false_positives);
+}
+#else
+static void kved_bloom_reset(kved_ctrl_t *ctrl)
+{
+}
+
+static void kved_bloom_insert(kved_ctrl_t *ctrl, kved_word_t key)
+{
+}
+
+static bool kved_bloom_check(kved_ctrl_t *ctrl, kved_word_t key)
+{
+	return true;
+}
+
+static void kved_bloom_miss(kved_ctrl_t *ctrl)
+{
+}
+#endif
+
+/** @private */
+typedef struct kved_scan_s
+{
+	kved_t *kv;                             /**< @private */
+	kved_flash_sector_t sector;             /**< @private */
+	uint16_t index;                         /**< @private */
+	uint16_t last_index;                    /**< @private */
+	uint16_t buf_index;                     /**< @private */
+	uint32_t buf_end;                       /**< @private */
+	const kved_word_t *words;               /**< @private */
+	kved_word_t buf[KVED_READ_BLOCK_SIZE];  /**< @private */
+} kved_scan_t;
+
+static void kved_scan_start(kved_t *kv, kved_scan_t *scan, kved_flash_sector_t sec, uint16_t first_index, uint16_t last_index)
+{
+	const kved_word_t *base = kved_ops_sector_address(kv,sec);
+
+	scan->kv = kv;
+	scan->sector = sec;
+	scan->index = first_index;
+	scan->last_index = last_index;
+
+	if(base)
+	{
+		// memory mapped sector: the whole sector works as our buffer
+		scan->words = base;
+		scan->buf_index = 0;
+		scan->buf_end = (uint32_t)last_index + KVED_ENTRY_SIZE_IN_WORDS;
+	}
+	else
+	{
+		scan->words = scan->buf;
+		scan->buf_index = first_index;
+		scan->buf_end = first_index;
+	}
+}
+
+static bool kved_scan_next(kved_scan_t *scan, uint16_t *index, kved_word_t *key, kved_word_t *val)
+{
+	if(scan->index > scan->last_index)
+		return false;
+
+	// refill with as many entries as possible, up to the end of the scan
+	if(scan->index >= scan->buf_end)
+	{
+		uint16_t count = scan->last_index + KVED_ENTRY_SIZE_IN_WORDS - scan->index;
+
+		if(count > KVED_READ_BLOCK_SIZE)
+			count = KVED_READ_BLOCK_SIZE;
+
+		kved_ops_data_read_block(scan->kv,scan->sector,scan->index,scan->buf,count);
+		scan->buf_index = scan->index;
+		scan->buf_end = (uint32_t)scan->index + count;
+	}
+
+	uint16_t pos = scan->index - scan->buf_index;
+
+	*index = scan->index;
+	*key = scan->words[pos];
+	*val = scan->words[pos + 1];
+	scan->index += KVED_ENTRY_SIZE_IN_WORDS;
+
+	return true;
+}
+
+static void kved_entry_read(kved_t *kv, kved_flash_sector_t sec, uint16_t index, kved_word_t *key, kved_word_t *val)
+{
+	const kved_word_t *base = kved_ops_sector_address(kv,sec);
+	kved_word_t entry[KVED_ENTRY_SIZE_IN_WORDS];
+
+	if(base)
+	{
+		*key = base[index];
+		*val = base[index + 1];
+		return;
+	}
+
+	kved_ops_data_read_block(kv,sec,index,entry,KVED_ENTRY_SIZE_IN_WORDS);
+	*key = entry[0];
+	*val = entry[1];
+}
+
+static void kved_db_entry_read(kved_t *kv, uint16_t db_index, kved_word_t *key, kved_word_t *val)
+{
+	kved_entry_read(kv,kved_db_index_sector(&kv->ctrl,db_index),kved_db_index_offset(&kv->ctrl,db_index),key,val);
+}
+
+#ifdef KVED_DEBUG
+const uint8_t *kved_data_type_label[] = 
+{ 
+	(uint8_t *)"U8",
+	(uint8_t *)"I8",
+	(uint8_t *)"U16",
+	(uint8_t *)"I16",
+	(uint8_t *)"U32",
+	(uint8_t *)"I32",
+	(uint8_t *)"FLT",
+	(uint8_t *)"STR",
+#if KVED_FLASH_WORD_SIZE == 8	
+	(uint8_t *)"U64",
+	(uint8_t *)"I64",
+	(uint8_t *)"DBL",
+#endif
+	(uint8_t *)"BLB",
+	(uint8_t *)"CNT",
+};
+
+static void kved_print(kved_word_t val)
+{
+	uint8_t *p = (uint8_t *) &val;
+
+	p += KVED_FLASH_WORD_SIZE - 1;
+	for(uint8_t n = 0 ; n < sizeof(kved_word_t) ; n++, p--)
+		printf("%02X",*p);
+}
+
+static void kved_print_ascii(kved_word_t val, size_t size, bool reverse)
+{
+	uint8_t *p = (uint8_t *) &val;
+
+	if(reverse)
+		p += size - 1;
+
+	for(uint8_t n = 0 ; n < size ; n++)
+	{
+		if(isprint(*p))
+		{
+			printf("%c",*p);
+		}
+		else
+		{
+			printf(".");
+		}
+
+		if(reverse)
+			p--;
+		else
+			p++;
+	}
+}
+
+static void kved_internal_dump(kved_t *kv)
+{
+	kved_word_t hdr;
+	kved_word_t cnt;
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key;
+	kved_word_t val;
+
+	for(uint8_t pos = 0 ; pos < kv->ctrl.num_sectors ; pos++)
+	{
+		kved_flash_sector_t sec = kved_ring_sector(&kv->ctrl,pos);
+		bool first_free_printed = false;
+
+		kved_entry_read(kv,sec,0,&hdr,&cnt);
+
+#if KVED_FLASH_WORD_SIZE == 8
+		printf("HDR (SEC %c)     SIGNATURE        COUNTER\r\n",'A' + sec);
+#else
+		printf("HDR (SEC %c)     SIGNAT.  COUNTER\r\n",'A' + sec);
+#endif	
+		
+		printf("ITEM IDX TYP SZ ");
+		kved_print(hdr);
+		printf(" ");
+		kved_print(cnt);
+		printf("\r\n");
+
+		kved_scan_start(kv,&scan,sec,kv->ctrl.first_index,kv->ctrl.last_index);
+
+		while(!first_free_printed && kved_scan_next(&scan,&index,&key,&val))
+		{
+			if(key == KVED_DELETED_ENTRY)
+			{
+				printf("DEL  ");
+			}
+			else if(key == KVED_FREE_ENTRY)
+			{
+				if(val == KVED_FREE_ENTRY)
+				{
+					printf("FREE ");
+					first_free_printed = true;
+				}
+				else
+				{
+					printf("ERR1 ");
+				}
+			}
+			else if((key & KVED_BLOB_FRAG_MSK) == KVED_BLOB_FRAG_ENTRY)
+			{
+				printf("FRAG ");
+			}
+			else
+			{
+				printf("USED ");
+			}
+
+			uint8_t size = KVED_HDR_MASK_SIZE(key);
+			uint8_t type = KVED_HDR_MASK_TYPE(key);
+
+			if((val == KVED_FREE_ENTRY) || (key == KVED_DELETED_ENTRY) || (key == KVED_FREE_ENTRY) ||
+			   ((key & KVED_BLOB_FRAG_MSK) == KVED_BLOB_FRAG_ENTRY) ||
+			   (type >= sizeof(kved_data_type_label)/sizeof(kved_data_type_label[0])))
+			{
+				printf("%03d        ",index);
+			}
+			else
+			{
+				printf("%03d %3s %02d ",index,(char *)kved_data_type_label[type],size);
+			}
+			kved_print(key);
+			printf(" ");
+			kved_print(val);
+			printf(" ");
+			kved_print_ascii(key,KVED_FLASH_WORD_SIZE,true);
+			printf(" ");
+			kved_print_ascii(val,KVED_FLASH_WORD_SIZE,type == KVED_DATA_TYPE_STRING ? false : true);
+			printf("\r\n");
+		}
+	}
+
+	printf("TOTAL %d USED %d DELETED %d FREE %d\r\n\r\n",
+			kv->ctrl.stats.num_total_entries,
+			kv->ctrl.stats.num_used_entries,
+			kv->ctrl.stats.num_deleted_entries,
+			kv->ctrl.stats.num_free_entries);
+}
+#else
+static void kved_internal_dump(kved_t *kv)
+{
+}
+#endif
+
+static bool kved_is_valid_key(kved_word_t key)
+{
+	key = KVED_HDR_MASK_KEY(key);
+
+	// a zero first char is used by deleted entries and by reserved entries (transactions and blobs)
+	return (key == KVED_HDR_MASK_KEY(KVED_SIGNATURE_ENTRY)) ||
+		   ((key >> (8*KVED_MAX_KEY_SIZE)) == 0) ||
+		   (key == KVED_HDR_MASK_KEY(KVED_FREE_ENTRY)) ? false : true;
+}
+
+static bool kved_is_blob_frag(kved_word_t key)
+{
+	return (key & KVED_BLOB_FRAG_MSK) == KVED_BLOB_FRAG_ENTRY;
+}
+
+// number of fragments of a blob or a counter, given its header (zero for other entries)
+static uint16_t kved_blob_frags(kved_word_t key, kved_word_t val)
+{
+	if(!kved_is_valid_key(key))
+		return 0;
+
+	if(KVED_HDR_MASK_TYPE(key) == KVED_DATA_TYPE_COUNTER)
+		return 1;
+
+	if(KVED_HDR_MASK_TYPE(key) != KVED_DATA_TYPE_BLOB)
+		return 0;
+
+	return ((uint16_t)val + KVED_BLOB_FRAG_SIZE - 1)/KVED_BLOB_FRAG_SIZE;
+}
+
+// keys of single word values, blobs and counters have their own functions
+static bool kved_is_value_key(kved_word_t key)
+{
+	return kved_is_valid_key(key) && (KVED_HDR_MASK_TYPE(key) < KVED_DATA_TYPE_BLOB);
+}
+
+// CRC-16/CCITT-FALSE, for blob headers
+static uint16_t kved_crc16(uint16_t crc, const uint8_t *data, uint16_t size)
+{
+	for(uint16_t n = 0 ; n < size ; n++)
+	{
+		crc ^= (uint16_t)data[n] << 8;
+
+		for(uint8_t b = 0 ; b < 8 ; b++)
+			crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+	}
+
+	return crc;
+}
+
+static bool kved_blob_frag_read(kved_t *kv, kved_flash_sector_t sec, uint16_t index, uint8_t *frag)
+{
+	kved_word_t key;
+	kved_word_t val;
+
+	kved_entry_read(kv,sec,index,&key,&val);
+
+	if(!kved_is_blob_frag(key))
+		return false;
+
+	// value word first, then the key bytes after the marker
+	memcpy(frag,&val,KVED_FLASH_WORD_SIZE);
+
+	for(uint8_t p = 0 ; p < (KVED_BLOB_FRAG_SIZE - KVED_FLASH_WORD_SIZE) ; p++)
+		frag[KVED_FLASH_WORD_SIZE + p] = (uint8_t)(key >> (8*p));
+
+	return true;
+}
+
+// Visit the bytes of the blob whose header is at index, its fragments are just before it.
+// Bytes are copied to dst and compared with cmp (both optional). False for bad blobs or different bytes.
+static bool kved_blob_scan(kved_t *kv, kved_flash_sector_t sec, uint16_t index, uint8_t *dst, const uint8_t *cmp)
+{
+	kved_word_t key;
+	kved_word_t val;
+	uint8_t frag[KVED_BLOB_FRAG_SIZE];
+	uint16_t crc = 0xFFFF;
+
+	kved_entry_read(kv,sec,index,&key,&val);
+
+	uint16_t size = (uint16_t)val;
+	uint16_t num_frags = kved_blob_frags(key,val);
+
+	if((index - kv->ctrl.first_index) < (num_frags*KVED_ENTRY_SIZE_IN_WORDS))
+		return false;
+
+	for(uint16_t f = 0 ; f < num_frags ; f++)
+	{
+		uint16_t len = (size - f*KVED_BLOB_FRAG_SIZE) > KVED_BLOB_FRAG_SIZE ? KVED_BLOB_FRAG_SIZE : size - f*KVED_BLOB_FRAG_SIZE;
+
+		if(!kved_blob_frag_read(kv,sec,index - (num_frags - f)*KVED_ENTRY_SIZE_IN_WORDS,frag))
+			return false;
+
+		if(cmp && memcmp(&cmp[f*KVED_BLOB_FRAG_SIZE],frag,len))
+			return false;
+
+		if(dst)
+			memcpy(&dst[f*KVED_BLOB_FRAG_SIZE],frag,len);
+
+		crc = kved_crc16(crc,frag,len);
+	}
+
+	return crc == (uint16_t)(val >> 16);
+}
+
+static uint8_t kved_bits_count(kved_word_t word)
+{
+	uint8_t count = 0;
+
+	for( ; word ; word &= word - 1)
+		count++;
+
+	return count;
+}
+
+// counter value: the header value plus the bits cleared in its fragment, just before the header
+// bits fragment of a counter, just before its header (false when it is missing or corrupted)
+static bool kved_counter_bits_read(kved_t *kv, uint16_t key_index, kved_word_t *bits_key, kved_word_t *bits_val)
+{
+	uint16_t index = kved_db_index_offset(&kv->ctrl,key_index);
+
+	if(index < (kv->ctrl.first_index + KVED_ENTRY_SIZE_IN_WORDS))
+		return false;
+
+	kved_entry_read(kv,kved_db_index_sector(&kv->ctrl,key_index),index - KVED_ENTRY_SIZE_IN_WORDS,bits_key,bits_val);
+
+	return kved_is_blob_frag(*bits_key);
+}
+
+static kved_word_t kved_counter_value(kved_t *kv, uint16_t key_index, kved_word_t base)
+{
+	kved_word_t bits_key;
+	kved_word_t bits_val;
+
+	// without its fragment, the counter is only its base value
+	if(!kved_counter_bits_read(kv,key_index,&bits_key,&bits_val))
+		return base;
+
+	return base + KVED_COUNTER_BITS - kved_bits_count(bits_val) - kved_bits_count(bits_key & ~KVED_BLOB_FRAG_MSK);
+}
+
+static void kved_sector_stats_read(kved_t *kv)
+{
+	// [0,NV_HDR_SIZE] ARE NOT VALID AS ENTRY INDEXES, THEY ARE RESERVED FOR HEADER
+	kv->ctrl.first_index = KVED_HDR_SIZE_IN_WORDS;
+	kv->ctrl.last_index = (kved_ops_sector_size(kv)/KVED_FLASH_WORD_SIZE) - KVED_HDR_SIZE_IN_WORDS;
+	kv->ctrl.first_free_index = 0;
+	kv->ctrl.tail_deleted_entries = 0;
+
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key;
+	kved_word_t val;
+
+	nv_sector_stats_erase(&kv->ctrl.stats);
+	kved_index_reset(&kv->ctrl);
+	kved_bloom_reset(&kv->ctrl);
+	kved_used_map_reset(&kv->ctrl,KVED_FLASH_NUM_SECTORS*kved_sector_entries(&kv->ctrl));
+
+	// oldest sector first, so the index points to the newest copy of duplicated keys (power loss)
+	for(uint8_t pos = 0 ; pos < kv->ctrl.num_sectors ; pos++)
+	{
+		kved_flash_sector_t sec = kved_ring_sector(&kv->ctrl,pos);
+		uint16_t num_frags = 0;
+
+		kved_scan_start(kv,&scan,sec,kv->ctrl.first_index,kv->ctrl.last_index);
+
+		while(kved_scan_next(&scan,&index,&key,&val))
+		{
+			// blob fragments are counted with the blob header, just after them
+			if(kved_is_blob_frag(key))
+			{
+				num_frags++;
+				continue;
+			}
+
+			uint16_t blob_frags = kved_blob_frags(key,val);
+
+			if(blob_frags > num_frags)
+				blob_frags = num_frags;
+
+			kv->ctrl.stats.num_used_entries += blob_frags;
+
+			// other fragments were left by a power loss
+			for( ; num_frags > blob_frags ; num_frags--)
+				kved_deleted_count(&kv->ctrl,sec);
+
+			num_frags = 0;
+
+			if(key == KVED_FREE_ENTRY)
+			{
+				// only the newest sector receives new entries, free entries
+				// in older sectors are recovered when they are compacted
+				if(sec != kv->ctrl.sector)
+					kved_deleted_count(&kv->ctrl,sec);
+				else if(kv->ctrl.first_free_index == 0)
+					kv->ctrl.first_free_index = index;
+			}
+			else if(kved_is_valid_key(key))
+			{
+				uint16_t db_index = kved_db_index(&kv->ctrl,sec,index);
+
+				kv->ctrl.stats.num_used_entries++;
+				// duplicated keys (power loss) are solved later, the newest one is kept
+				kved_index_insert(&kv->ctrl,key,db_index);
+				kved_bloom_insert(&kv->ctrl,key);
+				kved_used_map_set(&kv->ctrl,db_index,true);
+			}
+			else
+			{
+				// deleted entries and transaction records
+				kved_deleted_count(&kv->ctrl,sec);
+			}
+		}
+
+		for( ; num_frags > 0 ; num_frags--)
+			kved_deleted_count(&kv->ctrl,sec);
+	}
+
+	// standby sector is not available for entries
+	kv->ctrl.stats.num_total_entries = (KVED_FLASH_NUM_SECTORS - 1)*kved_sector_entries(&kv->ctrl);
+	kv->ctrl.stats.num_free_entries = kv->ctrl.stats.num_total_entries - 
+		kv->ctrl.stats.num_used_entries - kv->ctrl.stats.num_deleted_entries;
+}
+
+// free entries of the newest sector
+static uint16_t kved_sector_free_entries(kved_t *kv)
+{
+	if(kv->ctrl.first_free_index == 0)
+		return 0;
+
+	return (kv->ctrl.last_index - kv->ctrl.first_free_index)/KVED_ENTRY_SIZE_IN_WORDS + 1;
+}
+
+void kved_key_decode(kved_data_t *data, kved_word_t key)
+{
+	data->type = KVED_HDR_MASK_TYPE(key);
+
+	uint8_t *pkey = (uint8_t *) &key;
+	pkey += KVED_MAX_KEY_SIZE;
+
+	for(size_t p = 0 ; p < KVED_MAX_KEY_SIZE ; p++)
+		data->key[p] = *pkey--;
+}
+
+kved_word_t kved_key_encode(kved_data_t *data)
+{
+	uint8_t *str_key = data->key;
+	uint8_t key[KVED_MAX_KEY_SIZE];
+
+	strncpy((char *)key,(char *)data->key,KVED_MAX_KEY_SIZE);
+
+	uint8_t size = data->type == KVED_DATA_TYPE_STRING ? strnlen((char *)str_key,KVED_MAX_KEY_SIZE) : kved_data_type_size[data->type];
+	uint8_t hdr = (data->type << 4) | size;
+
+	kved_word_t encoded_key = 0;
+	uint8_t *pkey = (uint8_t *) &encoded_key;
+	pkey += KVED_MAX_KEY_SIZE;
+
+	for(size_t p = 0 ; p < KVED_MAX_KEY_SIZE ; p++)
+		*pkey-- = key[p];
+	
+	*pkey = hdr;
+
+	return encoded_key;
+}
+
+static uint16_t kved_key_index_find(kved_t *kv, kved_word_t key)
+{
+	uint16_t key_index = KVED_INDEX_NOT_FOUND;
+
+	// absent for sure, no lookup required
+	if(!kved_bloom_check(&kv->ctrl,key))
+		return KVED_INDEX_NOT_FOUND;
+
+#if KVED_INDEX_SIZE > 0
+	if(!kv->ctrl.index.overflow)
+	{
+		key_index = kved_index_lookup(&kv->ctrl,key);
+
+		if(key_index == KVED_INDEX_NOT_FOUND)
+			kved_bloom_miss(&kv->ctrl);
+
+		return key_index;
+	}
+#endif
+
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key_entry;
+	kved_word_t val;
+
+	key = KVED_HDR_MASK_KEY(key);
+
+	// newest sector first
+	for(uint8_t pos = kv->ctrl.num_sectors ; (pos > 0) && (key_index == KVED_INDEX_NOT_FOUND) ; pos--)
+	{
+		kved_flash_sector_t sec = kved_ring_sector(&kv->ctrl,pos - 1);
+
+		kved_scan_start(kv,&scan,sec,kv->ctrl.first_index,kv->ctrl.last_index);
+
+		while(kved_scan_next(&scan,&index,&key_entry,&val))
+		{
+			if(key == KVED_HDR_MASK_KEY(key_entry))
+			{
+				key_index = kved_db_index(&kv->ctrl,sec,index);
+				break;
+			}
+		}
+	}
+
+	if(key_index == KVED_INDEX_NOT_FOUND)
+		kved_bloom_miss(&kv->ctrl);
+
+	return key_index;
+}
+
+// marks keys still searched by kved_keys_index_find (not a valid database index)
+#define KVED_INDEX_SEARCHING UINT16_MAX
+
+// same as kved_key_index_find for several keys, all of them searched in a single sector scan
+static void kved_keys_index_find(kved_t *kv, const kved_word_t *keys, uint16_t *indexes, uint16_t count)
+{
+	uint16_t num_searching = 0;
+
+	for(uint16_t n = 0 ; n < count ; n++)
+	{
+		indexes[n] = KVED_INDEX_NOT_FOUND;
+
+#if KVED_INDEX_SIZE > 0
+		if(!kv->ctrl.index.overflow)
+		{
+			indexes[n] = kved_key_index_find(kv,keys[n]);
+			continue;
+		}
+#endif
+		// absent for sure, no lookup required
+		if(kved_bloom_check(&kv->ctrl,keys[n]))
+		{
+			indexes[n] = KVED_INDEX_SEARCHING;
+			num_searching++;
+		}
+	}
+
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key_entry;
+	kved_word_t val;
+
+	// newest sector first
+	for(uint8_t pos = kv->ctrl.num_sectors ; (pos > 0) && (num_searching > 0) ; pos--)
+	{
+		kved_flash_sector_t sec = kved_ring_sector(&kv->ctrl,pos - 1);
+
+		kved_scan_start(kv,&scan,sec,kv->ctrl.first_index,kv->ctrl.last_index);
+
+		while((num_searching > 0) && kved_scan_next(&scan,&index,&key_entry,&val))
+		{
+			if(!kved_is_valid_key(key_entry))
+				continue;
+
+			for(uint16_t n = 0 ; n < count ; n++)
+			{
+				if((indexes[n] == KVED_INDEX_SEARCHING) && (KVED_HDR_MASK_KEY(keys[n]) == KVED_HDR_MASK_KEY(key_entry)))
+				{
+					indexes[n] = kved_db_index(&kv->ctrl,sec,index);
+					num_searching--;
+				}
+			}
+		}
+	}
+
+	for(uint16_t n = 0 ; n < count ; n++)
+	{
+		if(indexes[n] == KVED_INDEX_SEARCHING)
+		{
+			indexes[n] = KVED_INDEX_NOT_FOUND;
+			kved_bloom_miss(&kv->ctrl);
+		}
+	}
+}
+
+static kved_word_t kved_value_encode(kved_data_t *data)
+{
+#if KVED_FLASH_WORD_SIZE == 8	
+	return data->value.u64;
+#else
+	return data->value.u32;
+#endif	
+}
+
+static void kved_value_decode(kved_data_t *data, kved_word_t value)
+{
+#if KVED_FLASH_WORD_SIZE == 8		
+	data->value.u64 = value;
+#else
+	data->value.u32 = value;
+#endif
+}
+
+static kved_flash_sector_t kved_standby_sector(kved_t *kv)
+{
+	return kved_sector_next(kv->ctrl.sector);
+}
+
+static kved_word_t kved_counter_next(kved_word_t cnt)
+{
+	// last value is not valid since it is equal to an erased flash entry
+	if((cnt + 1) == KVED_FLASH_UINT_MAX) // last value, avoiding some #if #def related to flash size
+		return 0;
+
+	return cnt + 1;
+}
+
+static void kved_sector_start(kved_t *kv, kved_flash_sector_t sec)
+{
+	kved_word_t cnt = kved_ops_data_read(kv,kv->ctrl.sector,1);
+
+	// signature is the last item, the sector is ignored until it is written
+	kved_ops_entry_write(kv,sec,0,KVED_SIGNATURE_ENTRY,kved_counter_next(cnt));
+}
+
+static bool kved_standby_is_blank(kved_t *kv, kved_flash_sector_t sec)
+{
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key;
+	kved_word_t val;
+
+	// header included
+	kved_scan_start(kv,&scan,sec,0,kv->ctrl.last_index);
+
+	while(kved_scan_next(&scan,&index,&key,&val))
+	{
+		if((key != KVED_FREE_ENTRY) || (val != KVED_FREE_ENTRY))
+			return false;
+	}
+
+	return true;
+}
+
+// erase the standby sector, unless it is known to be blank (reads are cheaper than erasing)
+static void kved_standby_erase(kved_t *kv)
+{
+	kved_flash_sector_t standby = kved_standby_sector(kv);
+
+	if((kv->ctrl.standby == KVED_STANDBY_DIRTY) || 
+	   ((kv->ctrl.standby == KVED_STANDBY_UNKNOWN) && !kved_standby_is_blank(kv,standby)))
+		kved_ops_sector_erase(kv,standby);
+}
+
+static uint16_t kved_gc_end_index(kved_t *kv)
+{
+	// older sectors are full, live entries are never written after the first free entry
+	if((kv->ctrl.num_sectors > 1) || (kv->ctrl.first_free_index == 0))
+		return kv->ctrl.last_index + KVED_ENTRY_SIZE_IN_WORDS;
+
+	return kv->ctrl.first_free_index;
+}
+
+static void kved_gc_start(kved_t *kv)
+{
+	if(kv->ctrl.gc.active)
+		return;
+
+	// standby sector already erased by the idle hook, only copying is required
+	kved_standby_erase(kv);
+
+	// standby sector has no header until the end, it is ignored after a reset
+	kv->ctrl.standby = KVED_STANDBY_DIRTY;
+	kv->ctrl.gc.active = true;
+	kv->ctrl.gc.src_index = kv->ctrl.first_index;
+	kv->ctrl.gc.dst_index = KVED_HDR_SIZE_IN_WORDS;
+	kv->ctrl.gc.dead_entries = 0;
+}
+
+/** @private */
+typedef struct kved_update_s
+{
+	const kved_word_t *keys;   /**< @private */
+	const kved_word_t *values; /**< @private */
+	bool *done;                /**< @private */
+	uint16_t count;            /**< @private */
+} kved_update_t;
+
+// new values of keys being written, used when their entries are copied (see kved_sector_switch)
+static bool kved_update_apply(kved_update_t *upd, kved_word_t *key, kved_word_t *val)
+{
+	for(uint16_t n = 0 ; (upd != NULL) && (n < upd->count) ; n++)
+	{
+		if(!upd->done[n] && (KVED_HDR_MASK_KEY(upd->keys[n]) == KVED_HDR_MASK_KEY(*key)))
+		{
+			*key = upd->keys[n];
+			*val = upd->values[n];
+			upd->done[n] = true;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// entries copied into the standby sector are programmed in rows of consecutive words
+typedef struct kved_row_s
+{
+	kved_flash_sector_t sector;
+	uint16_t index;
+	uint16_t count;
+	kved_word_t buf[KVED_READ_BLOCK_SIZE];
+} kved_row_t;
+
+static void kved_row_flush(kved_t *kv, kved_row_t *row)
+{
+	if(row->count)
+		kved_ops_data_write_block(kv,row->sector,row->index,row->buf,row->count);
+
+	row->count = 0;
+}
+
+static void kved_row_append(kved_t *kv, kved_row_t *row, kved_word_t key, kved_word_t val)
+{
+	if(row->count == 0)
+		row->index = kv->ctrl.gc.dst_index;
+
+	row->buf[row->count++] = key;
+	row->buf[row->count++] = val;
+	kv->ctrl.gc.dst_index += KVED_ENTRY_SIZE_IN_WORDS;
+
+	if(row->count == KVED_READ_BLOCK_SIZE)
+		kved_row_flush(kv,row);
+}
+
+static void kved_gc_copy(kved_t *kv, uint16_t max_entries, kved_update_t *upd)
+{
+	uint16_t end_index = kved_gc_end_index(kv);
+	uint16_t num_entries = 0;
+
+	kved_row_t row = { .sector = kved_standby_sector(kv), .count = 0 };
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key;
+	kved_word_t val;
+
+	if(kv->ctrl.gc.src_index >= end_index)
+		return;
+
+	kved_scan_start(kv,&scan,kved_tail_sector(&kv->ctrl),kv->ctrl.gc.src_index,end_index - KVED_ENTRY_SIZE_IN_WORDS);
+
+	while((num_entries < max_entries) && kved_scan_next(&scan,&index,&key,&val))
+	{
+		num_entries++;
+
+		if(kved_is_valid_key(key))
+		{
+			// blobs are copied with their fragments, just before the header
+			uint16_t num_frags = kved_blob_frags(key,val);
+
+			// standby sector full of entries invalidated during the copy: start again later
+			if((kv->ctrl.gc.dst_index + num_frags*KVED_ENTRY_SIZE_IN_WORDS) > kv->ctrl.last_index)
+			{
+				kved_row_flush(kv,&row);
+				kv->ctrl.gc.active = false;
+				return;
+			}
+
+			if(kved_update_apply(upd,&key,&val))
+				num_frags = 0;
+
+			for(uint16_t f = num_frags ; f > 0 ; f--)
+			{
+				kved_word_t frag_key;
+				kved_word_t frag_val;
+
+				kved_entry_read(kv,kved_tail_sector(&kv->ctrl),index - f*KVED_ENTRY_SIZE_IN_WORDS,&frag_key,&frag_val);
+				kved_row_append(kv,&row,frag_key,frag_val);
+			}
+
+			// standby sector has no signature yet, so the order of words is not relevant
+			kved_row_append(kv,&row,key,val);
+		}
+
+		kv->ctrl.gc.src_index = index + KVED_ENTRY_SIZE_IN_WORDS;
+	}
+
+	kved_row_flush(kv,&row);
+}
+
+static bool kved_gc_invalidate(kved_t *kv, kved_word_t key)
+{
+	kved_flash_sector_t next_sector = kved_standby_sector(kv);
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key_entry;
+	kved_word_t val;
+
+	if(!kv->ctrl.gc.active || (kv->ctrl.gc.dst_index == KVED_HDR_SIZE_IN_WORDS) || !kved_is_valid_key(key))
+		return false;
+
+	key = KVED_HDR_MASK_KEY(key);
+	kved_scan_start(kv,&scan,next_sector,KVED_HDR_SIZE_IN_WORDS,kv->ctrl.gc.dst_index - KVED_ENTRY_SIZE_IN_WORDS);
+
+	while(kved_scan_next(&scan,&index,&key_entry,&val))
+	{
+		if(kved_is_valid_key(key_entry) && (KVED_HDR_MASK_KEY(key_entry) == key))
+		{
+			uint16_t num_frags = kved_blob_frags(key_entry,val);
+
+			kved_ops_data_write(kv,next_sector,index,KVED_DELETED_ENTRY);
+
+			// blob fragments were copied just before the header
+			for(uint16_t f = 1 ; f <= num_frags ; f++)
+				kved_ops_data_write(kv,next_sector,index - f*KVED_ENTRY_SIZE_IN_WORDS,KVED_DELETED_ENTRY);
+
+			kv->ctrl.gc.dead_entries += num_frags + 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void kved_gc_finish(kved_t *kv)
+{
+	kved_flash_sector_t next_sector = kved_standby_sector(kv);
+	kved_flash_sector_t last_sector = kved_tail_sector(&kv->ctrl);
+
+	kved_sector_start(kv,next_sector);
+	kved_ops_data_write(kv,last_sector,0,0); // only invalidate header, it is faster
+
+	// the oldest sector is the new standby sector
+	kv->ctrl.gc.active = false;
+	kv->ctrl.standby = KVED_STANDBY_DIRTY;
+	kv->ctrl.sector = next_sector;
+	kved_sector_stats_read(kv);
+}
+
+static void kved_sector_open(kved_t *kv)
+{
+	kved_flash_sector_t next_sector = kved_standby_sector(kv);
+
+	kved_standby_erase(kv);
+	kved_sector_start(kv,next_sector);
+
+	// the next standby sector was not used yet or it was left behind before a reset
+	kv->ctrl.standby = KVED_STANDBY_UNKNOWN;
+	kv->ctrl.sector = next_sector;
+	kv->ctrl.num_sectors++;
+	kved_sector_stats_read(kv);
+}
+
+static void kved_sector_switch(kved_t *kv, kved_update_t *upd)
+{
+	// free sectors are still available, nothing to copy
+	if(kv->ctrl.num_sectors < (KVED_FLASH_NUM_SECTORS - 1))
+	{
+		kved_sector_open(kv);
+		return;
+	}
+
+	kved_gc_start(kv);
+	kved_gc_copy(kv,UINT16_MAX,upd);
+
+	// updated entries already copied: drop the copies and add the new values at the end
+	for(uint16_t n = 0 ; kv->ctrl.gc.active && (upd != NULL) && (n < upd->count) ; n++)
+	{
+		if(upd->done[n] || !kved_gc_invalidate(kv,upd->keys[n]))
+			continue;
+
+		if(kv->ctrl.gc.dst_index > kv->ctrl.last_index)
+		{
+			kv->ctrl.gc.active = false;
+			break;
+		}
+
+		kved_flash_sector_t next_sector = kved_standby_sector(kv);
+
+		kved_ops_entry_write(kv,next_sector,kv->ctrl.gc.dst_index,upd->keys[n],upd->values[n]);
+		kv->ctrl.gc.dst_index += KVED_ENTRY_SIZE_IN_WORDS;
+		upd->done[n] = true;
+	}
+
+	if(!kv->ctrl.gc.active)
+	{
+		// copying invalidated entries did not leave space, start again
+		for(uint16_t n = 0 ; (upd != NULL) && (n < upd->count) ; n++)
+			upd->done[n] = false;
+
+		kved_gc_start(kv);
+		kved_gc_copy(kv,UINT16_MAX,upd);
+	}
+
+	kved_gc_finish(kv);
+}
+
+// new entry at the first free entry of the newest sector (there must be one)
+static void kved_entry_append(kved_t *kv, kved_word_t key, kved_word_t value)
+{
+	uint16_t db_index = kved_db_index(&kv->ctrl,kv->ctrl.sector,kv->ctrl.first_free_index);
+
+	kved_ops_entry_write(kv,kv->ctrl.sector,kv->ctrl.first_free_index,key,value);
+	kved_index_insert(&kv->ctrl,key,db_index);
+	kved_bloom_insert(&kv->ctrl,key);
+	kved_used_map_set(&kv->ctrl,db_index,true);
+
+	kv->ctrl.stats.num_free_entries--;
+	kv->ctrl.stats.num_used_entries++;
+	kv->ctrl.first_free_index += KVED_ENTRY_SIZE_IN_WORDS;
+
+	if(kv->ctrl.first_free_index > kv->ctrl.last_index)
+		kv->ctrl.first_free_index = 0;
+}
+
+// old entry of a key already written again
+static void kved_entry_remove(kved_t *kv, kved_word_t key, uint16_t key_index)
+{
+	kved_flash_sector_t sec = kved_db_index_sector(&kv->ctrl,key_index);
+	uint16_t index = kved_db_index_offset(&kv->ctrl,key_index);
+	kved_word_t stored_key;
+	kved_word_t stored_value;
+
+	kved_entry_read(kv,sec,index,&stored_key,&stored_value);
+
+	uint16_t num_frags = kved_blob_frags(stored_key,stored_value);
+
+	kved_ops_data_write(kv,sec,index,KVED_DELETED_ENTRY);
+	kved_used_map_set(&kv->ctrl,key_index,false);
+
+	kved_deleted_count(&kv->ctrl,sec);
+	kv->ctrl.stats.num_used_entries--;
+
+	// blob fragments, just before the header (not other entries, when they are missing)
+	for(uint16_t f = 1 ; f <= num_frags ; f++)
+	{
+		if((index - f*KVED_ENTRY_SIZE_IN_WORDS) < kv->ctrl.first_index)
+			break;
+
+		kved_entry_read(kv,sec,index - f*KVED_ENTRY_SIZE_IN_WORDS,&stored_key,&stored_value);
+
+		if(!kved_is_blob_frag(stored_key))
+			break;
+
+		kved_ops_data_write(kv,sec,index - f*KVED_ENTRY_SIZE_IN_WORDS,KVED_DELETED_ENTRY);
+		kved_deleted_count(&kv->ctrl,sec);
+		kv->ctrl.stats.num_used_entries--;
+	}
+
+	// old value already copied by the garbage collector
+	if(kv->ctrl.gc.active && (sec == kved_tail_sector(&kv->ctrl)) && (index < kv->ctrl.gc.src_index))
+		kved_gc_invalidate(kv,key);
+}
+
+// write a changed value, key_index is the current key entry (or KVED_INDEX_NOT_FOUND for new keys)
+static bool kved_entry_write(kved_t *kv, kved_word_t key, kved_word_t value, uint16_t key_index)
+{
+	bool updated = false;
+	kved_update_t upd = { .keys = &key, .values = &value, .done = &updated, .count = 1 };
+
+	// no space, exchanging sector do not solve this situation, you need more flash space !
+	if(kv->ctrl.stats.num_total_entries == kv->ctrl.stats.num_used_entries)
+		return false;
+
+	// ok, we have space but the newest sector is full. A new sector is started or, when
+	// all sectors are in use, the live entries of the oldest sector are moved to the standby 
+	// sector, leaving the garbage behind. If we are writing an existing entry of the oldest
+	// sector, its value is updated during the process. Several sectors may be compacted
+	// until some space is found.
+	for(uint8_t n = 0 ; (kv->ctrl.first_free_index == 0) && !updated ; n++)
+	{
+		if(n == KVED_FLASH_NUM_SECTORS)
+			return false;
+
+		kved_sector_switch(kv,&upd);
+
+		// entries have moved
+		if(key_index != KVED_INDEX_NOT_FOUND)
+			key_index = kved_key_index_find(kv,key);
+	}
+
+	// An existing entry is moved to the new sector using the new value already, nothing to do anymore.
+	// However we need to take care when a new entry is added or when we are updating an entry 
+	// in the same sector or in another sector. 
+	if(!updated)
+	{
+		kved_entry_append(kv,key,value);
+
+		// Existing data: erase the old entry
+		if(key_index != KVED_INDEX_NOT_FOUND)
+			kved_entry_remove(kv,key,key_index);
+	}
+
+	return true;
+}
+
+// keys and values (up to KVED_BATCH_SIZE) are changed by the write
+static bool kved_batch_write(kved_t *kv, kved_word_t *keys, kved_word_t *values, uint16_t count)
+{
+	uint16_t indexes[KVED_BATCH_SIZE];
+	bool done[KVED_BATCH_SIZE];
+	uint16_t num_pending = 0;
+	uint16_t num_new = 0;
+
+	kved_keys_index_find(kv,keys,indexes,count);
+
+	// only changed values are kept, moved to the beginning of the arrays
+	for(uint16_t n = 0 ; n < count ; n++)
+	{
+		kved_word_t value = values[n];
+		bool overwritten = false;
+
+		// the same key later in the batch: only the last value is written
+		for(uint16_t m = n + 1 ; (m < count) && !overwritten ; m++)
+			overwritten = (KVED_HDR_MASK_KEY(keys[m]) == KVED_HDR_MASK_KEY(keys[n]));
+
+		if(overwritten)
+			continue;
+
+		if(indexes[n] != KVED_INDEX_NOT_FOUND)
+		{
+			kved_word_t stored_key;
+			kved_word_t stored_value;
+
+			kved_db_entry_read(kv,indexes[n],&stored_key,&stored_value);
+
+			// a new type is a change, even for the same value bits
+			if((stored_key == keys[n]) && (stored_value == value))
+				continue;
+		}
+		else
+		{
+			num_new++;
+		}
+
+		keys[num_pending] = keys[n];
+		values[num_pending] = value;
+		indexes[num_pending] = indexes[n];
+		done[num_pending] = false;
+		num_pending++;
+	}
+
+	// no space for the new keys, nothing is written
+	if((kv->ctrl.stats.num_used_entries + num_new) > kv->ctrl.stats.num_total_entries)
+		return false;
+
+	// all sectors in use and no room for the whole batch in the newest one: the oldest 
+	// sector is compacted once, before writing, and the batch values found there are
+	// written during the copy
+	if((num_pending > kved_sector_free_entries(kv)) && (kv->ctrl.num_sectors == (KVED_FLASH_NUM_SECTORS - 1)))
+	{
+		kved_update_t upd = { .keys = keys, .values = values, .done = done, .count = num_pending };
+
+		kved_sector_switch(kv,&upd);
+		kved_keys_index_find(kv,keys,indexes,num_pending);
+	}
+
+	for(uint16_t n = 0 ; n < num_pending ; n++)
+	{
+		if(done[n])
+			continue;
+
+		// still no room: a sector switch is done by the write
+		bool moved = (kv->ctrl.first_free_index == 0);
+
+		if(!kved_entry_write(kv,keys[n],values[n],indexes[n]))
+			return false;
+
+		// entries have moved
+		if(moved)
+			kved_keys_index_find(kv,&keys[n + 1],&indexes[n + 1],num_pending - n - 1);
+	}
+
+	return true;
+}
+
+#if KVED_WRITE_BACK_SIZE > 0
+static uint16_t kved_wb_find(kved_t *kv, kved_word_t key)
+{
+	uint16_t pos;
+
+	for(pos = 0 ; pos < kv->ctrl.wb.count ; pos++)
+	{
+		if(KVED_HDR_MASK_KEY(kv->ctrl.wb.keys[pos]) == KVED_HDR_MASK_KEY(key))
+			break;
+	}
+
+	return pos;
+}
+
+// pending values are written as batches, the last ones first
+static bool kved_wb_flush(kved_t *kv)
+{
+	while(kv->ctrl.wb.count > 0)
+	{
+		kved_word_t keys[KVED_BATCH_SIZE];
+		kved_word_t values[KVED_BATCH_SIZE];
+		uint16_t count = kv->ctrl.wb.count > KVED_BATCH_SIZE ? KVED_BATCH_SIZE : kv->ctrl.wb.count;
+		uint16_t first = kv->ctrl.wb.count - count;
+
+		memcpy(keys,&kv->ctrl.wb.keys[first],count*sizeof(kved_word_t));
+		memcpy(values,&kv->ctrl.wb.values[first],count*sizeof(kved_word_t));
+
+		if(!kved_batch_write(kv,keys,values,count))
+			return false;
+
+		kv->ctrl.wb.count = first;
+	}
+
+	return true;
+}
+
+static bool kved_wb_put(kved_t *kv, kved_word_t key, kved_word_t value)
+{
+	uint16_t pos = kved_wb_find(kv,key);
+
+	if(pos == kv->ctrl.wb.count)
+	{
+		if((kv->ctrl.wb.count == KVED_WRITE_BACK_SIZE) && !kved_wb_flush(kv))
+			return false;
+
+		pos = kv->ctrl.wb.count++;
+	}
+
+	// type may have changed
+	kv->ctrl.wb.keys[pos] = key;
+	kv->ctrl.wb.values[pos] = value;
+
+	return true;
+}
+#endif
+
+// pending value of a key written (or deleted) directly in flash
+static bool kved_wb_drop(kved_t *kv, kved_word_t key)
+{
+#if KVED_WRITE_BACK_SIZE > 0
+	uint16_t pos = kved_wb_find(kv,key);
+
+	if(pos == kv->ctrl.wb.count)
+		return false;
+
+	kv->ctrl.wb.count--;
+	kv->ctrl.wb.keys[pos] = kv->ctrl.wb.keys[kv->ctrl.wb.count];
+	kv->ctrl.wb.values[pos] = kv->ctrl.wb.values[kv->ctrl.wb.count];
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void kved_wb_drop_keys(kved_t *kv, const kved_word_t *keys, uint16_t count)
+{
+	for(uint16_t n = 0 ; n < count ; n++)
+		kved_wb_drop(kv,keys[n]);
+}
+
+static bool kved_internal_data_write(kved_t *kv, kved_word_t key, kved_data_t *data)
+{
+	if(!kv->started)
+		return false;
+
+	if(!kved_is_value_key(key))
+		return false;
+
+	kved_word_t value = kved_value_encode(data);
+	uint16_t key_index = kved_key_index_find(kv,key);
+
+	// check if the value has changed or not (for existing keys)
+	if(key_index != KVED_INDEX_NOT_FOUND)
+	{
+		kved_word_t stored_key;
+		kved_word_t stored_value;
+
+		kved_db_entry_read(kv,key_index,&stored_key,&stored_value);
+
+		// a new type is a change, even for the same value bits
+		if((stored_key == key) && (stored_value == value))
+		{
+			kved_wb_drop(kv,key);
+			return true;
+		}
+	}
+
+	if(!kved_entry_write(kv,key,value,key_index))
+		return false;
+
+	// pending values are only dropped by successful writes
+	kved_wb_drop(kv,key);
+
+#ifdef KVED_DEBUG
+	kved_internal_dump(kv);
+#endif	
+
+	return true;
+}
+
+bool kved_data_write_ex(kved_t *kv, kved_data_t *data)
+{
+	uint16_t result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_data_write(kv,kved_key_encode(data),data);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_data_write(kved_data_t *data)
+{
+	return kved_data_write_ex(&kved_default,data);
+}
+
+bool kved_encoded_data_write_ex(kved_t *kv, kved_word_t key, kved_data_t *data)
+{
+	uint16_t result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_data_write(kv,key,data);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_encoded_data_write(kved_word_t key, kved_data_t *data)
+{
+	return kved_encoded_data_write_ex(&kved_default,key,data);
+}
+
+static bool kved_internal_data_write_deferred(kved_t *kv, kved_word_t key, kved_data_t *data)
+{
+#if KVED_WRITE_BACK_SIZE > 0
+	if(!kv->started)
+		return false;
+
+	if(!kved_is_value_key(key))
+		return false;
+
+	// written later, by kved_flush or when the table is full
+	return kved_wb_put(kv,key,kved_value_encode(data));
+#else
+	return kved_internal_data_write(kv,key,data);
+#endif
+}
+
+bool kved_data_write_deferred_ex(kved_t *kv, kved_data_t *data)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_data_write_deferred(kv,kved_key_encode(data),data);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_data_write_deferred(kved_data_t *data)
+{
+	return kved_data_write_deferred_ex(&kved_default,data);
+}
+
+static bool kved_internal_data_write_batch(kved_t *kv, kved_data_t *items, size_t n)
+{
+	if(!kv->started)
+		return false;
+
+	// keys are resolved in groups of KVED_BATCH_SIZE items
+	for(size_t first = 0 ; first < n ; first += KVED_BATCH_SIZE)
+	{
+		kved_word_t keys[KVED_BATCH_SIZE];
+		kved_word_t values[KVED_BATCH_SIZE];
+		uint16_t count = (n - first) > KVED_BATCH_SIZE ? KVED_BATCH_SIZE : (uint16_t)(n - first);
+
+		for(uint16_t m = 0 ; m < count ; m++)
+		{
+			keys[m] = kved_key_encode(&items[first + m]);
+
+			if(!kved_is_value_key(keys[m]))
+				return false;
+
+			values[m] = kved_value_encode(&items[first + m]);
+		}
+
+		if(!kved_batch_write(kv,keys,values,count))
+			return false;
+
+		// keys are reordered by the batch write
+		for(uint16_t m = 0 ; m < count ; m++)
+			kved_wb_drop(kv,kved_key_encode(&items[first + m]));
+	}
+
+#ifdef KVED_DEBUG
+	kved_internal_dump(kv);
+#endif	
+
+	return true;
+}
+
+bool kved_data_write_batch_ex(kved_t *kv, kved_data_t *items, size_t n)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_data_write_batch(kv,items,n);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_data_write_batch(kved_data_t *items, size_t n)
+{
+	return kved_data_write_batch_ex(&kved_default,items,n);
+}
+
+static bool kved_internal_flush(kved_t *kv)
+{
+	if(!kv->started)
+		return false;
+
+#if KVED_WRITE_BACK_SIZE > 0
+	if(!kved_wb_flush(kv))
+		return false;
+
+#ifdef KVED_DEBUG
+	kved_internal_dump(kv);
+#endif	
+#endif
+
+	return true;
+}
+
+bool kved_flush_ex(kved_t *kv)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_flush(kv);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_flush(void)
+{
+	return kved_flush_ex(&kved_default);
+}
+
+void kved_txn_begin(kved_txn_t *txn)
+{
+	txn->count = 0;
+	txn->failed = false;
+}
+
+bool kved_txn_put(kved_txn_t *txn, kved_data_t *data)
+{
+	kved_word_t key = kved_key_encode(data);
+	uint16_t n;
+
+	if(!kved_is_value_key(key))
+	{
+		txn->failed = true;
+		return false;
+	}
+
+	for(n = 0 ; n < txn->count ; n++)
+	{
+		if(KVED_HDR_MASK_KEY(txn->keys[n]) == KVED_HDR_MASK_KEY(key))
+			break;
+	}
+
+	if(n == KVED_TXN_SIZE)
+	{
+		txn->failed = true;
+		return false;
+	}
+
+	txn->keys[n] = key;
+	txn->values[n] = kved_value_encode(data);
+
+	if(n == txn->count)
+		txn->count++;
+
+	return true;
+}
+
+static bool kved_internal_txn_commit(kved_t *kv, kved_txn_t *txn)
+{
+	uint16_t indexes[KVED_TXN_SIZE];
+	uint16_t num_pending = 0;
+	uint16_t num_new = 0;
+	bool moved = false;
+
+	if(!kv->started || txn->failed)
+		return false;
+
+	kved_keys_index_find(kv,txn->keys,indexes,txn->count);
+
+	// only changed values are kept, moved to the beginning (all keys are kept for the write-back table)
+	for(uint16_t n = 0 ; n < txn->count ; n++)
+	{
+		if(indexes[n] != KVED_INDEX_NOT_FOUND)
+		{
+			kved_word_t stored_key;
+			kved_word_t stored_value;
+
+			kved_db_entry_read(kv,indexes[n],&stored_key,&stored_value);
+
+			if((stored_key == txn->keys[n]) && (stored_value == txn->values[n]))
+				continue;
+		}
+		else
+		{
+			num_new++;
+		}
+
+		kved_word_t key = txn->keys[n];
+		kved_word_t value = txn->values[n];
+
+		txn->keys[n] = txn->keys[num_pending];
+		txn->values[n] = txn->values[num_pending];
+		txn->keys[num_pending] = key;
+		txn->values[num_pending] = value;
+		indexes[num_pending] = indexes[n];
+		num_pending++;
+	}
+
+	uint16_t count = txn->count;
+
+	txn->count = 0;
+
+	if(num_pending == 0)
+	{
+		kved_wb_drop_keys(kv,txn->keys,count);
+		return true;
+	}
+
+	// the transaction record and the new values must fit in the newest sector, with the old values still there
+	if(((num_pending + 1) > kved_sector_entries(&kv->ctrl)) || 
+	   ((kv->ctrl.stats.num_used_entries + num_new + 1) > kv->ctrl.stats.num_total_entries))
+		return false;
+
+	// sector switches before writing, without new values in the copies
+	for(uint8_t n = 0 ; kved_sector_free_entries(kv) < (num_pending + 1) ; n++)
+	{
+		if(n == KVED_FLASH_NUM_SECTORS)
+			return false;
+
+		kved_sector_switch(kv,NULL);
+		moved = true;
+	}
+
+	// entries have moved
+	if(moved)
+		kved_keys_index_find(kv,txn->keys,indexes,num_pending);
+
+	// pending values are only dropped by successful commits
+	kved_wb_drop_keys(kv,txn->keys,count);
+
+	// transaction record with the number of values, first data, after key
+	uint16_t txn_index = kv->ctrl.first_free_index;
+
+	kved_ops_entry_write(kv,kv->ctrl.sector,txn_index,KVED_TXN_ENTRY,num_pending);
+	kv->ctrl.stats.num_free_entries--;
+	kv->ctrl.first_free_index += KVED_ENTRY_SIZE_IN_WORDS;
+
+	for(uint16_t n = 0 ; n < num_pending ; n++)
+		kved_entry_append(kv,txn->keys[n],txn->values[n]);
+
+	// commit: deleting the transaction record, new values are valid from now on
+	kved_ops_data_write(kv,kv->ctrl.sector,txn_index,KVED_DELETED_ENTRY);
+	kved_deleted_count(&kv->ctrl,kv->ctrl.sector);
+
+	for(uint16_t n = 0 ; n < num_pending ; n++)
+	{
+		if(indexes[n] != KVED_INDEX_NOT_FOUND)
+			kved_entry_remove(kv,txn->keys[n],indexes[n]);
+	}
+
+#ifdef KVED_DEBUG
+	kved_internal_dump(kv);
+#endif	
+
+	return true;
+}
+
+bool kved_txn_commit_ex(kved_t *kv, kved_txn_t *txn)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_txn_commit(kv,txn);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_txn_commit(kved_txn_t *txn)
+{
+	return kved_txn_commit_ex(&kved_default,txn);
+}
+
+static kved_word_t kved_str_key_encode(const char *key, kved_data_types_t type)
+{
+	kved_data_t data = { .type = type };
+
+	memcpy(data.key,key,strnlen(key,KVED_MAX_KEY_SIZE));
+
+	return kved_key_encode(&data);
+}
+
+// blob fragment at the first free entry of the newest sector, without index (only headers are indexed)
+static void kved_blob_frag_append(kved_t *kv, const uint8_t *frag)
+{
+	kved_word_t key = KVED_BLOB_FRAG_ENTRY;
+	kved_word_t val;
+
+	memcpy(&val,frag,KVED_FLASH_WORD_SIZE);
+
+	for(uint8_t p = 0 ; p < (KVED_BLOB_FRAG_SIZE - KVED_FLASH_WORD_SIZE) ; p++)
+		key |= (kved_word_t)frag[KVED_FLASH_WORD_SIZE + p] << (8*p);
+
+	kved_ops_entry_write(kv,kv->ctrl.sector,kv->ctrl.first_free_index,key,val);
+
+	kv->ctrl.stats.num_free_entries--;
+	kv->ctrl.stats.num_used_entries++;
+	kv->ctrl.first_free_index += KVED_ENTRY_SIZE_IN_WORDS;
+
+	if(kv->ctrl.first_free_index > kv->ctrl.last_index)
+		kv->ctrl.first_free_index = 0;
+}
+
+static bool kved_internal_blob_write(kved_t *kv, kved_word_t key, const uint8_t *blob, uint16_t size)
+{
+	uint16_t num_frags = (size + KVED_BLOB_FRAG_SIZE - 1)/KVED_BLOB_FRAG_SIZE;
+	uint16_t num_old = 0;
+	bool moved = false;
+
+	if(!kv->started)
+		return false;
+
+	if(!kved_is_valid_key(key))
+		return false;
+
+	kved_wb_drop(kv,key);
+
+	// blob size and CRC in the header
+	kved_word_t value = (kved_word_t)size | ((kved_word_t)kved_crc16(0xFFFF,blob,size) << 16);
+	uint16_t key_index = kved_key_index_find(kv,key);
+
+	// check if the blob has changed or not (for existing keys)
+	if(key_index != KVED_INDEX_NOT_FOUND)
+	{
+		kved_word_t stored_key;
+		kved_word_t stored_value;
+
+		kved_db_entry_read(kv,key_index,&stored_key,&stored_value);
+
+		if((stored_key == key) && (stored_value == value) && 
+		   kved_blob_scan(kv,kved_db_index_sector(&kv->ctrl,key_index),kved_db_index_offset(&kv->ctrl,key_index),NULL,blob))
+			return true;
+
+		num_old = kved_blob_frags(stored_key,stored_value) + 1;
+	}
+
+	// header and fragments must fit in the newest sector, with the old blob still there
+	if(((num_frags + 1) > kved_sector_entries(&kv->ctrl)) || 
+	   ((kv->ctrl.stats.num_used_entries - num_old + num_frags + 1) > kv->ctrl.stats.num_total_entries))
+		return false;
+
+	for(uint8_t n = 0 ; kved_sector_free_entries(kv) < (num_frags + 1) ; n++)
+	{
+		if(n == KVED_FLASH_NUM_SECTORS)
+			return false;
+
+		kved_sector_switch(kv,NULL);
+		moved = true;
+	}
+
+	// entries have moved
+	if(moved && (key_index != KVED_INDEX_NOT_FOUND))
+		key_index = kved_key_index_find(kv,key);
+
+	for(uint16_t f = 0 ; f < num_frags ; f++)
+	{
+		uint8_t frag[KVED_BLOB_FRAG_SIZE];
+		uint16_t len = (size - f*KVED_BLOB_FRAG_SIZE) > KVED_BLOB_FRAG_SIZE ? KVED_BLOB_FRAG_SIZE : size - f*KVED_BLOB_FRAG_SIZE;
+
+		memset(frag,0xFF,sizeof(frag));
+		memcpy(frag,&blob[f*KVED_BLOB_FRAG_SIZE],len);
+		kved_blob_frag_append(kv,frag);
+	}
+
+	// header is the last one: the blob is valid from now on
+	kved_entry_append(kv,key,value);
+
+	if(key_index != KVED_INDEX_NOT_FOUND)
+		kved_entry_remove(kv,key,key_index);
+
+#ifdef KVED_DEBUG
+	kved_internal_dump(kv);
+#endif	
+
+	return true;
+}
+
+bool kved_blob_write_ex(kved_t *kv, const char *key, const void *blob, uint16_t size)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_blob_write(kv,kved_str_key_encode(key,KVED_DATA_TYPE_BLOB),blob,size);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_blob_write(const char *key, const void *blob, uint16_t size)
+{
+	return kved_blob_write_ex(&kved_default,key,blob,size);
+}
+
+static bool kved_internal_blob_read(kved_t *kv, kved_word_t key, uint8_t *blob, uint16_t *size)
+{
+	if(!kv->started)
+		return false;
+
+	if(!kved_is_valid_key(key))
+		return false;
+
+	uint16_t key_index = kved_key_index_find(kv,key);
+
+	if(key_index == KVED_INDEX_NOT_FOUND)
+		return false;
+
+	kved_word_t stored_key;
+	kved_word_t stored_value;
+
+	kved_db_entry_read(kv,key_index,&stored_key,&stored_value);
+
+	// stored with another type
+	if(KVED_HDR_MASK_TYPE(stored_key) != KVED_DATA_TYPE_BLOB)
+		return false;
+
+	// not enough room, but the caller knows the blob size now
+	if((uint16_t)stored_value > *size)
+	{
+		*size = (uint16_t)stored_value;
+		return false;
+	}
+
+	*size = (uint16_t)stored_value;
+
+	return kved_blob_scan(kv,kved_db_index_sector(&kv->ctrl,key_index),kved_db_index_offset(&kv->ctrl,key_index),blob,NULL);
+}
+
+bool kved_blob_read_ex(kved_t *kv, const char *key, void *blob, uint16_t *size)
+{
+	bool result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_blob_read(kv,kved_str_key_encode(key,KVED_DATA_TYPE_BLOB),blob,size);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+bool kved_blob_read(const char *key, void *blob, uint16_t *size)
+{
+	return kved_blob_read_ex(&kved_default,key,blob,size);
+}
+
+static bool kved_internal_counter_inc(kved_t *kv, kved_word_t key)
+{
+	kved_word_t count = 1;
+	bool moved = false;
+
+	if(!kv->started)
+		return false;
+
+	if(!kved_is_valid_key(key))
+		return false;
+
+	kved_wb_drop(kv,key);
+
+	uint16_t key_index = kved_key_index_find(kv,key);
+
+	if(key_index != KVED_INDEX_NOT_FOUND)
+	{
+		kved_word_t stored_key;
+		kved_word_t stored_value;
+
+		kved_db_entry_read(kv,key_index,&stored_key,&stored_value);
+
+		if(KVED_HDR_MASK_TYPE(stored_key) != KVED_DATA_TYPE_COUNTER)
+			return false;
+
+#if KVED_FLASH_BIT_CLEAR
+		// otherwise, programmed words only accept zero: new entries on each increment
+		kved_flash_sector_t sec = kved_db_index_sector(&kv->ctrl,key_index);
+		uint16_t index = kved_db_index_offset(&kv->ctrl,key_index);
+		kved_word_t bits_key;
+		kved_word_t bits_val;
+
+		// a copy made by the garbage collector would not see the cleared bit
+		bool copied = kv->ctrl.gc.active && (sec == kved_tail_sector(&kv->ctrl)) && (index < kv->ctrl.gc.src_index);
+		// bits are only cleared in a fragment, a corrupted counter is written again from its base value
+		bool in_place = !copied && kved_counter_bits_read(kv,key_index,&bits_key,&bits_val);
+
+		// one bit cleared in place, value word first
+		if(in_place && (bits_val != 0))
+		{
+			kved_ops_data_write(kv,sec,index - KVED_ENTRY_SIZE_IN_WORDS + 1,bits_val & (bits_val - 1));
+			return true;
+		}
+
+		if(in_place && ((bits_key & ~KVED_BLOB_FRAG_MSK) != 0))
+		{
+			kved_ops_data_write(kv,sec,index - KVED_ENTRY_SIZE_IN_WORDS,bits_key & (bits_key - 1));
+			return true;
+		}
+#endif
+
+		count = kved_counter_value(kv,key_index,stored_value) + 1;
+	}
+
+	// new counter entries, with the old ones still there
+	if((kv->ctrl.stats.num_used_entries + (key_index == KVED_INDEX_NOT_FOUND ? 2 : 0)) > kv->ctrl.stats.num_total_entries)
+		return false;
+
+	for(uint8_t n = 0 ; kved_sector_free_entries(kv) < 2 ; n++)
+	{
+		if(n == KVED_FLASH_NUM_SECTORS)
+			return false;
+
+		kved_sector_switch(kv,NULL);
+		moved = true;
+	}
+
+	// entries have moved
+	if(moved && (key_index != KVED_INDEX_NOT_FOUND))
+		key_index = kved_key_index_find(kv,key);
+
+	uint8_t bits[KVED_BLOB_FRAG_SIZE];
+
+	memset(bits,0xFF,sizeof(bits));
+	kved_blob_frag_append(kv,bits);
+
+	// header is the last one: the counter is valid from now on
+	kved_entry_append(kv,key,count);
+
+	if(key_index != KVED_INDEX_NOT_FOUND)
+		kved_entry_remove(kv,key,key_index);
+
+#ifdef KVED_DEBUG
+	kved_internal_dump(kv);
+#endif	
+
+	return true;
+}
+
+bool kved_counter_inc_ex(kved_t *kv, const char *key)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_counter_inc(kv,kved_str_key_encode(key,KVED_DATA_TYPE_COUNTER));
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_counter_inc(const char *key)
+{
+	return kved_counter_inc_ex(&kved_default,key);
+}
+
+static bool kved_internal_counter_get(kved_t *kv, kved_word_t key, kved_word_t *value)
+{
+	if(!kv->started)
+		return false;
+
+	if(!kved_is_valid_key(key))
+		return false;
+
+	uint16_t key_index = kved_key_index_find(kv,key);
+
+	if(key_index == KVED_INDEX_NOT_FOUND)
+		return false;
+
+	kved_word_t stored_key;
+	kved_word_t stored_value;
+
+	kved_db_entry_read(kv,key_index,&stored_key,&stored_value);
+
+	if(KVED_HDR_MASK_TYPE(stored_key) != KVED_DATA_TYPE_COUNTER)
+		return false;
+
+	*value = kved_counter_value(kv,key_index,stored_value);
+
+	return true;
+}
+
+bool kved_counter_get_ex(kved_t *kv, const char *key, kved_word_t *value)
+{
+	bool result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_counter_get(kv,kved_str_key_encode(key,KVED_DATA_TYPE_COUNTER),value);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+bool kved_counter_get(const char *key, kved_word_t *value)
+{
+	return kved_counter_get_ex(&kved_default,key,value);
+}
+
+static uint16_t kved_used_index_search(kved_t *kv, uint16_t start_index)
+{
+#if KVED_BITMAP_ENTRIES > 0
+	if(kv->ctrl.used_map_valid)
+		return kved_used_map_search(&kv->ctrl,start_index);
+#endif
+
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key;
+	kved_word_t val;
+
+	uint16_t first_index = kved_db_index_offset(&kv->ctrl,start_index);
+
+	// sector order, starting from the sector of the given index
+	for(uint8_t sec = kved_db_index_sector(&kv->ctrl,start_index) ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+	{
+		if(first_index < kv->ctrl.first_index)
+			first_index = kv->ctrl.first_index;
+
+		if(kved_sector_in_use(&kv->ctrl,sec))
+		{
+			kved_scan_start(kv,&scan,sec,first_index,kv->ctrl.last_index);
+
+			while(kved_scan_next(&scan,&index,&key,&val))
+			{
+				if(kved_is_valid_key(key))
+					return kved_db_index(&kv->ctrl,sec,index);
+			}
+		}
+
+		first_index = kv->ctrl.first_index;
+	}
+
+	return KVED_INDEX_NOT_FOUND;
+}
+
+static uint16_t kved_internal_first_used_index_get(kved_t *kv)
+{
+	return kved_used_index_search(kv,kv->ctrl.first_index);
+}
+
+uint16_t kved_first_used_index_get_ex(kved_t *kv)
+{
+	uint16_t result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_first_used_index_get(kv);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+uint16_t kved_first_used_index_get(void)
+{
+	return kved_first_used_index_get_ex(&kved_default);
+}
+
+static uint16_t kved_internal_next_used_index_get(kved_t *kv, uint16_t last_index)
+{
+	if(last_index >= kved_db_index(&kv->ctrl,KVED_FLASH_NUM_SECTORS - 1,kv->ctrl.last_index))
+		return KVED_INDEX_NOT_FOUND;
+
+	return kved_used_index_search(kv,last_index + KVED_ENTRY_SIZE_IN_WORDS);
+}
+
+uint16_t kved_next_used_index_get_ex(kved_t *kv, uint16_t last_index)
+{
+	uint16_t result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_next_used_index_get(kv,last_index);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+uint16_t kved_next_used_index_get(uint16_t last_index)
+{
+	return kved_next_used_index_get_ex(&kved_default,last_index);
+}
+
+static bool kved_internal_data_read_by_index(kved_t *kv, uint16_t index, kved_data_t *data)
+{
+	if(!kved_db_index_is_valid(&kv->ctrl,index))
+		return false;
+
+	kved_word_t key;
+	kved_word_t val;
+
+	kved_db_entry_read(kv,index,&key,&val);
+
+	if(!kved_is_valid_key(key))
+		return false;
+
+	if(KVED_HDR_MASK_TYPE(key) == KVED_DATA_TYPE_COUNTER)
+		val = kved_counter_value(kv,index,val);
+
+	kved_value_decode(data,val);
+	kved_key_decode(data,key);
+
+	return true;
+}
+
+bool kved_data_read_by_index_ex(kved_t *kv, uint16_t index, kved_data_t *data)
+{
+	uint16_t result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_data_read_by_index(kv,index,data);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+bool kved_data_read_by_index(uint16_t index, kved_data_t *data)
+{
+	return kved_data_read_by_index_ex(&kved_default,index,data);
+}
+
+static uint16_t kved_internal_free_entries_get(kved_t *kv)
+{
+	if(!kv->started)
+		return 0;
+
+	uint16_t entries = kv->ctrl.stats.num_total_entries - kv->ctrl.stats.num_used_entries;
+
+	return entries;
+}
+
+uint16_t kved_free_entries_get_ex(kved_t *kv)
+{
+	uint16_t result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_free_entries_get(kv);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+uint16_t kved_free_entries_get(void)
+{
+	return kved_free_entries_get_ex(&kved_default);
+}
+
+static uint16_t kved_internal_total_entries_get(kved_t *kv)
+{
+	if(!kv->started)
+		return 0;
+
+	return kv->ctrl.stats.num_total_entries;
+}
+
+uint16_t kved_total_entries_get_ex(kved_t *kv)
+{
+	uint16_t result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_total_entries_get(kv);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+uint16_t kved_total_entries_get(void)
+{
+	return kved_total_entries_get_ex(&kved_default);
+}
+
+static uint16_t kved_internal_used_entries_get(kved_t *kv)
+{
+	if(!kv->started)
+		return 0;
+
+	return kv->ctrl.stats.num_used_entries;
+}
+
+uint16_t kved_used_entries_get_ex(kved_t *kv)
+{
+	uint16_t result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_used_entries_get(kv);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+uint16_t kved_used_entries_get(void)
+{
+	return kved_used_entries_get_ex(&kved_default);
+}
+
+static bool kved_internal_data_read(kved_t *kv, kved_word_t key, uint16_t *hint, kved_data_t *data)
+{
+	uint16_t key_index = KVED_INDEX_NOT_FOUND;
+	kved_word_t key_entry;
+	kved_word_t value;
+
+	if(!kv->started)
+		return false;
+
+	if(!kved_is_valid_key(key))
+		return false;
+
+#if KVED_WRITE_BACK_SIZE > 0
+	uint16_t pos = kved_wb_find(kv,key);
+
+	// pending values are the newest ones
+	if(pos < kv->ctrl.wb.count)
+	{
+		data->type = KVED_HDR_MASK_TYPE(kv->ctrl.wb.keys[pos]);
+		kved_value_decode(data,kv->ctrl.wb.values[pos]);
+
+		return true;
+	}
+#endif
+
+	// last known position still holds our key: no lookup required
+	if(hint && kved_db_index_is_valid(&kv->ctrl,*hint))
+	{
+		kved_db_entry_read(kv,*hint,&key_entry,&value);
+
+		if(KVED_HDR_MASK_KEY(key_entry) == KVED_HDR_MASK_KEY(key))
+			key_index = *hint;
+	}
+
+	if(key_index == KVED_INDEX_NOT_FOUND)
+	{
+		key_index = kved_key_index_find(kv,key);
+
+		if(hint)
+			*hint = key_index;
+
+		if(key_index == KVED_INDEX_NOT_FOUND)
+			return false;
+
+		kved_db_entry_read(kv,key_index,&key_entry,&value);
+	}
+
+	// blob headers only hold the blob size and CRC, blobs are read by kved_blob_read
+	if(KVED_HDR_MASK_TYPE(key_entry) == KVED_DATA_TYPE_BLOB)
+		return false;
+
+	// update the type as user may not know about them before calling
+	data->type = KVED_HDR_MASK_TYPE(key_entry);
+
+	if(data->type == KVED_DATA_TYPE_COUNTER)
+		value = kved_counter_value(kv,key_index,value);
+
+	kved_value_decode(data,value);
+
+	return true;
+}
+
+bool kved_data_read_ex(kved_t *kv, kved_data_t *data)
+{
+	bool result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_data_read(kv,kved_key_encode(data),NULL,data);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+bool kved_data_read(kved_data_t *data)
+{
+	return kved_data_read_ex(&kved_default,data);
+}
+
+bool kved_encoded_data_read_ex(kved_t *kv, kved_word_t key, uint16_t *hint, kved_data_t *data)
+{
+	bool result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_data_read(kv,key,hint,data);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+bool kved_encoded_data_read(kved_word_t key, uint16_t *hint, kved_data_t *data)
+{
+	return kved_encoded_data_read_ex(&kved_default,key,hint,data);
+}
+
+static const kved_value_t *kved_internal_data_view(kved_t *kv, kved_data_t *data)
+{
+	if(!kv->started)
+		return NULL;
+
+	// all sectors are mapped or none
+	if(kved_ops_sector_address(kv,kv->ctrl.sector) == NULL)
+		return NULL;
+
+	kved_word_t key = kved_key_encode(data);
+
+	if(!kved_is_valid_key(key))
+		return NULL;
+
+#if KVED_WRITE_BACK_SIZE > 0
+	// flash value is not the newest one
+	if(kved_wb_find(kv,key) < kv->ctrl.wb.count)
+		return NULL;
+#endif
+
+	uint16_t key_index = kved_key_index_find(kv,key);
+
+	if(key_index == KVED_INDEX_NOT_FOUND)
+		return NULL;
+
+	const kved_word_t *base = kved_ops_sector_address(kv,kved_db_index_sector(&kv->ctrl,key_index));
+	uint16_t index = kved_db_index_offset(&kv->ctrl,key_index);
+
+	data->type = KVED_HDR_MASK_TYPE(base[index]);
+
+	// counter values are not in a single word and blob values are in fragments
+	if((data->type == KVED_DATA_TYPE_COUNTER) || (data->type == KVED_DATA_TYPE_BLOB))
+		return NULL;
+
+	return (const kved_value_t *) &base[index + 1];
+}
+
+const kved_value_t *kved_data_view_ex(kved_t *kv, kved_data_t *data)
+{
+	const kved_value_t *result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_data_view(kv,data);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+const kved_value_t *kved_data_view(kved_data_t *data)
+{
+	return kved_data_view_ex(&kved_default,data);
+}
+
+static bool kved_internal_data_delete(kved_t *kv, kved_word_t key)
+{
+	if(!kv->started)
+		return false;
+
+	if(!kved_is_valid_key(key))
+		return false;
+
+	bool pending = kved_wb_drop(kv,key);
+	uint16_t key_index = kved_key_index_find(kv,key);
+
+	if(key_index == KVED_INDEX_NOT_FOUND)
+		return pending;
+
+	kved_entry_remove(kv,key,key_index);
+	kved_index_remove(&kv->ctrl,key);
+
+#ifdef KVED_DEBUG
+	kved_internal_dump(kv);
+#endif	
+
+	return true;
+}
+
+bool kved_data_delete_ex(kved_t *kv, kved_data_t *data)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_data_delete(kv,kved_key_encode(data));
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_data_delete(kved_data_t *data)
+{
+	return kved_data_delete_ex(&kved_default,data);
+}
+
+// FNV-1a, 64 bits
+static uint64_t kved_long_key_hash(const char *name)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	while(*name)
+		hash = (hash ^ (uint8_t)*name++)*0x100000001B3ULL;
+
+	return hash;
+}
+
+static kved_word_t kved_long_key_make(const char *name, kved_data_types_t type, uint8_t marker)
+{
+	kved_data_t data = { .type = type };
+	uint64_t hash = kved_long_key_hash(name);
+
+	// keys are strings, no zero chars
+	for(uint8_t p = 0 ; p < KVED_MAX_KEY_SIZE ; p++, hash >>= 8)
+		data.key[p] = (uint8_t)hash ? (uint8_t)hash : 1;
+
+	data.key[0] = marker | (data.key[0] & ~KVED_LONG_KEY_MARKER_MSK);
+
+	return kved_key_encode(&data);
+}
+
+kved_word_t kved_long_key_encode(const char *name, kved_data_types_t type)
+{
+	return kved_long_key_make(name,type,KVED_LONG_KEY_MARKER);
+}
+
+#if KVED_LONG_KEY_NAMES > 0
+// true when the stored name of the hashed key is this one (found tells if there is a stored name)
+static bool kved_long_key_name_match(kved_t *kv, const char *name, bool *found)
+{
+	kved_word_t name_key = kved_long_key_make(name,KVED_DATA_TYPE_BLOB,KVED_LONG_KEY_NAME_MARKER);
+	uint16_t len = strlen(name);
+	uint8_t stored[KVED_LONG_KEY_SIZE];
+	uint16_t size = sizeof(stored);
+
+	*found = kved_internal_blob_read(kv,name_key,stored,&size);
+
+	return *found && (size == len) && (memcmp(stored,name,len) == 0);
+}
+
+// stored name of a long key, also used to detect hash collisions
+static bool kved_long_key_name_store(kved_t *kv, const char *name)
+{
+	bool found;
+
+	if(kved_long_key_name_match(kv,name,&found))
+		return true;
+
+	// another name with the same hash
+	if(found)
+		return false;
+
+	return kved_internal_blob_write(kv,kved_long_key_make(name,KVED_DATA_TYPE_BLOB,KVED_LONG_KEY_NAME_MARKER),(const uint8_t *)name,strlen(name));
+}
+#endif
+
+static bool kved_internal_long_key_data_write(kved_t *kv, const char *name, kved_data_t *data)
+{
+	if(strnlen(name,KVED_LONG_KEY_SIZE + 1) > KVED_LONG_KEY_SIZE)
+		return false;
+
+#if KVED_LONG_KEY_NAMES > 0
+	// name first, a value is never left without it
+	if(!kved_long_key_name_store(kv,name))
+		return false;
+#endif
+
+	return kved_internal_data_write(kv,kved_long_key_encode(name,data->type),data);
+}
+
+bool kved_long_key_data_write_ex(kved_t *kv, const char *name, kved_data_t *data)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_long_key_data_write(kv,name,data);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_long_key_data_write(const char *name, kved_data_t *data)
+{
+	return kved_long_key_data_write_ex(&kved_default,name,data);
+}
+
+static bool kved_internal_long_key_data_read(kved_t *kv, const char *name, kved_data_t *data)
+{
+	if(strnlen(name,KVED_LONG_KEY_SIZE + 1) > KVED_LONG_KEY_SIZE)
+		return false;
+
+#if KVED_LONG_KEY_NAMES > 0
+	bool found;
+
+	// the value may belong to another name with the same hash
+	if(!kved_long_key_name_match(kv,name,&found))
+		return false;
+#endif
+
+	return kved_internal_data_read(kv,kved_long_key_encode(name,data->type),NULL,data);
+}
+
+bool kved_long_key_data_read_ex(kved_t *kv, const char *name, kved_data_t *data)
+{
+	bool result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_long_key_data_read(kv,name,data);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+bool kved_long_key_data_read(const char *name, kved_data_t *data)
+{
+	return kved_long_key_data_read_ex(&kved_default,name,data);
+}
+
+static bool kved_internal_long_key_data_delete(kved_t *kv, const char *name)
+{
+	if(strnlen(name,KVED_LONG_KEY_SIZE + 1) > KVED_LONG_KEY_SIZE)
+		return false;
+
+#if KVED_LONG_KEY_NAMES > 0
+	bool found;
+
+	// the value and the name may belong to another name with the same hash
+	if(!kved_long_key_name_match(kv,name,&found))
+		return false;
+#endif
+
+	if(!kved_internal_data_delete(kv,kved_long_key_encode(name,KVED_DATA_TYPE_UINT8)))
+		return false;
+
+#if KVED_LONG_KEY_NAMES > 0
+	kved_internal_data_delete(kv,kved_long_key_make(name,KVED_DATA_TYPE_BLOB,KVED_LONG_KEY_NAME_MARKER));
+#endif
+
+	return true;
+}
+
+bool kved_long_key_data_delete_ex(kved_t *kv, const char *name)
+{
+	bool result;
+
+	kved_lock_enter(kv);
+	result = kved_internal_long_key_data_delete(kv,name);
+	kved_lock_leave(kv);
+
+	return result;
+}
+
+bool kved_long_key_data_delete(const char *name)
+{
+	return kved_long_key_data_delete_ex(&kved_default,name);
+}
+
+static bool kved_internal_long_key_name_get(kved_t *kv, kved_data_t *data, char *name, uint16_t size)
+{
+#if KVED_LONG_KEY_NAMES > 0
+	kved_data_t name_data = *data;
+
+	if(((data->key[0] & KVED_LONG_KEY_MARKER_MSK) != KVED_LONG_KEY_MARKER) || (size == 0))
+		return false;
+
+	// same hash, another marker
+	name_data.type = KVED_DATA_TYPE_BLOB;
+	name_data.key[0] = KVED_LONG_KEY_NAME_MARKER | (data->key[0] & ~KVED_LONG_KEY_MARKER_MSK);
+	size--;
+
+	if(!kved_internal_blob_read(kv,kved_key_encode(&name_data),(uint8_t *)name,&size))
+		return false;
+
+	name[size] = 0;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool kved_long_key_name_get_ex(kved_t *kv, kved_data_t *data, char *name, uint16_t size)
+{
+	bool result;
+
+	kved_lock_read_enter(kv);
+	result = kved_internal_long_key_name_get(kv,data,name,size);
+	kved_lock_read_leave(kv);
+
+	return result;
+}
+
+bool kved_long_key_name_get(kved_data_t *data, char *name, uint16_t size)
+{
+	return kved_long_key_name_get_ex(&kved_default,data,name,size);
+}
+
+static void kved_internal_format(kved_t *kv)
+{
+	// erase data and control
+	for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+		kved_ops_sector_erase(kv,sec);
+
+	memset(&kv->ctrl,0,sizeof(kv->ctrl));
+
+	// setup sector as first sector and update stats.
+	// Consistency is not required in such situation.
+	kv->ctrl.sector  = KVED_FLASH_SECTOR_A;
+	kv->ctrl.num_sectors = 1;
+	kved_ops_entry_write(kv,kv->ctrl.sector,0,KVED_SIGNATURE_ENTRY,0);// first cnt, after ID
+	kv->ctrl.standby = KVED_STANDBY_BLANK;
+
+	kved_sector_stats_read(kv);
+}
+
+void kved_format_ex(kved_t *kv)
+{
+	kved_lock_enter(kv);
+	kved_internal_format(kv);
+	kved_lock_leave(kv);
+}
+
+void kved_format(void)
+{
+	kved_format_ex(&kved_default);
+}
+
+static void kved_sector_consistency_check(kved_t *kv)
+{
+	kved_word_t cnt[KVED_FLASH_NUM_SECTORS];
+	bool valid[KVED_FLASH_NUM_SECTORS];
+	uint8_t num_valid = 0;
+
+	kv->ctrl.sector = KVED_FLASH_SECTOR_A;
+	kv->ctrl.num_sectors = 0;
+
+	for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+	{
+		valid[sec] = kved_ops_data_read(kv,sec,0) == KVED_SIGNATURE_ENTRY;
+		cnt[sec] = kved_ops_data_read(kv,sec,1);
+		num_valid += valid[sec] ? 1 : 0;
+	}
+
+	// unexpected situation since counter can not be KVED_FLASH_UINT_MAX: we 
+	// will invalidate the sector. Maybe some people would like to analize it 
+	// and rescue some valid entries. Not implemented, anyway.
+	for(uint8_t sec = 0 ; (num_valid > 1) && (sec < KVED_FLASH_NUM_SECTORS) ; sec++)
+	{
+		if(valid[sec] && (cnt[sec] == KVED_FLASH_UINT_MAX))
+		{
+			kved_ops_data_write(kv,sec,0,0);
+			valid[sec] = false;
+		}
+	}
 
-	kved_flash_sector_erase(next_sector);
+	// Sectors in use have consecutive counters, in ring order, and the newest sector is the one
+	// not followed by the next counter value (remember: last value (0xFF..FF) is not valid as 
+	// it is the same value of a erased word, see kved_counter_next). 
+	// If the ring is broken, the longest sequence wins (the newest one, for equal sizes).
+	for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+	{
+		kved_flash_sector_t next = kved_sector_next(sec);
 
-	upd_key = KVED_HDR_MASK_KEY(upd_key);
+		if(!valid[sec] || (valid[next] && (cnt[next] == kved_counter_next(cnt[sec]))))
+			continue;
 
-	for(uint16_t index = ctrl->first_index ; index <= ctrl->last_index ; index += KVED_ENTRY_SIZE_IN_WORDS)
-	{
-		kved_word_t key = kved_flash_data_read(ctrl->sector,index);
+		uint8_t num_sectors = 1;
+		kved_flash_sector_t cur = sec;
 
-		if(kved_is_valid_key(key))
+		while(num_sectors < KVED_FLASH_NUM_SECTORS)
 		{
-			kved_word_t val = kved_flash_data_read(ctrl->sector,index + 1);
+			kved_flash_sector_t prev = (kved_flash_sector_t)((cur + KVED_FLASH_NUM_SECTORS - 1) % KVED_FLASH_NUM_SECTORS);
 
-			kved_flash_data_write(next_sector,next_index++,key);
+			if(!valid[prev] || (kved_counter_next(cnt[prev]) != cnt[cur]))
+				break;
 
-			if(KVED_HDR_MASK_KEY(key) == upd_key)
-				kved_flash_data_write(next_sector,next_index++,upd_value);
-			else
-				kved_flash_data_write(next_sector,next_index++,val);
-
-			used_items++;
+			cur = prev;
+			num_sectors++;
 		}
 
-		total_items++;
+		if(num_sectors >= kv->ctrl.num_sectors)
+		{
+			kv->ctrl.sector = sec;
+			kv->ctrl.num_sectors = num_sectors;
+		}
 	}
 
-	kved_flash_sector_t last_sector = ctrl->sector;
-	ctrl->sector = next_sector;
-	ctrl->first_index = KVED_HDR_SIZE_IN_WORDS;
-	ctrl->last_index = (kved_flash_sector_size()/KVED_FLASH_WORD_SIZE) - KVED_HDR_SIZE_IN_WORDS;
-	ctrl->first_free_index = next_index;
-	ctrl->stats.num_deleted_entries = 0;
-	ctrl->stats.num_total_entries = total_items;
-	ctrl->stats.num_used_entries = used_items;
-	ctrl->stats.num_free_entries = total_items - used_items;
+	// All sectors with valid signatures: as the signature is the latest item to be written into the sector
+	// when a copy operation is performed, probably a restart event happened just after data copying and, 
+	// in this case, the oldest sector can be erased as the copy was done.
+	if(kv->ctrl.num_sectors == KVED_FLASH_NUM_SECTORS)
+		kv->ctrl.num_sectors--;
 
-	// last value is not valid since it is equal to an erased flash entry
-	if((cnt + 1) == KVED_FLASH_UINT_MAX) // last value, avoiding some #if #def related to flash size
-		cnt = 0;
-	else
-		cnt++;
-
-	kved_flash_data_write(next_sector,1,cnt);
-	kved_flash_data_write(next_sector,0,KVED_SIGNATURE_ENTRY);
-
-	kved_flash_data_write(last_sector,0,0); // only invalidate header, it is faster
+	// Invalidate sectors out of the ring
+	for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+	{
+		if(valid[sec] && ((kv->ctrl.num_sectors == 0) || !kved_sector_in_use(&kv->ctrl,sec)))
+			kved_ops_data_write(kv,sec,0,0);
+	}
 }
 
-static bool kved_internal_data_write(kved_data_t *data)
+// Transactions are written in the newest sector only and their records are deleted at commit.
+// A record still there means a power loss before the commit: the values written after it 
+// are removed, the old values were not deleted yet.
+static void kved_txn_consistency_check(kved_t *kv)
 {
-	bool sector_changed = false;
-
-	if(!started)
-		return false;
-
-	kved_word_t key = kved_key_encode(data);
-
-	if(!kved_is_valid_key(key))
-		return false;
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key;
+	kved_word_t val;
 
-	uint16_t key_index = kved_key_index_find(key);
-	bool old_entry = key_index != KVED_INDEX_NOT_FOUND;
+	kved_scan_start(kv,&scan,kv->ctrl.sector,kv->ctrl.first_index,kv->ctrl.last_index);
 
-	// check if the value has changed or not (for existing keys)
-	if(old_entry)
+	while(kved_scan_next(&scan,&index,&key,&val))
 	{
-		kved_word_t stored_value = kved_flash_data_read(ctrl.sector,key_index + 1);
+		if(key != KVED_TXN_ENTRY)
+			continue;
 
-		if(stored_value == kved_value_encode(data))
-			return true;
-	}
+		uint16_t last_index = kv->ctrl.last_index;
 
-	// no space, exchanging sector do not solve this situation, you need more flash space !
-	if(ctrl.stats.num_total_entries == ctrl.stats.num_used_entries)
-		return false;
+		if(val < (kved_word_t)(kv->ctrl.last_index - index)/KVED_ENTRY_SIZE_IN_WORDS)
+			last_index = index + (uint16_t)val*KVED_ENTRY_SIZE_IN_WORDS;
 
-	// ok, we have space but a clean up is required before. 
-	// Let's do a sector switch and leave the garbage behind.
-	// If we are writing using an existing entries it will
-	// be their valued updated during the process. 
-	if(ctrl.stats.num_free_entries == 0)
-	{
-		kved_word_t cnt = kved_flash_data_read(ctrl.sector,1);
-		kved_sector_switch(&ctrl,cnt,key,kved_value_encode(data));
-		sector_changed = true;
+		// values first, the record is deleted at the end (a new power loss only repeats this)
+		for(uint16_t txn_index = index + KVED_ENTRY_SIZE_IN_WORDS ; txn_index <= last_index ; txn_index += KVED_ENTRY_SIZE_IN_WORDS)
+		{
+			if(kved_ops_data_read(kv,kv->ctrl.sector,txn_index) != KVED_FREE_ENTRY)
+				kved_ops_data_write(kv,kv->ctrl.sector,txn_index,KVED_DELETED_ENTRY);
+		}
+
+		kved_ops_data_write(kv,kv->ctrl.sector,index,KVED_DELETED_ENTRY);
+		kved_sector_stats_read(kv);
+		break;
 	}
+}
 
-	// AN existing entry is moved to the new sector using the new value already, not to do anymore.
-	// However we need to take care when a new entry is added or when we are updating an entry 
-	// in the same sector. 
-	bool old_entry_updated_in_the_same_sector = (!sector_changed) && old_entry;
+// Blob fragments are written before the blob header, so a power loss may leave fragments
+// without a header. Headers are also checked against their fragments (CRC).
+static void kved_blob_consistency_check(kved_t *kv)
+{
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key;
+	kved_word_t val;
+	bool changed = false;
 
-	if(!old_entry || old_entry_updated_in_the_same_sector)
+	for(uint8_t pos = 0 ; pos < kv->ctrl.num_sectors ; pos++)
 	{
-		// first data, after key
-		kved_flash_data_write(ctrl.sector,ctrl.first_free_index + 1,kved_value_encode(data));
-		kved_flash_data_write(ctrl.sector,ctrl.first_free_index,key);
+		kved_flash_sector_t sec = kved_ring_sector(&kv->ctrl,pos);
+		uint16_t num_frags = 0;
 
-		ctrl.stats.num_free_entries--;
-		ctrl.stats.num_used_entries++;
-		ctrl.first_free_index += KVED_ENTRY_SIZE_IN_WORDS;
+		kved_scan_start(kv,&scan,sec,kv->ctrl.first_index,kv->ctrl.last_index);
 
-		// Existing data written in the same sector: erase the old entry
-		if(old_entry_updated_in_the_same_sector)
+		while(kved_scan_next(&scan,&index,&key,&val))
 		{
-			kved_flash_data_write(ctrl.sector,key_index,KVED_DELETED_ENTRY);
+			if(kved_is_blob_frag(key))
+			{
+				num_frags++;
+				continue;
+			}
 
-			ctrl.stats.num_deleted_entries++;
-			ctrl.stats.num_used_entries--;
-		}
-	}
+			uint16_t blob_frags = kved_blob_frags(key,val);
 
-#ifdef KVED_DEBUG
-	kved_dump();
-#endif	
+			// blobs and counters without all their fragments, blobs with a bad CRC
+			if((blob_frags > num_frags) || 
+			   (kved_is_valid_key(key) && (KVED_HDR_MASK_TYPE(key) == KVED_DATA_TYPE_BLOB) && !kved_blob_scan(kv,sec,index,NULL,NULL)))
+			{
+				kved_ops_data_write(kv,sec,index,KVED_DELETED_ENTRY);
+				blob_frags = 0;
+				changed = true;
+			}
 
-	return true;
-}
+			for( ; num_frags > blob_frags ; num_frags--)
+			{
+				kved_ops_data_write(kv,sec,index - num_frags*KVED_ENTRY_SIZE_IN_WORDS,KVED_DELETED_ENTRY);
+				changed = true;
+			}
 
-bool kved_data_write(kved_data_t *data)
-{
-	uint16_t result;
+			num_frags = 0;
+		}
 
-	kved_cpu_critical_section_enter();
-	result = kved_internal_data_write(data);
-	kved_cpu_critical_section_leave();
+		for( ; num_frags > 0 ; num_frags--)
+		{
+			kved_ops_data_write(kv,sec,kv->ctrl.last_index + KVED_ENTRY_SIZE_IN_WORDS - num_frags*KVED_ENTRY_SIZE_IN_WORDS,KVED_DELETED_ENTRY);
+			changed = true;
+		}
+	}
 
-	return result;
+	if(changed)
+		kved_sector_stats_read(kv);
 }
 
-static uint16_t kved_internal_first_used_index_get(void)
+// true when the key is also found after the given entry (power loss)
+static bool kved_key_is_duplicated(kved_t *kv, uint8_t pos, uint16_t index, kved_word_t key)
 {
-	uint16_t first_index = KVED_INDEX_NOT_FOUND;
+	kved_scan_t scan;
+	uint16_t dup_index;
+	kved_word_t dup_key;
+	kved_word_t dup_val;
 
-	for(uint16_t index = ctrl.first_index ; index <= ctrl.last_index ; index += KVED_ENTRY_SIZE_IN_WORDS)
+	for(uint8_t dup_pos = pos ; dup_pos < kv->ctrl.num_sectors ; dup_pos++)
 	{
-		kved_word_t key = kved_flash_data_read(ctrl.sector,index);
+		kved_flash_sector_t dup_sec = kved_ring_sector(&kv->ctrl,dup_pos);
 
-		if(kved_is_valid_key(key))
+		kved_scan_start(kv,&scan,dup_sec,dup_pos == pos ? index + KVED_ENTRY_SIZE_IN_WORDS : kv->ctrl.first_index,kv->ctrl.last_index);
+
+		while(kved_scan_next(&scan,&dup_index,&dup_key,&dup_val))
 		{
-			first_index = index;
-			break;
+			if(kved_is_valid_key(dup_key) && (KVED_HDR_MASK_KEY(dup_key) == KVED_HDR_MASK_KEY(key)))
+				return true;
 		}
 	}
 
-	return first_index;
+	return false;
 }
 
-uint16_t kved_first_used_index_get(void)
+#define KVED_BOOT_SET_EMPTY UINT16_MAX
+
+/** @private */
+typedef struct kved_boot_set_s
 {
-	uint16_t result;
+	uint16_t *slots;                        /**< @private */
+	uint16_t size;                          /**< @private */
+} kved_boot_set_t;
+
+// the scratch buffer (see kved_init_scratch_ex) is a hash set with the database index of the
+// newest copy of each key, used when it has room for all used entries plus 1/3 of empty slots
+static bool kved_boot_set_init(kved_t *kv, kved_boot_set_t *set)
+{
+	if((set->slots == NULL) || (kv->ctrl.stats.num_used_entries > set->size - set->size/4))
+		return false;
 
-	kved_cpu_critical_section_enter();
-	result = kved_internal_first_used_index_get();
-	kved_cpu_critical_section_leave();
+	memset(set->slots,0xFF,set->size*sizeof(uint16_t));
 
-	return result;
+	return true;
 }
 
-static uint16_t kved_internal_next_used_index_get(uint16_t last_index)
+// stores the entry as the newest copy of its key, returning the database index of an older copy
+static uint16_t kved_boot_set_replace(kved_t *kv, kved_boot_set_t *set, kved_word_t key, uint16_t db_index)
 {
-	uint16_t next_index = KVED_INDEX_NOT_FOUND;
+	uint16_t slot = (uint16_t)(kved_bloom_hash(KVED_HDR_MASK_KEY(key)) % set->size);
+	kved_word_t old_key;
+	kved_word_t old_val;
 
-	for(uint16_t index = last_index + KVED_ENTRY_SIZE_IN_WORDS ; index <= ctrl.last_index ; index += KVED_ENTRY_SIZE_IN_WORDS)
+	// keys are not kept in RAM, each used slot is compared with the flash entry
+	for( ; set->slots[slot] != KVED_BOOT_SET_EMPTY ; slot = (uint16_t)((slot + 1) % set->size))
 	{
-		kved_word_t key = kved_flash_data_read(ctrl.sector,index);
+		uint16_t old_db_index = set->slots[slot];
 
-		if(kved_is_valid_key(key))
+		kved_db_entry_read(kv,old_db_index,&old_key,&old_val);
+
+		if(KVED_HDR_MASK_KEY(old_key) == KVED_HDR_MASK_KEY(key))
 		{
-			next_index = index;
-			break;
+			set->slots[slot] = db_index;
+			return old_db_index;
 		}
 	}
 
-	return next_index;
+	set->slots[slot] = db_index;
+
+	return KVED_BOOT_SET_EMPTY;
 }
 
-uint16_t kved_next_used_index_get(uint16_t last_index)
+// deletes an old copy of a key, with its blob fragments just before it
+static void kved_boot_entry_delete(kved_t *kv, uint16_t db_index)
 {
-	uint16_t result;
+	kved_flash_sector_t sec = kved_db_index_sector(&kv->ctrl,db_index);
+	uint16_t index = kved_db_index_offset(&kv->ctrl,db_index);
+	kved_word_t key;
+	kved_word_t val;
 
-	kved_cpu_critical_section_enter();
-	result = kved_internal_next_used_index_get(last_index);
-	kved_cpu_critical_section_leave();
+	kved_entry_read(kv,sec,index,&key,&val);
 
-	return result;
+	kved_ops_data_write(kv,sec,index,0);
+	kved_used_map_set(&kv->ctrl,db_index,false);
+	kved_deleted_count(&kv->ctrl,sec);
+	kv->ctrl.stats.num_used_entries--;
+
+	for(uint16_t f = kved_blob_frags(key,val) ; f > 0 ; f--)
+	{
+		kved_ops_data_write(kv,sec,index - f*KVED_ENTRY_SIZE_IN_WORDS,0);
+		kved_deleted_count(&kv->ctrl,sec);
+		kv->ctrl.stats.num_used_entries--;
+	}
 }
 
-static bool kved_internal_data_read_by_index(uint16_t index, kved_data_t *data)
+static void kved_data_consistency_check(kved_t *kv, kved_boot_set_t *set)
 {
-	if((index < ctrl.first_index) || (index > ctrl.last_index))
-		return false;
+	kved_scan_t scan;
+	uint16_t index;
+	kved_word_t key;
+	kved_word_t val;
+	bool indexed = false;
+	bool buffered = false;
+
+#if KVED_INDEX_SIZE > 0
+	// the index was built in ring order, so it points to the newest copy
+	// of each key and any other copy is an old one: a single pass is enough
+	indexed = !kv->ctrl.index.overflow;
+#endif
 
-	kved_word_t key = kved_flash_data_read(ctrl.sector,index);
+	// otherwise, the scratch buffer is filled in the same order during the pass
+	if(!indexed)
+		buffered = kved_boot_set_init(kv,set);
 
-	if(!kved_is_valid_key(key))
-		return false;
+	for(uint8_t pos = 0 ; pos < kv->ctrl.num_sectors ; pos++)
+	{
+		kved_flash_sector_t sec = kved_ring_sector(&kv->ctrl,pos);
 
-	kved_word_t val = kved_flash_data_read(ctrl.sector,index + 1);
-	kved_value_decode(data,val);
-	kved_key_decode(data,key);
+		kved_scan_start(kv,&scan,sec,kv->ctrl.first_index,kv->ctrl.last_index);
 
-	return true;
-}
+		while(kved_scan_next(&scan,&index,&key,&val))
+		{
+			// As we write value first and key after and we may be powered off during this operation
+			// it is necessary to fix cases where only the value was written. In such situation
+			// a key with only FFs may exist and this entry will be deleted.
+			// If the power down occurs when key is been written it is not possible to
+			// detect if the operation was finished or not. But this case need to be solved
+			// by application, removing any unknown or unexpected key (application knows its owns keys, kved not). 
+			if(key == KVED_FLASH_UINT_MAX)
+			{
+				if(val != KVED_FLASH_UINT_MAX)
+				{
+					kved_ops_data_write(kv,sec,index,0);
 
-bool kved_data_read_by_index(uint16_t index, kved_data_t *data)
-{
-	uint16_t result;
+					// free entries of older sectors are already counted as deleted
+					if(sec == kv->ctrl.sector)
+					{
+						kved_deleted_count(&kv->ctrl,sec);
+						kv->ctrl.stats.num_free_entries--;
 
-	kved_cpu_critical_section_enter();
-	result = kved_internal_data_read_by_index(index,data);
-	kved_cpu_critical_section_leave();
+						// the torn entry was counted as the first free one
+						if(kv->ctrl.first_free_index == index)
+							kv->ctrl.first_free_index = (index + KVED_ENTRY_SIZE_IN_WORDS) <= kv->ctrl.last_index ? index + KVED_ENTRY_SIZE_IN_WORDS : 0;
+					}
+				}
 
-	return result;
-}
+				continue;
+			}
 
-static uint16_t kved_internal_free_entries_get(void)
-{
-	if(!started)
-		return 0;
+			// Second possible situation: new data is written in the same section (or in a newer one) 
+			// and the old value is not erased due some power down.
+			// So, it is required to check for duplicated keys AHEAD (always)
+			// and erase the old entry.
+			if(kved_is_valid_key(key))
+			{
+				uint16_t db_index = kved_db_index(&kv->ctrl,sec,index);
+				bool duplicated = false;
+
+				if(indexed)
+				{
+#if KVED_INDEX_SIZE > 0
+					duplicated = kved_index_lookup(&kv->ctrl,key) != db_index;
+#endif
+				}
+				else if(buffered)
+				{
+					// this copy is the newest one so far, any older copy is deleted
+					uint16_t old_db_index = kved_boot_set_replace(kv,set,key,db_index);
 
-	uint16_t entries = ctrl.stats.num_total_entries - ctrl.stats.num_used_entries;
+					if(old_db_index != KVED_BOOT_SET_EMPTY)
+						kved_boot_entry_delete(kv,old_db_index);
+				}
+				else
+				{
+					// fallback: without index or buffer, later entries are searched for each key
+					duplicated = kved_key_is_duplicated(kv,pos,index,key);
+				}
 
-	return entries;
+				if(duplicated)
+					kved_boot_entry_delete(kv,db_index);
+			}
+		}
+	}
 }
 
-uint16_t kved_free_entries_get(void)
+static bool kved_internal_idle(kved_t *kv)
 {
-	uint16_t result;
+	if(!kv->started)
+		return false;
 
-	kved_cpu_critical_section_enter();
-	result = kved_internal_free_entries_get();
-	kved_cpu_critical_section_leave();
+	if(kv->ctrl.standby == KVED_STANDBY_BLANK)
+		return true;
 
-	return result;
-}
+	// standby sector in use by the garbage collector
+	if(kv->ctrl.gc.active)
+		return false;
 
-static uint16_t kved_internal_total_entries_get(void)
-{
-	if(!started)
-		return 0;
+	kved_flash_sector_t standby = kved_standby_sector(kv);
 
-	return ctrl.stats.num_total_entries;
-}
+	// state is unknown after a reset, avoid erasing a blank sector again
+	if((kv->ctrl.standby == KVED_STANDBY_DIRTY) || !kved_standby_is_blank(kv,standby))
+	{
+		kved_ops_sector_erase(kv,standby);
 
-uint16_t kved_total_entries_get(void)
-{
-	uint16_t result;
+		if(!kved_standby_is_blank(kv,standby))
+		{
+			kv->ctrl.standby = KVED_STANDBY_DIRTY;
+			return false;
+		}
+	}
 
-	kved_cpu_critical_section_enter();
-	result = kved_internal_total_entries_get();
-	kved_cpu_critical_section_leave();
+	kv->ctrl.standby = KVED_STANDBY_BLANK;
 
-	return result;
+	return true;
 }
 
-static uint16_t kved_internal_used_entries_get(void)
+bool kved_idle_ex(kved_t *kv)
 {
-	if(!started)
-		return 0;
+	bool result;
 
-	return ctrl.stats.num_used_entries;
+	kved_lock_enter(kv);
+	result = kved_internal_idle(kv);
+	kved_lock_leave(kv);
+
+	return result;
 }
 
-uint16_t kved_used_entries_get(void)
+bool kved_idle(void)
 {
-	uint16_t result;
-
-	kved_cpu_critical_section_enter();
-	result = kved_internal_used_entries_get();
-	kved_cpu_critical_section_leave();
-
-	return result;
+	return kved_idle_ex(&kved_default);
 }
 
-static bool kved_internal_data_read(kved_data_t *data)
+static bool kved_internal_gc_step(kved_t *kv, uint16_t max_words)
 {
-	if(!started)
+	if(!kv->started)
 		return false;
 
-	kved_word_t key = kved_key_encode(data);
+	if(!kv->ctrl.gc.active)
+	{
+		// only the oldest sector is compacted, when there are no free sectors left, and it is 
+		// worth only when the space to be recovered is larger than the free space
+		if((kv->ctrl.num_sectors < (KVED_FLASH_NUM_SECTORS - 1)) ||
+		   (kv->ctrl.tail_deleted_entries == 0) || 
+		   (kv->ctrl.tail_deleted_entries < kved_sector_free_entries(kv)))
+			return false;
+
+		// erasing is a step by itself
+		if(kv->ctrl.standby != KVED_STANDBY_BLANK)
+		{
+			kved_internal_idle(kv);
+			return true;
+		}
 
-	if(!kved_is_valid_key(key))
-		return false;
+		kved_gc_start(kv);
+	}
 
-	uint16_t key_index = kved_key_index_find(key);
+	uint16_t max_entries = max_words/KVED_ENTRY_SIZE_IN_WORDS;
 
-	if(key_index == KVED_INDEX_NOT_FOUND)
-		return false;
+	kved_gc_copy(kv,max_entries ? max_entries : 1,NULL);
+
+	// aborted, standby sector must be erased again
+	if(!kv->ctrl.gc.active)
+		return true;
 
-	 // update the type as user may not know about them before calling
-	data->type = KVED_HDR_MASK_TYPE(kved_flash_data_read(ctrl.sector,key_index));
+	if(kv->ctrl.gc.src_index >= kved_gc_end_index(kv))
+	{
+		// free entries of the newest sector would be left behind: 
+		// the copy is kept until the next sector switch
+		if((kv->ctrl.num_sectors > 1) && (kv->ctrl.first_free_index != 0))
+			return false;
 
-	 kved_word_t value = kved_flash_data_read(ctrl.sector,key_index+1);
-	 kved_value_decode(data,value);
+		kved_gc_finish(kv);
+#ifdef KVED_DEBUG
+		kved_internal_dump(kv);
+#endif	
+		return false;
+	}
 
 	return true;
 }
 
-bool kved_data_read(kved_data_t *data)
+bool kved_gc_step_ex(kved_t *kv, uint16_t max_words)
 {
 	bool result;
 
-	kved_cpu_critical_section_enter();
-	result = kved_internal_data_read(data);
-	kved_cpu_critical_section_leave();
+	kved_lock_enter(kv);
+	result = kved_internal_gc_step(kv,max_words);
+	kved_lock_leave(kv);
 
 	return result;
 }
 
-static bool kved_internal_data_delete(kved_data_t *data)
+bool kved_gc_step(uint16_t max_words)
 {
-	if(!started)
-		return false;
+	return kved_gc_step_ex(&kved_default,max_words);
+}
 
-	kved_word_t key = kved_key_encode(data);
+static bool kved_internal_data_write_async(kved_t *kv, kved_word_t key, kved_data_t *data, kved_async_cb_t cb, void *ctx)
+{
+#if KVED_ASYNC_SIZE > 0
+	kved_async_t *async = &kv->ctrl.async;
 
-	if(!kved_is_valid_key(key))
+	if(!kv->started)
 		return false;
 
-	uint16_t key_index = kved_key_index_find(key);
-
-	if(key_index == KVED_INDEX_NOT_FOUND)
+	if(!kved_is_value_key(key) || (async->count == KVED_ASYNC_SIZE))
 		return false;
 
-	kved_flash_data_write(ctrl.sector,key_index,KVED_DELETED_ENTRY);
+	// the request is newer than a pending value of the write-back table
+	kved_wb_drop(kv,key);
 
-	ctrl.stats.num_deleted_entries++;
-	ctrl.stats.num_used_entries--;
+	uint16_t pos = (async->first + async->count) % KVED_ASYNC_SIZE;
 
-#ifdef KVED_DEBUG
-	kved_dump();
-#endif	
+	async->keys[pos] = key;
+	async->values[pos] = kved_value_encode(data);
+	async->cbs[pos] = cb;
+	async->ctxs[pos] = ctx;
+	async->count++;
 
 	return true;
+#else
+	return kved_internal_data_write(kv,key,data);
+#endif
 }
 
-bool kved_data_delete(kved_data_t *data)
+bool kved_data_write_async_ex(kved_t *kv, kved_data_t *data, kved_async_cb_t cb, void *ctx)
 {
 	bool result;
 
-	kved_cpu_critical_section_enter();
-	result = kved_internal_data_delete(data);
-	kved_cpu_critical_section_leave();
+	kved_lock_enter(kv);
+	result = kved_internal_data_write_async(kv,kved_key_encode(data),data,cb,ctx);
+	kved_lock_leave(kv);
+
+#if KVED_ASYNC_SIZE == 0
+	if(cb)
+		cb(ctx,result);
+#endif
 
 	return result;
 }
 
-static void kved_internal_format(void)
+bool kved_data_write_async(kved_data_t *data, kved_async_cb_t cb, void *ctx)
 {
-	// erase data and control
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_A);
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_B);
-	memset(&ctrl,0,sizeof(ctrl));
+	return kved_data_write_async_ex(&kved_default,data,cb,ctx);
+}
 
-	// setup sector as first sector and update stats.
-	// Consistency is not required in such situation.
-	ctrl.sector  = KVED_FLASH_SECTOR_A;
-	kved_flash_data_write(ctrl.sector,1,0);// first cnt, after ID
-	kved_flash_data_write(ctrl.sector,0,KVED_SIGNATURE_ENTRY);
+// standby sector preparation, as done by kved_idle, but erasing and blank check are separated steps
+static bool kved_poll_standby(kved_t *kv)
+{
+	if((kv->ctrl.standby == KVED_STANDBY_BLANK) || kv->ctrl.gc.active)
+		return false;
+
+	kved_flash_sector_t standby = kved_standby_sector(kv);
+
+	if(kv->ctrl.standby == KVED_STANDBY_DIRTY)
+	{
+		// the port may return before the end, next steps wait for it
+		kved_ops_sector_erase(kv,standby);
+		kv->ctrl.standby = KVED_STANDBY_UNKNOWN;
+	}
+	else
+	{
+		kv->ctrl.standby = kved_standby_is_blank(kv,standby) ? KVED_STANDBY_BLANK : KVED_STANDBY_DIRTY;
+	}
 
-	kved_sector_stats_read(&ctrl);
+	return true;
 }
 
-void kved_format(void)
+#if KVED_ASYNC_SIZE > 0
+// a new entry does not switch sectors or the standby sector is ready (no erasing)
+static bool kved_poll_write_ready(kved_t *kv)
 {
-	kved_cpu_critical_section_enter();
-	kved_internal_format();
-	kved_cpu_critical_section_leave();
+	return (kved_sector_free_entries(kv) > 1) || kv->ctrl.gc.active || (kv->ctrl.standby == KVED_STANDBY_BLANK);
 }
+#endif
 
-static void kved_sector_consistency_check(void)
+static bool kved_internal_poll(kved_t *kv, kved_async_cb_t *cb, void **ctx, bool *written)
 {
-	bool invalidate_a = false;
-	bool invalidate_b = false;
+	if(!kv->started)
+		return false;
+
+	if(kved_ops_busy(kv))
+		return true;
 
-	kved_word_t id_sec_a = kved_flash_data_read(KVED_FLASH_SECTOR_A,0);
-	kved_word_t id_sec_b = kved_flash_data_read(KVED_FLASH_SECTOR_B,0);
+#if KVED_ASYNC_SIZE > 0
+	kved_async_t *async = &kv->ctrl.async;
 
-	// Two valid signatures: as the signature is the latest item to be written into the sector
-	// when a formatting or copy operation is performed, probably a restart event happened just 
-	// after data copying and, in this case, the section with the
-	// newest cnt will win and the other can be erase as the copy was done.
-	// (remember: last value (0xFF..FF) is not valid as it is the same value of a erased word
-	if((id_sec_a == KVED_SIGNATURE_ENTRY) && (id_sec_b == KVED_SIGNATURE_ENTRY))
+	if(async->count)
 	{
-		kved_word_t cnt_sec_a = kved_flash_data_read(KVED_FLASH_SECTOR_A,1);
-		kved_word_t cnt_sec_b = kved_flash_data_read(KVED_FLASH_SECTOR_B,1);
+		if(!kved_poll_write_ready(kv) && kved_poll_standby(kv))
+			return true;
 
-		// the (a) counter rolled over and the
-		// sector (a->b) copy was done so erase older sector (a) and use the newer (b)
-		if((cnt_sec_a == (KVED_FLASH_UINT_MAX-1)) && (cnt_sec_b == 0))
-		{
-			invalidate_a = true;
-		}
-		// the (b) counter rolled over and the
-		// sector (b->a) copy was done so erase older sector (b) and use the newer (a)
-		else if((cnt_sec_b == (KVED_FLASH_UINT_MAX-1)) && (cnt_sec_a == 0))
-		{
-			invalidate_b = true;
-		}
-		// unexpected situation since counter can not be KVED_FLASH_UINT_MAX: we 
-		// will invalidate the sector. Maybe some people would like to analize it 
-		// and rescue some valid entries. Not implemented, anyway.
-		else if((cnt_sec_a == KVED_FLASH_UINT_MAX) || (cnt_sec_b == KVED_FLASH_UINT_MAX))
-		{
-			invalidate_a = cnt_sec_a == KVED_FLASH_UINT_MAX ;
-			invalidate_b = cnt_sec_b == KVED_FLASH_UINT_MAX;
-		}
+		kved_word_t key = async->keys[async->first];
+		kved_word_t value = async->values[async->first];
 
-		// ok, regular situation where one counter is the newest and 
-		// all values are normal, just choose the newest one
-		if((invalidate_a == false) && (invalidate_b == false))
-		{
-			if(cnt_sec_a > cnt_sec_b)
-					invalidate_b = true;
-				else
-					invalidate_a = true;
-		}
+		*cb = async->cbs[async->first];
+		*ctx = async->ctxs[async->first];
+		async->first = (async->first + 1) % KVED_ASYNC_SIZE;
+		async->count--;
 
-		// Invalidate selected sectors ...
-		if(invalidate_a)
-			kved_flash_data_write(KVED_FLASH_SECTOR_A,0,0);
+		*written = kved_batch_write(kv,&key,&value,1);
 
-		if(invalidate_b)
-			kved_flash_data_write(KVED_FLASH_SECTOR_B,0,0);
+		return true;
 	}
+#endif
+
+	if(kved_poll_standby(kv))
+		return true;
+
+	// standby sector is ready, steps only copy entries
+	return kved_internal_gc_step(kv,KVED_READ_BLOCK_SIZE);
 }
 
-static void kved_data_consistency_check(void)
+bool kved_poll_ex(kved_t *kv)
 {
-	for(uint16_t index = ctrl.first_index ; index <= ctrl.last_index ; index += KVED_ENTRY_SIZE_IN_WORDS)
-	{
-		kved_word_t key = kved_flash_data_read(ctrl.sector,index);
-		kved_word_t val = kved_flash_data_read(ctrl.sector,index + 1);
+	kved_async_cb_t cb = NULL;
+	void *ctx = NULL;
+	bool written = false;
+	bool result;
 
-		// As we write value first and key after and we may be powered off during this operation
-		// it is necessary to fix cases where only the value was written. In such situation
-		// a key with only FFs may exist and this entry will be deleted.
-		// If the power down occurs when key is been written it is not possible to
-		// detect if the operation was finished or not. But this case need to be solved
-		// by application, removing any unknown or unexpected key (application knows its owns keys, kved not). 
-		if((key == KVED_FLASH_UINT_MAX) && (val != KVED_FLASH_UINT_MAX))
-		{
-			kved_flash_data_write(ctrl.sector,index,0);
-			ctrl.stats.num_deleted_entries++;
-			ctrl.stats.num_free_entries--;
-			continue;
-		}
+	kved_lock_enter(kv);
+	result = kved_internal_poll(kv,&cb,&ctx,&written);
+	kved_lock_leave(kv);
 
-		// Second possible situation: new data is written in the same section and the
-		// old value is not erased due some power down.
-		// So, it is required to check for duplicated keys AHEAD (always)
-		// and erase the old entry.
-		if(kved_is_valid_key(key))
-		{
-			for(uint16_t dup_key_index = index + KVED_ENTRY_SIZE_IN_WORDS ; dup_key_index <= ctrl.last_index ; dup_key_index += KVED_ENTRY_SIZE_IN_WORDS)
-			{
-				kved_word_t dup_key = kved_flash_data_read(ctrl.sector,dup_key_index);
-				if(kved_is_valid_key(dup_key))
-				{
-					if(KVED_HDR_MASK_KEY(dup_key) == KVED_HDR_MASK_KEY(key))
-					{
-						kved_flash_data_write(ctrl.sector,index,0);
-						ctrl.stats.num_deleted_entries++;
-						ctrl.stats.num_used_entries--;
-						break;
-					}
-				}
-			}
-		}
-	}
+	// new requests can be added by the callback
+	if(cb)
+		cb(ctx,written);
+
+	return result;
+}
+
+bool kved_poll(void)
+{
+	return kved_poll_ex(&kved_default);
+}
+
+static void kved_internal_bloom_stats_get(kved_t *kv, kved_bloom_stats_t *stats)
+{
+#if KVED_BLOOM_BITS > 0
+	*stats = kv->ctrl.bloom.stats;
+
+	uint32_t absent = stats->rejected + stats->false_positives;
+	stats->false_positive_rate = absent ? (uint16_t)(((uint64_t)stats->false_positives*1000)/absent) : 0;
+#else
+	memset(stats,0,sizeof(kved_bloom_stats_t));
+#endif
+}
+
+void kved_bloom_stats_get_ex(kved_t *kv, kved_bloom_stats_t *stats)
+{
+	kved_lock_read_enter(kv);
+	kved_internal_bloom_stats_get(kv,stats);
+	kved_lock_read_leave(kv);
+}
+
+void kved_bloom_stats_get(kved_bloom_stats_t *stats)
+{
+	kved_bloom_stats_get_ex(&kved_default,stats);
+}
+
+void kved_dump_ex(kved_t *kv)
+{
+	kved_lock_read_enter(kv);
+	kved_internal_dump(kv);
+	kved_lock_read_leave(kv);
 }
 
 void kved_dump(void)
 {
-	kved_cpu_critical_section_enter();
-	kved_internal_dump(&ctrl);
-	kved_cpu_critical_section_leave();
+	kved_dump_ex(&kved_default);
 }
 
-void kved_init(void)
+void kved_init_scratch_ex(kved_t *kv, const kved_flash_ops_t *flash, const kved_lock_ops_t *lock, uint16_t *buf, uint16_t size)
 {
-	kved_flash_init();
+	kved_boot_set_t set = { .slots = size ? buf : NULL, .size = size };
 
-	kved_sector_consistency_check();
+	memset(&kv->ctrl,0,sizeof(kv->ctrl));
+	kv->flash = flash ? flash : &kved_flash_port_ops;
+	kv->lock = lock ? lock : &kved_cpu_lock_ops;
+	kv->started = false;
 
-	kved_word_t id_sec_a = kved_flash_data_read(KVED_FLASH_SECTOR_A,0);
-	kved_word_t id_sec_b = kved_flash_data_read(KVED_FLASH_SECTOR_B,0);
+	kved_ops_init(kv);
 
-	if(id_sec_a == KVED_SIGNATURE_ENTRY)
-	{
-		ctrl.sector = KVED_FLASH_SECTOR_A;
-	}
-	else if(id_sec_b == KVED_SIGNATURE_ENTRY)
+	// database indexes are 16 bits wide, the instance is left unstarted
+	if(((uint32_t)KVED_FLASH_NUM_SECTORS*(kved_ops_sector_size(kv)/KVED_FLASH_WORD_SIZE)) > (UINT16_MAX + 1UL))
 	{
-		ctrl.sector = KVED_FLASH_SECTOR_B;
+#ifdef KVED_DEBUG
+		assert(!"sectors times words per sector exceed 65536");
+#endif
+		return;
 	}
-	else
+
+	kved_sector_consistency_check(kv);
+
+	// no valid sector
+	if(kv->ctrl.num_sectors == 0)
 	{
-		ctrl.sector  = KVED_FLASH_SECTOR_A;
-		kved_flash_sector_erase(ctrl.sector);
-		kved_flash_data_write(ctrl.sector,1,0);// first cnt, after ID
-		kved_flash_data_write(ctrl.sector,0,KVED_SIGNATURE_ENTRY);
+		kv->ctrl.sector  = KVED_FLASH_SECTOR_A;
+		kv->ctrl.num_sectors = 1;
+		kved_ops_sector_erase(kv,kv->ctrl.sector);
+		kved_ops_entry_write(kv,kv->ctrl.sector,0,KVED_SIGNATURE_ENTRY,0);// first cnt, after ID
 	}
 
-	kved_sector_stats_read(&ctrl);
+	kved_sector_stats_read(kv);
 
-	kved_data_consistency_check();
+	// before solving duplicated keys, uncommitted values are newer than the old ones
+	kved_txn_consistency_check(kv);
+	kved_blob_consistency_check(kv);
+	kved_data_consistency_check(kv,&set);
 
-	started = true;
+	kv->started = true;
 
 #ifdef KVED_DEBUG
-	kved_dump();
+	kved_internal_dump(kv);
 #endif	
 }
+
+void kved_init_scratch(uint16_t *buf, uint16_t size)
+{
+	kved_init_scratch_ex(&kved_default,NULL,NULL,buf,size);
+}
+
+void kved_init_ex(kved_t *kv, const kved_flash_ops_t *flash, const kved_lock_ops_t *lock)
+{
+	kved_init_scratch_ex(kv,flash,lock,NULL,0);
+}
+
+void kved_init(void)
+{
+	kved_init_ex(&kved_default,NULL,NULL);
+}
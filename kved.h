@@ -14,8 +14,13 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 @{
 */
 
+#include <stddef.h>
 #include "kved_config.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* kved structure
 
 <- 4 bytes -><- 4 bytes ->  <= 8 bytes when using flash with word of 64 bits 
@@ -45,16 +50,25 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 	typedef uint64_t kved_word_t; /**< flash word data type */
 #endif
 
+#include "kved_flash.h"
+#include "kved_cpu.h"
+
 #if KVED_FLASH_WORD_SIZE == 8
 	#define KVED_SIGNATURE_ENTRY  0xDEADBEEFDEADBEEFULL
 	#define KVED_DELETED_ENTRY    0x0000000000000000ULL
 	#define KVED_FREE_ENTRY       0xFFFFFFFFFFFFFFFFULL
 	#define KVED_HDR_ENTRY_MSK    0xFFFFFFFFFFFFFF00ULL
+	#define KVED_TXN_ENTRY        0x0054584E00000000ULL
+	#define KVED_BLOB_FRAG_ENTRY  0x0062000000000000ULL
+	#define KVED_BLOB_FRAG_MSK    0xFFFF000000000000ULL
 #else
 	#define KVED_SIGNATURE_ENTRY  0xDEADBEEFUL /**< kved signature */
 	#define KVED_DELETED_ENTRY    0x00000000UL /**< deleted entry identification */
 	#define KVED_FREE_ENTRY       0xFFFFFFFFUL /**< free entry identification */
 	#define KVED_HDR_ENTRY_MSK    0xFFFFFF00UL /**< label entry mask */
+	#define KVED_TXN_ENTRY        0x00545800UL /**< transaction record (first key char is zero), deleted at commit */
+	#define KVED_BLOB_FRAG_ENTRY  0x00620000UL /**< blob fragment (first key char is zero), data in the other bytes */
+	#define KVED_BLOB_FRAG_MSK    0xFFFF0000UL /**< blob fragment mask */
 #endif
 
 #define KVED_HDR_SIZE_IN_WORDS    2 /**< kved header size */
@@ -71,6 +85,16 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 #define KVED_MAX_KEY_SIZE    (KVED_FLASH_WORD_SIZE-1) 
 /** Index return value when a key is not found in the database */
 #define KVED_INDEX_NOT_FOUND 0 
+/** Blob bytes per entry: the value and the key word, except its two marker bytes */
+#define KVED_BLOB_FRAG_SIZE  (2*KVED_FLASH_WORD_SIZE - 2)
+/** Counter increments done by clearing bits of its fragment, without new entries */
+#define KVED_COUNTER_BITS    (8*KVED_BLOB_FRAG_SIZE)
+/** First key char of hashed long keys (from 0x80 up to 0x9F), short keys are ASCII */
+#define KVED_LONG_KEY_MARKER      0x80
+/** First key char of long key names (from 0xA0 up to 0xBF), see @ref KVED_LONG_KEY_NAMES */
+#define KVED_LONG_KEY_NAME_MARKER 0xA0
+/** Mask of the long key markers */
+#define KVED_LONG_KEY_MARKER_MSK  0xE0
 
 /**
 @brief Supported data types.
@@ -90,6 +114,8 @@ typedef enum kved_data_types_e
 	KVED_DATA_TYPE_INT64,     /**< 64 bits, unsigned */
 	KVED_DATA_TYPE_DOUBLE,    /**< Double precision floating point (double) */
 #endif	
+	KVED_DATA_TYPE_BLOB,      /**< Blob header, see @ref kved_blob_write (value with blob size and CRC) */
+	KVED_DATA_TYPE_COUNTER,   /**< Counter, see @ref kved_counter_inc (value with the count of the last new entry) */
 } kved_data_types_t;
 
 /**
@@ -122,6 +148,172 @@ typedef struct kved_data_s
 	kved_data_types_t type;         /**< Data type used according to @ref kved_data_types_t */
 } kved_data_t;
 
+/**
+@brief Bloom filter statistics, see @ref kved_bloom_stats_get
+*/
+typedef struct kved_bloom_stats_s
+{
+	uint32_t lookups;             /**< key lookups checked by the filter */
+	uint32_t rejected;            /**< absent keys reported by the filter, without a lookup */
+	uint32_t false_positives;     /**< absent keys not reported by the filter (lookup required) */
+	uint16_t false_positive_rate; /**< false positives per thousand absent keys */
+} kved_bloom_stats_t;
+
+/**
+@brief Transaction, see @ref kved_txn_begin. Fields are private.
+*/
+typedef struct kved_txn_s
+{
+	kved_word_t keys[KVED_TXN_SIZE];   /**< @private */
+	kved_word_t values[KVED_TXN_SIZE]; /**< @private */
+	uint16_t count;                    /**< @private */
+	bool failed;                       /**< @private */
+} kved_txn_t;
+
+/** @private */
+typedef struct kved_sector_stat_s
+{
+	uint16_t num_free_entries;    /**< @private */
+	uint16_t num_deleted_entries; /**< @private */
+	uint16_t num_used_entries;    /**< @private */
+	uint16_t num_total_entries;   /**< @private */
+} kved_sector_stat_t;
+
+#if (KVED_FLASH_NUM_SECTORS < 2) || (KVED_FLASH_NUM_SECTORS > 16)
+#error "KVED_FLASH_NUM_SECTORS must be from 2 up to 16"
+#endif
+
+#if KVED_BITMAP_ENTRIES > 0
+#define KVED_BITMAP_WORDS ((KVED_BITMAP_ENTRIES + 31)/32)
+#endif
+
+#if KVED_INDEX_SIZE > 0
+#if (KVED_INDEX_SIZE & (KVED_INDEX_SIZE - 1)) != 0
+#error "KVED_INDEX_SIZE must be a power of 2"
+#endif
+
+/** @private */
+typedef struct kved_index_entry_s
+{
+	kved_word_t key; /**< @private */
+	uint16_t index;  /**< @private */
+} kved_index_entry_t;
+
+/** @private */
+typedef struct kved_index_s
+{
+	kved_index_entry_t entries[KVED_INDEX_SIZE]; /**< @private */
+	uint16_t num_entries;                        /**< @private */
+	bool overflow;                               /**< @private */
+} kved_index_t;
+#endif
+
+#if KVED_BLOOM_BITS > 0
+#if ((KVED_BLOOM_BITS & (KVED_BLOOM_BITS - 1)) != 0) || (KVED_BLOOM_BITS < 32) || (KVED_BLOOM_BITS > 65536)
+#error "KVED_BLOOM_BITS must be a power of 2, from 32 up to 65536"
+#endif
+
+/** @private */
+typedef struct kved_bloom_s
+{
+	uint32_t bits[KVED_BLOOM_BITS/32]; /**< @private */
+	kved_bloom_stats_t stats;          /**< @private */
+} kved_bloom_t;
+#endif
+
+#if ((KVED_READ_BLOCK_SIZE % KVED_ENTRY_SIZE_IN_WORDS) != 0) || (KVED_READ_BLOCK_SIZE == 0)
+#error "KVED_READ_BLOCK_SIZE must be a non zero multiple of the entry size (2 words)"
+#endif
+
+#if KVED_WRITE_BACK_SIZE > 0
+/** @private */
+typedef struct kved_wb_s
+{
+	kved_word_t keys[KVED_WRITE_BACK_SIZE];   /**< @private */
+	kved_word_t values[KVED_WRITE_BACK_SIZE]; /**< @private */
+	uint16_t count;                           /**< @private */
+} kved_wb_t;
+#endif
+
+/**
+@brief Completion callback of @ref kved_data_write_async.
+@param[in] ctx - user context, as given to @ref kved_data_write_async
+@param[in] result - true: value written, false: error during the recording process
+*/
+typedef void (*kved_async_cb_t)(void *ctx, bool result);
+
+#if KVED_ASYNC_SIZE > 0
+/** @private */
+typedef struct kved_async_s
+{
+	kved_word_t keys[KVED_ASYNC_SIZE];    /**< @private */
+	kved_word_t values[KVED_ASYNC_SIZE];  /**< @private */
+	kved_async_cb_t cbs[KVED_ASYNC_SIZE]; /**< @private */
+	void *ctxs[KVED_ASYNC_SIZE];          /**< @private */
+	uint16_t first;                       /**< @private */
+	uint16_t count;                       /**< @private */
+} kved_async_t;
+#endif
+
+/** @private */
+typedef enum kved_standby_state_e
+{
+	KVED_STANDBY_UNKNOWN = 0, /**< @private */
+	KVED_STANDBY_DIRTY,       /**< @private */
+	KVED_STANDBY_BLANK,       /**< @private */
+} kved_standby_state_t;
+
+/** @private */
+typedef struct kved_gc_s
+{
+	bool active;           /**< @private */
+	uint16_t src_index;    /**< @private */
+	uint16_t dst_index;    /**< @private */
+	uint16_t dead_entries; /**< @private */
+} kved_gc_t;
+
+/** @private */
+typedef struct kved_ctrl_s
+{
+	uint16_t first_index;       /**< @private */
+	uint16_t first_free_index;  /**< @private */
+	uint16_t last_index;        /**< @private */
+	kved_sector_stat_t stats;   /**< @private */
+	kved_flash_sector_t sector; /**< @private */
+	uint8_t num_sectors;        /**< @private */
+	uint16_t tail_deleted_entries; /**< @private */
+	kved_standby_state_t standby; /**< @private */
+	kved_gc_t gc;               /**< @private */
+#if KVED_INDEX_SIZE > 0
+	kved_index_t index;         /**< @private */
+#endif
+#if KVED_BITMAP_ENTRIES > 0
+	uint32_t used_map[KVED_BITMAP_WORDS]; /**< @private */
+	bool used_map_valid;                  /**< @private */
+#endif
+#if KVED_BLOOM_BITS > 0
+	kved_bloom_t bloom;         /**< @private */
+#endif
+#if KVED_WRITE_BACK_SIZE > 0
+	kved_wb_t wb;               /**< @private */
+#endif
+#if KVED_ASYNC_SIZE > 0
+	kved_async_t async;         /**< @private */
+#endif
+} kved_ctrl_t;
+
+/**
+@brief Database instance. Each instance uses its own flash sectors, 
+provided by its flash operations (see @ref kved_init_ex). Fields are private.
+*/
+typedef struct kved_s
+{
+	kved_ctrl_t ctrl;               /**< @private */
+	const kved_flash_ops_t *flash;  /**< @private */
+	const kved_lock_ops_t *lock;    /**< @private */
+	volatile bool started;          /**< @private */
+} kved_t;
+
 /**
 @brief Writes a new value to the database.
 @param[in] data - information about the data to be written
@@ -149,11 +341,171 @@ kved_data_write(&kv2);
 */
 bool kved_data_write(kved_data_t *data);
 
+/**
+@brief Writes several values at once. All keys are searched together, with a single sector scan 
+(see @ref KVED_BATCH_SIZE), and unchanged values are skipped. When the newest sector has no room 
+for the whole batch, the oldest sector is compacted once, before writing.
+When the same key appears more than once, the last value is written.
+@param[in] items - information about the data to be written
+@param[in] n - number of items
+@return true: recording successful.
+@return false: error during the recording process (a full database is detected before writing
+each group of @ref KVED_BATCH_SIZE items, previous groups stay written).
+
+@code
+
+kved_data_t cfg[] = {
+	{ .type = KVED_DATA_TYPE_UINT32, .key = "ca1", .value.u32 = 0x12345678 },
+	{ .type = KVED_DATA_TYPE_STRING, .key = "ID", .value.str = "N01" },
+};
+
+kved_data_write_batch(cfg,sizeof(cfg)/sizeof(cfg[0]));
+
+@endcode
+*/
+bool kved_data_write_batch(kved_data_t *items, size_t n);
+
+/**
+@brief Same as @ref kved_data_write, but the value is kept in the RAM write-back table
+(see @ref KVED_WRITE_BACK_SIZE) and written later, by @ref kved_flush or when the table is full.
+A new deferred write of a pending key only updates its RAM value and reads see pending values first.
+Pending values are lost on a reset before the flush. Other writes and deletes of a pending key drop its pending value.
+Values are written immediately when the write-back is disabled.
+@param[in] data - information about the data to be written
+@return true: value kept (or written).
+@return false: invalid key or error while writing the full table.
+
+@code
+kved_data_t temp = { .key = "tmp", .type = KVED_DATA_TYPE_FLOAT };
+
+temp.value.flt = sensor_read(); // at 10 Hz
+kved_data_write_deferred(&temp);
+
+kved_flush(); // every few seconds or on a brown-out interrupt
+@endcode
+*/
+bool kved_data_write_deferred(kved_data_t *data);
+
+/**
+@brief Writes all pending values of the RAM write-back table (see @ref kved_data_write_deferred)
+in a single pass, as @ref kved_data_write_batch does. Pending values are kept when there is no room for them.
+Iterations and entry counters only see values already written.
+@return true: all pending values written (or none pending).
+@return false: error during the recording process.
+*/
+bool kved_flush(void);
+
+/**
+@brief Starts a transaction: values added by @ref kved_txn_put are only written by @ref kved_txn_commit, 
+all of them or none of them, even after a power loss.
+@param[out] txn - transaction, kept by the application until the commit
+
+@code
+
+kved_txn_t txn;
+kved_data_t gain = { .type = KVED_DATA_TYPE_FLOAT, .key = "gn", .value.flt = 1.02f };
+kved_data_t offset = { .type = KVED_DATA_TYPE_INT16, .key = "of", .value.i16 = -12 };
+
+kved_txn_begin(&txn);
+kved_txn_put(&txn,&gain);
+kved_txn_put(&txn,&offset);
+
+if(!kved_txn_commit(&txn))
+	printf("Calibration not saved");
+
+@endcode
+*/
+void kved_txn_begin(kved_txn_t *txn);
+
+/**
+@brief Adds a value to a transaction. The database is not accessed, the value is not visible until the commit.
+Adding the same key again replaces its value.
+@param[in,out] txn - transaction
+@param[in] data - information about the data to be written
+@return true: value added.
+@return false: invalid key or more than @ref KVED_TXN_SIZE keys, the transaction will not be committed.
+*/
+bool kved_txn_put(kved_txn_t *txn, kved_data_t *data);
+
+/**
+@brief Writes all values of a transaction. A transaction record is written before the changed values, 
+all of them in the newest sector, and it is deleted after the last value (the commit is a single word write). 
+At startup, values after a transaction record still in place are removed, keeping the old values.
+Only after the commit the old values are deleted. The transaction is ended, start a new one for further values.
+@param[in,out] txn - transaction
+@return true: all values written (or no value changed).
+@return false: nothing was written (failed @ref kved_txn_put, no free space or more values than a sector can hold).
+*/
+bool kved_txn_commit(kved_txn_t *txn);
+
+/**
+@brief Writes a blob, a value with several flash words. Blob bytes are split in fragments of 
+@ref KVED_BLOB_FRAG_SIZE bytes, each one using an entry, written just before a blob header entry 
+(key with type @ref KVED_DATA_TYPE_BLOB and a value with the size and the CRC of the blob).
+The header is written last, so an incomplete blob is removed at startup. Blobs are moved and 
+deleted as a unit and they can not be larger than a sector.
+@param[in] key - access key, up to @ref KVED_MAX_KEY_SIZE characters
+@param[in] blob - blob bytes
+@param[in] size - blob size, in bytes
+@return true: recording successful (or the blob has not changed).
+@return false: error during the recording process.
+
+@code
+
+const uint8_t curve[40] = { ... };
+
+kved_blob_write("cal",curve,sizeof(curve));
+
+@endcode
+*/
+bool kved_blob_write(const char *key, const void *blob, uint16_t size);
+
+/**
+@brief Retrieves a previously saved blob, see @ref kved_blob_write. The blob CRC is checked.
+@param[in] key - access key
+@param[out] blob - buffer for the blob bytes
+@param[in,out] size - buffer size, updated with the blob size (also when the buffer is too small)
+@return true: read successfully.
+@return false: blob not found, buffer too small or CRC error.
+*/
+bool kved_blob_read(const char *key, void *blob, uint16_t *size);
+
+/**
+@brief Increments a counter, created with 1 when it does not exist. 
+A counter is stored as a fragment entry, as the blob fragments, and a header entry with the 
+counter value when the entries were written. Each increment clears one bit of the fragment, in place, 
+so only one of each @ref KVED_COUNTER_BITS increments writes new entries. 
+Clearing bits of a programmed word requires flash support (@ref KVED_FLASH_BIT_CLEAR, e.g. STM32F4): 
+flash with ECC per word (STM32L4, STM32WB, STM32C0) or half-word programming (STM32F1) only accepts zero 
+over a programmed word, so each increment writes new counter entries there.
+Counters are also read by @ref kved_data_read (type @ref KVED_DATA_TYPE_COUNTER) and removed 
+by @ref kved_data_delete.
+@param[in] key - counter key (null terminated), up to @ref KVED_MAX_KEY_SIZE chars
+@return true: counter incremented.
+@return false: error during the recording process or key stored with another type.
+
+@code
+kved_counter_inc("bts");
+@endcode
+*/
+bool kved_counter_inc(const char *key);
+
+/**
+@brief Retrieves the value of a counter, see @ref kved_counter_inc.
+@param[in] key - counter key (null terminated)
+@param[out] value - counter value
+@return true: read successfully.
+@return false: counter not found or key stored with another type.
+*/
+bool kved_counter_get(const char *key, kved_word_t *value);
+
+
 /**
 @brief Retrieves a previously saved value from database.
+Blobs are not read as values (use @ref kved_blob_read), counters are read with their current count.
 @param[out] data - Structure where the retrieved value will be stored (type and content)
 @return true: read successfully.
-@return false: error during the reading process.
+@return false: error during the reading process, key not found or key of a blob.
 
 @code
 
@@ -175,6 +527,29 @@ if(kved_data_read(&kv2))
 */
 bool kved_data_read(kved_data_t *data);
 
+/**
+@brief Retrieves a pointer to a previously saved value, directly from the flash, without copying it.
+Only available when the flash port maps the sectors into memory (see @ref kved_flash_sector_address).
+The pointer is valid until the next write, delete or format operation.
+@param[in,out] data - structure with the key to search for, type is updated
+@return pointer to the stored value or NULL when the key is not found, the flash is not memory mapped 
+or the key is a counter or a blob (type is updated).
+
+@code
+
+kved_data_t kv1 = {
+	.key = "ca1",
+};
+
+const kved_value_t *val = kved_data_view(&kv1);
+
+if(val)
+	printf("Value: %d\n",val->u32);
+
+@endcode
+*/
+const kved_value_t *kved_data_view(kved_data_t *data);
+
 /**
 @brief Deletes a previously saved value in the database, if it exists.
 @param[in] data - Structure where the retrieved value will be stored (type and content)
@@ -197,7 +572,8 @@ bool kved_data_delete(kved_data_t *data);
 /**
 @brief Retrieves a previously saved value from database but using an index.
 This function is used in conjunction with @ref kved_first_used_index_get and @ref kved_next_used_index_get
-to iterate over the database.
+to iterate over the database. Blobs are listed by their header entry (type @ref KVED_DATA_TYPE_BLOB), 
+with the blob size (low 16 bits) and CRC (next 16 bits) as value, see @ref kved_blob_read for their contents.
 @param[in] index - index of the value to retrieve
 @param[out] data - structure where the retrieved value will be stored (type and content)
 @return true: read successfully.
@@ -236,7 +612,7 @@ uint16_t kved_first_used_index_get(void);
 uint16_t kved_next_used_index_get(uint16_t last_index);
 
 /**
-@brief Returns the number of database entries (used or not)
+@brief Returns the number of database entries (used or not), standby sector excluded
 @return Number of entries
 */
 uint16_t kved_total_entries_get(void);
@@ -253,6 +629,75 @@ uint16_t kved_used_entries_get(void);
 */
 uint16_t kved_free_entries_get(void);
 
+/**
+@brief Idle hook: prepare the standby sector for the next sector switch, erasing it when required 
+and checking if it is blank. The sector switch, done when a write finds no free entries, 
+only copies data when the standby sector is ready, without erasing a sector inside @ref kved_data_write.
+Call it when the application is idle (it may erase a sector inside the critical section).
+After a reset, the first call only reads the standby sector (blank check).
+@return true: standby sector is blank, nothing else to do
+@return false: database not started, standby sector in use by @ref kved_gc_step or erasing failed
+*/
+bool kved_idle(void);
+
+/**
+@brief Incremental garbage collection: copy a few live entries of the oldest sector into the standby 
+sector, switching to it when all entries were copied. Entries updated or deleted after being copied are 
+invalidated in the standby sector. Call it from the idle loop, so writes rarely need a full sector switch
+(a write finding no free entries still finishes the copy).
+A collection starts when all sectors are in use and the deleted entries of the oldest sector are not fewer 
+than the free entries. Erasing the standby sector, when required, is done as a single step (see @ref kved_idle).
+With more than two sectors, the switch is delayed until the newest sector is full.
+Power loss safe: the standby sector header is written after the last copy.
+@param[in] max_words - maximum number of sector words visited (two words per entry)
+@return true: collection in progress, call it again
+@return false: nothing to do
+*/
+bool kved_gc_step(uint16_t max_words);
+
+/**
+@brief Writes a new value without waiting for the flash: the request is queued in RAM (see @ref KVED_ASYNC_SIZE)
+and written by @ref kved_poll, that calls @p cb when it is done. Requests are written in order and reads only see 
+their values after the completion. Pending requests are lost on a reset, @ref kved_init or @ref kved_format 
+(callbacks are not called). When the queue is disabled, the value is written immediately and @p cb is 
+called before returning.
+@param[in] data - information about the data to be written
+@param[in] cb - completion callback (optional, NULL)
+@param[in] ctx - user context for @p cb
+@return true: request queued (or value written).
+@return false: invalid key or queue full.
+
+@code
+static void cfg_saved(void *ctx, bool result)
+{
+	// ...
+}
+
+kved_data_write_async(&cfg,cfg_saved,NULL);
+
+while(kved_poll())
+	task_delay(1); // other tasks run while flash is busy
+@endcode
+*/
+bool kved_data_write_async(kved_data_t *data, kved_async_cb_t cb, void *ctx);
+
+/**
+@brief Background state machine: writes pending requests of @ref kved_data_write_async, prepares the standby sector
+(see @ref kved_idle) and runs the incremental garbage collection (see @ref kved_gc_step), one step per call.
+It returns immediately while the flash is busy (see @ref kved_flash_busy) and erasing is a step by itself, 
+so calls are short when the port does not wait for the end of flash operations.
+Completion callbacks are called out of the critical section.
+@return true: work in progress (or flash busy), call it again
+@return false: nothing to do
+*/
+bool kved_poll(void);
+
+/**
+@brief Get the Bloom filter statistics since the last format (all zeros when @ref KVED_BLOOM_BITS is 0)
+@param[out] stats - current statistics
+*/
+void kved_bloom_stats_get(kved_bloom_stats_t *stats);
+
 /**
 @brief Print all values stored in the database
 */
@@ -279,9 +724,230 @@ kved_word_t kved_key_encode(kved_data_t *data);
 
 /**
 @brief Initialize the database. Must be called before any use.
+Sectors times words per sector can not exceed 65536 (see @ref KVED_FLASH_NUM_SECTORS): 
+with a larger runtime sector size (simulation and mmap ports), the database is not started 
+and all calls fail (asserted when KVED_DEBUG is defined). Hardware ports check it at build time.
+Duplicated keys left by a power loss are solved with a single pass over the sectors, so the startup 
+time grows linearly with the sector size, when the RAM key index holds all keys (@ref KVED_INDEX_SIZE) 
+or when a scratch buffer is given (see @ref kved_init_scratch). Otherwise, as a fallback, the newer 
+entries are searched for each key and the startup time grows with the square of the number of entries.
 */
 void kved_init(void);
 
+/**
+@brief Same as @ref kved_init, with a RAM scratch buffer used to find duplicated keys in a single pass 
+when the RAM key index is disabled or overflowed. The buffer is a hash set of 16 bits entry indexes, 
+only used during the call, so it can be shared with other startup code. It is used when the used entries 
+are up to 3/4 of @p size: a buffer with 4/3 of the database entries (see @ref kved_total_entries_get) 
+is always used. Smaller buffers fall back to the search of newer entries, as @ref kved_init.
+@code
+static uint16_t scratch[4*(2048/8)/3 + 1]; // two 2 KiB sectors of 32 bits words: 256 entries
+
+kved_init_scratch(scratch,sizeof(scratch)/sizeof(scratch[0]));
+@endcode
+@param[in] buf - scratch buffer
+@param[in] size - number of 16 bits elements of @p buf
+*/
+void kved_init_scratch(uint16_t *buf, uint16_t size);
+
+/**
+@brief Encode a long key name (up to @ref KVED_LONG_KEY_SIZE chars) as a key entry.
+The key chars of the entry are a hash of the name, with @ref KVED_LONG_KEY_MARKER in the 
+first char, so lookups still compare a single word per entry.
+@param[in] name - key name (null terminated)
+@param[in] type - data type
+@return Encoded key entry
+*/
+kved_word_t kved_long_key_encode(const char *name, kved_data_types_t type);
+
+/**
+@brief Same as @ref kved_data_write but using a long key name, see @ref kved_long_key_encode.
+When @ref KVED_LONG_KEY_NAMES is enabled, the name is stored as well and the write fails
+if another name with the same hash is already there.
+@param[in] name - key name (null terminated)
+@param[in] data - information about the data to be written (key field is not used)
+@return true: recording successful.
+@return false: error during the recording process, name too long or hash collision.
+
+@code
+kved_data_t kv = { .type = KVED_DATA_TYPE_UINT32, .value.u32 = 115200 };
+kved_long_key_data_write("uart.console.baudrate",&kv);
+@endcode
+*/
+bool kved_long_key_data_write(const char *name, kved_data_t *data);
+
+/**
+@brief Same as @ref kved_data_read but using a long key name, see @ref kved_long_key_encode.
+When @ref KVED_LONG_KEY_NAMES is set, the stored name is compared too, so a value written 
+with another name with the same hash is not returned. Otherwise, hash collisions are not detected.
+@param[in] name - key name (null terminated)
+@param[out] data - Structure where the retrieved value will be stored (type and content, key field is not used)
+@return true: read successfully.
+@return false: error during the reading process, key not found or stored with another name.
+*/
+bool kved_long_key_data_read(const char *name, kved_data_t *data);
+
+/**
+@brief Same as @ref kved_data_delete but using a long key name. Its stored name is also deleted.
+When @ref KVED_LONG_KEY_NAMES is set, the stored name is compared first, so the value and the name 
+of another name with the same hash are kept. Otherwise, hash collisions are not detected.
+@param[in] name - key name (null terminated)
+@return true: key deleted.
+@return false: key not found, stored with another name or name too long.
+*/
+bool kved_long_key_data_delete(const char *name);
+
+/**
+@brief Retrieves the name of a long key, given an entry read by @ref kved_data_read_by_index.
+Only available when @ref KVED_LONG_KEY_NAMES is enabled.
+Stored names are blobs with @ref KVED_LONG_KEY_NAME_MARKER in the first key char, also found during iterations.
+@param[in] data - entry with a long key (@ref KVED_LONG_KEY_MARKER in the first key char)
+@param[out] name - buffer for the name, null terminated
+@param[in] size - buffer size
+@return true: name retrieved.
+@return false: not a long key, name not stored or buffer too small.
+*/
+bool kved_long_key_name_get(kved_data_t *data, char *name, uint16_t size);
+
+/**
+@brief Same as @ref kved_data_write but using a key already encoded by @ref kved_key_encode 
+(or at compile time, see kved.hpp), avoiding the key encoding on each call.
+@param[in] key - encoded key, type and size must match the data
+@param[in] data - information about the data to be written (key field is not used)
+@return true: recording successful.
+@return false: error during the recording process.
+*/
+bool kved_encoded_data_write(kved_word_t key, kved_data_t *data);
+
+/**
+@brief Same as @ref kved_data_read but using a key already encoded by @ref kved_key_encode
+(or at compile time, see kved.hpp). An optional hint with the last known key index can be 
+used to avoid the key lookup: when the key is still there, only one entry is read.
+@param[in] key - encoded key (type and size are ignored)
+@param[in,out] hint - last known key index (updated) or NULL. Use @ref KVED_INDEX_NOT_FOUND when unknown.
+@param[out] data - Structure where the retrieved value will be stored (type and content, key field is not used)
+@return true: read successfully.
+@return false: error during the reading process.
+*/
+bool kved_encoded_data_read(kved_word_t key, uint16_t *hint, kved_data_t *data);
+
+/**
+@brief Initialize a database instance. Must be called before any use of the instance.
+The default instance, used by the functions without the _ex suffix, is initialized by @ref kved_init.
+Instances with more than 65536 words in all sectors are not started, as in @ref kved_init.
+@code
+static kved_t calib;
+static const kved_flash_ops_t calib_flash = { ... }; // maps sectors A/B to another sector pair
+
+kved_init_ex(&calib,&calib_flash,NULL);
+kved_data_write_ex(&calib,&kv1);
+@endcode
+@param[out] kv - database instance
+@param[in] flash - flash operations, NULL for the flash port (@ref kved_flash_port_ops)
+@param[in] lock - lock operations, NULL for the CPU read and write locks (@ref kved_cpu_lock_ops)
+*/
+void kved_init_ex(kved_t *kv, const kved_flash_ops_t *flash, const kved_lock_ops_t *lock);
+
+/** @brief Same as @ref kved_init_scratch, for the instance @p kv (see @ref kved_init_ex) */
+void kved_init_scratch_ex(kved_t *kv, const kved_flash_ops_t *flash, const kved_lock_ops_t *lock, uint16_t *buf, uint16_t size);
+
+/** @brief Same as @ref kved_data_write, for the instance @p kv */
+bool kved_data_write_ex(kved_t *kv, kved_data_t *data);
+
+/** @brief Same as @ref kved_encoded_data_write, for the instance @p kv */
+bool kved_encoded_data_write_ex(kved_t *kv, kved_word_t key, kved_data_t *data);
+
+/** @brief Same as @ref kved_data_write_batch, for the instance @p kv */
+bool kved_data_write_batch_ex(kved_t *kv, kved_data_t *items, size_t n);
+
+/** @brief Same as @ref kved_data_write_deferred, for the instance @p kv */
+bool kved_data_write_deferred_ex(kved_t *kv, kved_data_t *data);
+
+/** @brief Same as @ref kved_flush, for the instance @p kv */
+bool kved_flush_ex(kved_t *kv);
+
+/** @brief Same as @ref kved_txn_commit, for the instance @p kv */
+bool kved_txn_commit_ex(kved_t *kv, kved_txn_t *txn);
+
+/** @brief Same as @ref kved_blob_write, for the instance @p kv */
+bool kved_blob_write_ex(kved_t *kv, const char *key, const void *blob, uint16_t size);
+
+/** @brief Same as @ref kved_blob_read, for the instance @p kv */
+bool kved_blob_read_ex(kved_t *kv, const char *key, void *blob, uint16_t *size);
+
+/** @brief Same as @ref kved_counter_inc, for the instance @p kv */
+bool kved_counter_inc_ex(kved_t *kv, const char *key);
+
+/** @brief Same as @ref kved_counter_get, for the instance @p kv */
+bool kved_counter_get_ex(kved_t *kv, const char *key, kved_word_t *value);
+
+/** @brief Same as @ref kved_long_key_data_write, for the instance @p kv */
+bool kved_long_key_data_write_ex(kved_t *kv, const char *name, kved_data_t *data);
+
+/** @brief Same as @ref kved_long_key_data_read, for the instance @p kv */
+bool kved_long_key_data_read_ex(kved_t *kv, const char *name, kved_data_t *data);
+
+/** @brief Same as @ref kved_long_key_data_delete, for the instance @p kv */
+bool kved_long_key_data_delete_ex(kved_t *kv, const char *name);
+
+/** @brief Same as @ref kved_long_key_name_get, for the instance @p kv */
+bool kved_long_key_name_get_ex(kved_t *kv, kved_data_t *data, char *name, uint16_t size);
+
+/** @brief Same as @ref kved_data_read, for the instance @p kv */
+bool kved_data_read_ex(kved_t *kv, kved_data_t *data);
+
+/** @brief Same as @ref kved_encoded_data_read, for the instance @p kv */
+bool kved_encoded_data_read_ex(kved_t *kv, kved_word_t key, uint16_t *hint, kved_data_t *data);
+
+/** @brief Same as @ref kved_data_view, for the instance @p kv */
+const kved_value_t *kved_data_view_ex(kved_t *kv, kved_data_t *data);
+
+/** @brief Same as @ref kved_data_delete, for the instance @p kv */
+bool kved_data_delete_ex(kved_t *kv, kved_data_t *data);
+
+/** @brief Same as @ref kved_data_read_by_index, for the instance @p kv */
+bool kved_data_read_by_index_ex(kved_t *kv, uint16_t index, kved_data_t *data);
+
+/** @brief Same as @ref kved_first_used_index_get, for the instance @p kv */
+uint16_t kved_first_used_index_get_ex(kved_t *kv);
+
+/** @brief Same as @ref kved_next_used_index_get, for the instance @p kv */
+uint16_t kved_next_used_index_get_ex(kved_t *kv, uint16_t last_index);
+
+/** @brief Same as @ref kved_total_entries_get, for the instance @p kv */
+uint16_t kved_total_entries_get_ex(kved_t *kv);
+
+/** @brief Same as @ref kved_used_entries_get, for the instance @p kv */
+uint16_t kved_used_entries_get_ex(kved_t *kv);
+
+/** @brief Same as @ref kved_free_entries_get, for the instance @p kv */
+uint16_t kved_free_entries_get_ex(kved_t *kv);
+
+/** @brief Same as @ref kved_idle, for the instance @p kv */
+bool kved_idle_ex(kved_t *kv);
+
+/** @brief Same as @ref kved_gc_step, for the instance @p kv */
+bool kved_gc_step_ex(kved_t *kv, uint16_t max_words);
+
+/** @brief Same as @ref kved_data_write_async, for the instance @p kv */
+bool kved_data_write_async_ex(kved_t *kv, kved_data_t *data, kved_async_cb_t cb, void *ctx);
+
+/** @brief Same as @ref kved_poll, for the instance @p kv */
+bool kved_poll_ex(kved_t *kv);
+
+/** @brief Same as @ref kved_bloom_stats_get, for the instance @p kv */
+void kved_bloom_stats_get_ex(kved_t *kv, kved_bloom_stats_t *stats);
+
+/** @brief Same as @ref kved_dump, for the instance @p kv */
+void kved_dump_ex(kved_t *kv);
+
+/** @brief Same as @ref kved_format, for the instance @p kv */
+void kved_format_ex(kved_t *kv);
+
+#ifdef __cplusplus
+}
+#endif
+
 /**
 @}
 */
@@ -0,0 +1,401 @@
+/*
+kved (key/value embedded database), a simple key/value database
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+/**
+@file
+@brief C++17 helpers for kved: compile time key encoding and perfect hashing.
+
+Keys are encoded at compile time, with the same result of @ref kved_key_encode,
+and used with @ref kved_encoded_data_read / @ref kved_encoded_data_write, so
+no key encoding is done at runtime:
+
+@code
+constexpr kved::key<kved::u32> ca1{"ca1"};
+constexpr kved::key<kved::flt> gain{"gn"};
+
+ca1.write(0x12345678);
+
+uint32_t v;
+if(ca1.read(v))
+	printf("ca1 = %u\n",v);
+@endcode
+
+When all application keys are known, a perfect hash can be generated at compile time
+and used to keep the last flash position of each key in RAM (O(1) reads):
+
+@code
+constexpr auto keys = kved::make_registry(ca1,gain);
+static_assert(keys.valid(),"perfect hash not found");
+
+kved::index idx{keys};
+
+idx.read(ca1,v);
+@endcode
+
+Key encoding assumes a little endian target, as @ref kved_key_encode does.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "kved.h"
+
+namespace kved
+{
+
+/**
+@brief Data type tag, binding a kved data type to its C++ type.
+*/
+template<kved_data_types_t Type, class T, T kved_value_t::*Member>
+struct type_tag
+{
+	static constexpr kved_data_types_t id = Type; /**< kved data type */
+	using value_type = T;                         /**< C++ value type */
+
+	/** @private */
+	static void set(kved_value_t &dst, const value_type &v) { dst.*Member = v; }
+	/** @private */
+	static void get(const kved_value_t &src, value_type &v) { v = src.*Member; }
+};
+
+using u8  = type_tag<KVED_DATA_TYPE_UINT8,  uint8_t,  &kved_value_t::u8>;  /**< unsigned 8 bits */
+using i8  = type_tag<KVED_DATA_TYPE_INT8,   int8_t,   &kved_value_t::i8>;  /**< signed 8 bits */
+using u16 = type_tag<KVED_DATA_TYPE_UINT16, uint16_t, &kved_value_t::u16>; /**< unsigned 16 bits */
+using i16 = type_tag<KVED_DATA_TYPE_INT16,  int16_t,  &kved_value_t::i16>; /**< signed 16 bits */
+using u32 = type_tag<KVED_DATA_TYPE_UINT32, uint32_t, &kved_value_t::u32>; /**< unsigned 32 bits */
+using i32 = type_tag<KVED_DATA_TYPE_INT32,  int32_t,  &kved_value_t::i32>; /**< signed 32 bits */
+using flt = type_tag<KVED_DATA_TYPE_FLOAT,  float,    &kved_value_t::flt>; /**< single precision float */
+#if KVED_FLASH_WORD_SIZE == 8
+using u64 = type_tag<KVED_DATA_TYPE_UINT64, uint64_t, &kved_value_t::u64>; /**< unsigned 64 bits */
+using i64 = type_tag<KVED_DATA_TYPE_INT64,  int64_t,  &kved_value_t::i64>; /**< signed 64 bits */
+using dbl = type_tag<KVED_DATA_TYPE_DOUBLE, double,   &kved_value_t::dbl>; /**< double precision float */
+#endif
+
+/**
+@brief String tag, values are copied from/to a fixed size buffer (with terminator).
+*/
+struct str
+{
+	static constexpr kved_data_types_t id = KVED_DATA_TYPE_STRING; /**< kved data type */
+	using value_type = std::array<char,KVED_MAX_STRING_SIZE + 1>;  /**< C++ value type */
+
+	/** @private */
+	static void set(kved_value_t &dst, const value_type &v)
+	{
+		for(std::size_t p = 0 ; p < KVED_MAX_STRING_SIZE ; p++)
+			dst.str[p] = static_cast<uint8_t>(v[p]);
+	}
+	/** @private */
+	static void get(const kved_value_t &src, value_type &v)
+	{
+		for(std::size_t p = 0 ; p < KVED_MAX_STRING_SIZE ; p++)
+			v[p] = static_cast<char>(src.str[p]);
+		v[KVED_MAX_STRING_SIZE] = 0;
+	}
+};
+
+/**
+@brief Compile time version of @ref kved_key_encode.
+@param[in] name - key name, up to @ref KVED_MAX_KEY_SIZE characters are used
+@param[in] type - data type
+@return encoded key
+*/
+constexpr kved_word_t encode(const char *name, kved_data_types_t type)
+{
+	// must match kved_data_type_size in kved.c
+	constexpr uint8_t type_size[] = { 1, 1, 2, 2, 2, 2, 4, KVED_MAX_STRING_SIZE,
+#if KVED_FLASH_WORD_SIZE == 8
+		8, 8, 8,
+#endif
+		0, 0,
+	};
+
+	std::size_t len = 0;
+	while((len < KVED_MAX_KEY_SIZE) && name[len])
+		len++;
+
+	uint8_t size = type == KVED_DATA_TYPE_STRING ? static_cast<uint8_t>(len) : type_size[type];
+	kved_word_t encoded_key = static_cast<kved_word_t>((type << 4) | size);
+
+	// first key char goes to the most significant byte
+	for(std::size_t p = 0 ; p < len ; p++)
+		encoded_key |= static_cast<kved_word_t>(static_cast<uint8_t>(name[p])) << (8*(KVED_MAX_KEY_SIZE - p));
+
+	return encoded_key;
+}
+
+/**
+@brief Typed key, encoded at compile time.
+*/
+template<class Tag>
+class key
+{
+public:
+	using value_type = typename Tag::value_type; /**< C++ value type */
+
+	/**
+	@brief Create a key from a string literal, up to @ref KVED_MAX_KEY_SIZE characters.
+	*/
+	template<std::size_t N>
+	constexpr explicit key(const char (&name)[N]) : word(encode(name,Tag::id))
+	{
+		static_assert(N - 1 <= KVED_MAX_KEY_SIZE,"kved key too long");
+	}
+
+	/**
+	@brief Write a new value, see @ref kved_data_write.
+	*/
+	bool write(const value_type &v) const
+	{
+		kved_data_t data{};
+
+		data.type = Tag::id;
+		Tag::set(data.value,v);
+
+		return kved_encoded_data_write(word,&data);
+	}
+
+	/**
+	@brief Read the current value, see @ref kved_encoded_data_read.
+	@param[out] v - value read
+	@param[in,out] hint - last known key index (updated) or nullptr
+	@return false when key does not exist or it was stored with another type
+	*/
+	bool read(value_type &v, uint16_t *hint = nullptr) const
+	{
+		kved_data_t data{};
+
+		if(!kved_encoded_data_read(word,hint,&data) || (data.type != Tag::id))
+			return false;
+
+		Tag::get(data.value,v);
+
+		return true;
+	}
+
+	/**
+	@brief Remove the key, see @ref kved_data_delete.
+	*/
+	bool remove(void) const
+	{
+		kved_data_t data{};
+
+		kved_key_decode(&data,word);
+
+		return kved_data_delete(&data);
+	}
+
+	kved_word_t word; /**< encoded key */
+};
+
+/** @private */
+namespace detail
+{
+
+constexpr std::size_t next_pow2(std::size_t n)
+{
+	std::size_t p = 1;
+
+	while(p < n)
+		p <<= 1;
+
+	return p;
+}
+
+constexpr uint32_t hash(kved_word_t key, uint32_t seed)
+{
+	uint64_t h = static_cast<uint64_t>(KVED_HDR_MASK_KEY(key)) ^ (seed*0x9E3779B97F4A7C15ULL);
+
+	h = (h ^ (h >> 30))*0xBF58476D1CE4E5B9ULL;
+	h = (h ^ (h >> 27))*0x94D049BB133111EBULL;
+
+	return static_cast<uint32_t>(h ^ (h >> 31));
+}
+
+} // namespace detail
+
+/**
+@brief Perfect hash of a fixed key set, built at compile time (hash and displace).
+Keys are first split into buckets, then a seed is searched for each bucket, largest
+buckets first, mapping all bucket keys to free slots.
+Type and size of keys are not considered, as in the database.
+*/
+template<std::size_t N>
+class registry
+{
+public:
+	static_assert(N > 0,"empty kved registry");
+
+	/**
+	@brief Build the perfect hash for the given encoded keys.
+	*/
+	constexpr explicit registry(const std::array<kved_word_t,N> &k) : keys(k), seeds(), slot_key(), ok(build()) {}
+
+	/**
+	@brief True when a perfect hash was found (no duplicated keys as well).
+	*/
+	constexpr bool valid(void) const { return ok; }
+
+	/**
+	@brief Number of slots.
+	*/
+	static constexpr std::size_t size(void) { return slots; }
+
+	/**
+	@brief Slot of a key or @ref size() when key is not in the registry.
+	*/
+	constexpr std::size_t slot(kved_word_t key) const
+	{
+		std::size_t s = detail::hash(key,seeds[detail::hash(key,0) & (slots - 1)]) & (slots - 1);
+
+		return (slot_key[s] == N) || (KVED_HDR_MASK_KEY(keys[slot_key[s]]) != KVED_HDR_MASK_KEY(key)) ? slots : s;
+	}
+
+	/**
+	@brief True when key is in the registry.
+	*/
+	constexpr bool contains(kved_word_t key) const { return slot(key) != slots; }
+
+private:
+	static constexpr std::size_t slots = detail::next_pow2(N);
+	static constexpr uint32_t max_seed = 0xFFFF;
+
+	constexpr bool build(void)
+	{
+		std::array<std::size_t,N> bucket{};
+		std::array<std::size_t,slots> bucket_size{};
+
+		for(std::size_t s = 0 ; s < slots ; s++)
+			slot_key[s] = N;
+
+		for(std::size_t n = 0 ; n < N ; n++)
+		{
+			for(std::size_t m = 0 ; m < n ; m++)
+			{
+				if(KVED_HDR_MASK_KEY(keys[n]) == KVED_HDR_MASK_KEY(keys[m]))
+					return false;
+			}
+
+			bucket[n] = detail::hash(keys[n],0) & (slots - 1);
+			bucket_size[bucket[n]]++;
+		}
+
+		for(std::size_t size = N ; size > 0 ; size--)
+		{
+			for(std::size_t b = 0 ; b < slots ; b++)
+			{
+				if(bucket_size[b] == size && !place(bucket,b))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	constexpr bool place(const std::array<std::size_t,N> &bucket, std::size_t b)
+	{
+		for(uint32_t seed = 1 ; seed <= max_seed ; seed++)
+		{
+			std::array<std::size_t,slots> taken{};
+			bool found = true;
+
+			for(std::size_t n = 0 ; found && (n < N) ; n++)
+			{
+				if(bucket[n] != b)
+					continue;
+
+				std::size_t s = detail::hash(keys[n],seed) & (slots - 1);
+
+				if((slot_key[s] != N) || taken[s])
+					found = false;
+				else
+					taken[s] = n + 1;
+			}
+
+			if(!found)
+				continue;
+
+			for(std::size_t s = 0 ; s < slots ; s++)
+			{
+				if(taken[s])
+					slot_key[s] = taken[s] - 1;
+			}
+
+			seeds[b] = seed;
+
+			return true;
+		}
+
+		return false;
+	}
+
+	std::array<kved_word_t,N> keys;
+	std::array<uint32_t,slots> seeds;
+	std::array<std::size_t,slots> slot_key;
+	bool ok;
+};
+
+/**
+@brief Build a @ref registry from a set of keys.
+*/
+template<class... Tags>
+constexpr registry<sizeof...(Tags)> make_registry(const key<Tags> &... k)
+{
+	return registry<sizeof...(Tags)>(std::array<kved_word_t,sizeof...(Tags)>{ k.word... });
+}
+
+/**
+@brief RAM index with the last known flash position of each registry key.
+Positions are checked on each read, a sector switch or an update only costs a new lookup.
+*/
+template<std::size_t N>
+class index
+{
+public:
+	/**
+	@brief Create an index for the given registry.
+	*/
+	constexpr explicit index(const registry<N> &r) : reg(r), hints() { reset(); }
+
+	/**
+	@brief Read a key using its last known position, see @ref key::read.
+	*/
+	template<class Tag>
+	bool read(const key<Tag> &k, typename Tag::value_type &v)
+	{
+		std::size_t s = reg.slot(k.word);
+
+		return k.read(v,s < registry<N>::size() ? &hints[s] : nullptr);
+	}
+
+	/**
+	@brief Write a key, see @ref key::write.
+	*/
+	template<class Tag>
+	bool write(const key<Tag> &k, const typename Tag::value_type &v)
+	{
+		return k.write(v);
+	}
+
+	/**
+	@brief Forget all positions (after @ref kved_format, for instance).
+	*/
+	constexpr void reset(void)
+	{
+		for(std::size_t s = 0 ; s < registry<N>::size() ; s++)
+			hints[s] = KVED_INDEX_NOT_FOUND;
+	}
+
+private:
+	registry<N> reg;
+	std::array<uint16_t,registry<N>::size()> hints;
+};
+
+} // namespace kved
@@ -19,8 +19,122 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 
 #define KVED_FLASH_WORD_SIZE PORT_KVED_FLASH_WORD_SIZE
 
+/**
+@brief Number of flash sectors (from 2 up to 16), used as a ring, provided by the flash port.
+Entries are appended to the newest sector and, when it is full, the next sector is started.
+One sector is kept as standby: when it is the only one left, live entries of the oldest 
+sector are moved into it and the oldest sector becomes the new standby. 
+Database capacity is (sectors - 1) sectors. Sectors times words per sector can not exceed 65536.
+*/
+#ifdef PORT_KVED_FLASH_NUM_SECTORS
+#define KVED_FLASH_NUM_SECTORS PORT_KVED_FLASH_NUM_SECTORS
+#else
+#define KVED_FLASH_NUM_SECTORS 2
+#endif
+
+/**
+@brief Flash words can be programmed again, clearing more bits, provided by the flash port (1) or not (0, the default).
+Counters clear one bit per increment in place (see @ref kved_counter_inc) only when it is supported. 
+Flash with ECC per word (STM32L4, STM32WB, STM32C0) or programmed in half-words (STM32F1) only accept 
+zero over a programmed word: each counter increment writes new counter entries.
+*/
+#ifdef PORT_KVED_FLASH_BIT_CLEAR
+#define KVED_FLASH_BIT_CLEAR PORT_KVED_FLASH_BIT_CLEAR
+#else
+#define KVED_FLASH_BIT_CLEAR 0
+#endif
+
 //#define KVED_DEBUG
 
+/**
+@brief Number of buckets (power of 2) of the RAM key index, used to avoid a sector
+scan on each key lookup. Each bucket uses a flash word plus 16 bits of RAM.
+When the number of keys exceeds 3/4 of the buckets, lookups fall back to the sector scan.
+The index also solves duplicated keys at startup in a single pass (see @ref kved_init).
+Use 0 to disable the index.
+*/
+#ifndef KVED_INDEX_SIZE
+#define KVED_INDEX_SIZE 0
+#endif
+
+/**
+@brief Maximum number of entries (of all sectors) tracked by the RAM bitmap of used entries, 
+used for iteration without sector scans (one bit per entry).
+When the sectors have more entries, iteration falls back to the sector scan.
+Use 0 to disable the bitmap.
+*/
+#ifndef KVED_BITMAP_ENTRIES
+#define KVED_BITMAP_ENTRIES 0
+#endif
+
+/**
+@brief Number of bits (power of 2, from 32 up to 65536) of the RAM Bloom filter over stored keys,
+used to report absent keys without a key lookup. The filter is rebuilt on each sector 
+switch, so deleted keys may remain as false positives until then.
+Use 0 to disable the filter.
+*/
+#ifndef KVED_BLOOM_BITS
+#define KVED_BLOOM_BITS 0
+#endif
+
+/**
+@brief Number of flash words read at once, into a stack buffer, when scanning a sector.
+Entries copied by the garbage collection are also written in blocks of this size (see @ref kved_flash_data_write_block).
+Must be a multiple of the entry size (2 words).
+*/
+#ifndef KVED_READ_BLOCK_SIZE
+#define KVED_READ_BLOCK_SIZE 16
+#endif
+
+/**
+@brief Number of items of @ref kved_data_write_batch resolved at once, with a single sector scan.
+Larger batches are written in groups of this size. Each item uses two flash words plus 16 bits of stack.
+*/
+#ifndef KVED_BATCH_SIZE
+#define KVED_BATCH_SIZE 16
+#endif
+
+/**
+@brief Maximum number of keys in a transaction (see @ref kved_txn_begin).
+Each key uses two flash words of the transaction plus 16 bits of stack during the commit.
+*/
+#ifndef KVED_TXN_SIZE
+#define KVED_TXN_SIZE 8
+#endif
+
+/**
+@brief Number of keys with pending writes kept in RAM (write-back), see @ref kved_data_write_deferred.
+Each key uses two flash words of RAM. Use 0 to disable the write-back (deferred values are written immediately).
+*/
+#ifndef KVED_WRITE_BACK_SIZE
+#define KVED_WRITE_BACK_SIZE 0
+#endif
+
+/**
+@brief Number of pending requests of @ref kved_data_write_async, written by @ref kved_poll.
+Each request uses two flash words plus two pointers of RAM. Use 0 to disable the queue (requests are written immediately).
+*/
+#ifndef KVED_ASYNC_SIZE
+#define KVED_ASYNC_SIZE 0
+#endif
+
+/**
+@brief Maximum length of long key names (see @ref kved_long_key_data_write).
+*/
+#ifndef KVED_LONG_KEY_SIZE
+#define KVED_LONG_KEY_SIZE 32
+#endif
+
+/**
+@brief Store the full name of each long key, as a blob, besides its hashed key word.
+Names are used to detect hash collisions on writes and reads and they can be retrieved 
+with @ref kved_long_key_name_get. Each name uses a blob header plus its fragments.
+Use 0 to store only the hashed key words.
+*/
+#ifndef KVED_LONG_KEY_NAMES
+#define KVED_LONG_KEY_NAMES 1
+#endif
+
 #if defined (__ARMCC_VERSION) && (__ARMCC_VERSION >= 6010050)
 #ifndef __weak
 #define __weak  __attribute__((weak))
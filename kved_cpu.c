@@ -11,6 +11,7 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "kved.h"
 #include "kved_cpu.h"
@@ -22,3 +23,52 @@ __weak void kved_cpu_critical_section_enter(void)
 __weak void kved_cpu_critical_section_leave(void)
 {   
 }
+
+__weak void kved_cpu_write_lock_enter(void)
+{
+	kved_cpu_critical_section_enter();
+}
+
+__weak void kved_cpu_write_lock_leave(void)
+{
+	kved_cpu_critical_section_leave();
+}
+
+__weak void kved_cpu_read_lock_enter(void)
+{
+	kved_cpu_write_lock_enter();
+}
+
+__weak void kved_cpu_read_lock_leave(void)
+{
+	kved_cpu_write_lock_leave();
+}
+
+static void kved_cpu_lock_enter(void *arg)
+{
+	kved_cpu_write_lock_enter();
+}
+
+static void kved_cpu_lock_leave(void *arg)
+{
+	kved_cpu_write_lock_leave();
+}
+
+static void kved_cpu_lock_read_enter(void *arg)
+{
+	kved_cpu_read_lock_enter();
+}
+
+static void kved_cpu_lock_read_leave(void *arg)
+{
+	kved_cpu_read_lock_leave();
+}
+
+const kved_lock_ops_t kved_cpu_lock_ops =
+{
+	.arg = NULL,
+	.enter = kved_cpu_lock_enter,
+	.leave = kved_cpu_lock_leave,
+	.read_enter = kved_cpu_lock_read_enter,
+	.read_leave = kved_cpu_lock_read_leave,
+};
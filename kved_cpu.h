@@ -24,6 +24,49 @@ void kved_cpu_critical_section_enter(void);
  */
 void kved_cpu_critical_section_leave(void);
 
+/**
+ @brief Write lock entry point (exclusive access), used by functions changing the database.
+ Defaults to @ref kved_cpu_critical_section_enter. May be mapped to an RTOS mutex or to
+ the write side of a read/write lock.
+ */
+void kved_cpu_write_lock_enter(void);
+
+/**
+ @brief Write lock exit, defaults to @ref kved_cpu_critical_section_leave.
+ */
+void kved_cpu_write_lock_leave(void);
+
+/**
+ @brief Read lock entry point, used by functions only reading the database.
+ Defaults to @ref kved_cpu_write_lock_enter. When mapped to the read side of a 
+ read/write lock, several readers may run concurrently.
+ */
+void kved_cpu_read_lock_enter(void);
+
+/**
+ @brief Read lock exit, defaults to @ref kved_cpu_write_lock_leave.
+ */
+void kved_cpu_read_lock_leave(void);
+
+/**
+@brief Lock operations used by a database instance (see @ref kved_init_ex).
+All operations receive the user argument @p arg. Read operations are optional:
+when not provided, readers use @p enter and @p leave as well.
+*/
+typedef struct kved_lock_ops_s
+{
+	void *arg;                     /**< user argument */
+	void (*enter)(void *arg);      /**< lock the database (exclusive access) */
+	void (*leave)(void *arg);      /**< unlock the database */
+	void (*read_enter)(void *arg); /**< lock the database for reading (shared access, optional) */
+	void (*read_leave)(void *arg); /**< unlock the database after reading (optional) */
+} kved_lock_ops_t;
+
+/**
+@brief Lock operations based on the CPU read and write locks, used by the default instance.
+*/
+extern const kved_lock_ops_t kved_cpu_lock_ops;
+
 /**
 @}
 */
@@ -0,0 +1,111 @@
+/*
+kved (key/value embedded database), a simple key/value database 
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+/**
+@file
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "kved.h"
+#include "kved_flash.h"
+
+__weak void kved_flash_entry_write(kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	// first data, after key
+	kved_flash_data_write(sec,index + 1,value);
+	kved_flash_data_write(sec,index,key);
+}
+
+__weak void kved_flash_data_write_block(kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	for(uint16_t n = 0 ; n < count ; n++)
+		kved_flash_data_write(sec,index + n,buf[n]);
+}
+
+__weak void kved_flash_data_read_block(kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	for(uint16_t n = 0 ; n < count ; n++)
+		buf[n] = kved_flash_data_read(sec,index + n);
+}
+
+__weak const kved_word_t *kved_flash_sector_address(kved_flash_sector_t sec)
+{
+	return NULL;
+}
+
+__weak bool kved_flash_busy(void)
+{
+	return false;
+}
+
+static void kved_flash_port_init(void *arg)
+{
+	kved_flash_init();
+}
+
+static bool kved_flash_port_sector_erase(void *arg, kved_flash_sector_t sec)
+{
+	return kved_flash_sector_erase(sec);
+}
+
+static void kved_flash_port_data_write(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	kved_flash_data_write(sec,index,data);
+}
+
+static void kved_flash_port_entry_write(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	kved_flash_entry_write(sec,index,key,value);
+}
+
+static void kved_flash_port_data_write_block(void *arg, kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	kved_flash_data_write_block(sec,index,buf,count);
+}
+
+static kved_word_t kved_flash_port_data_read(void *arg, kved_flash_sector_t sec, uint16_t index)
+{
+	return kved_flash_data_read(sec,index);
+}
+
+static void kved_flash_port_data_read_block(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	kved_flash_data_read_block(sec,index,buf,count);
+}
+
+static const kved_word_t *kved_flash_port_sector_address(void *arg, kved_flash_sector_t sec)
+{
+	return kved_flash_sector_address(sec);
+}
+
+static bool kved_flash_port_busy(void *arg)
+{
+	return kved_flash_busy();
+}
+
+static uint32_t kved_flash_port_sector_size(void *arg)
+{
+	return kved_flash_sector_size();
+}
+
+const kved_flash_ops_t kved_flash_port_ops =
+{
+	.arg = NULL,
+	.init = kved_flash_port_init,
+	.sector_erase = kved_flash_port_sector_erase,
+	.data_write = kved_flash_port_data_write,
+	.entry_write = kved_flash_port_entry_write,
+	.data_write_block = kved_flash_port_data_write_block,
+	.data_read = kved_flash_port_data_read,
+	.data_read_block = kved_flash_port_data_read_block,
+	.sector_address = kved_flash_port_sector_address,
+	.busy = kved_flash_port_busy,
+	.sector_size = kved_flash_port_sector_size,
+};
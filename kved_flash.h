@@ -15,14 +15,19 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 */
 
 /**
-@brief Flash sectors that can be used for data persistence.
+@brief Flash sectors that can be used for data persistence, numbered from 0 up to 
+@ref KVED_FLASH_NUM_SECTORS - 1 (only the first two sectors are named).
 Positions and mappings will depend on the driver implementation.
+@note KVED_FLASH_NUM_SECTORS is no longer a member of this enumeration: it is a macro of 
+kved_config.h (included by kved.h), set by the port with PORT_KVED_FLASH_NUM_SECTORS (2 by default). 
+Code using it as a number of sectors is unchanged. Code using it as a @ref kved_flash_sector_t value 
+(C++, for instance) needs a cast, and ports defining their own KVED_FLASH_NUM_SECTORS must use 
+PORT_KVED_FLASH_NUM_SECTORS instead.
 */
 typedef enum kved_flash_sector_e
 {
 	KVED_FLASH_SECTOR_A = 0, /**< Setor A */
 	KVED_FLASH_SECTOR_B,     /**< Setor B */
-	KVED_FLASH_NUM_SECTORS,  /**< Number of sectors */
 } kved_flash_sector_t;
 
 /**
@@ -41,6 +46,30 @@ bool kved_flash_sector_erase(kved_flash_sector_t sec);
 */
 void kved_flash_data_write(kved_flash_sector_t sec, uint16_t index, kved_word_t data);
 
+/**
+@brief Write an entry (key and value words) into the flash sector, with a single program sequence 
+(unlock/lock, cache handling, etc). The value word (index + 1) must be programmed before the 
+key word (index), as an entry only becomes valid when its key is written.
+A default implementation, based on @ref kved_flash_data_write, is provided as a weak function.
+  @param[in] sec - sector (see @ref kved_flash_sector_e)
+  @param[in] index - index of the key word
+  @param[in] key - key word
+  @param[in] value - value word
+*/
+void kved_flash_entry_write(kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value);
+
+/**
+@brief Write several consecutive words into the flash sector, used when entries are copied
+into the standby sector. The sector is only validated after the copy, so words can be programmed
+in any order (fast row programming, for instance).
+A default implementation, based on @ref kved_flash_data_write, is provided as a weak function.
+  @param[in] sec - sector (see @ref kved_flash_sector_e)
+  @param[in] index - index of the first word
+  @param[in] buf - words to be written
+  @param[in] count - number of words to write
+*/
+void kved_flash_data_write_block(kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count);
+
 /**
 @brief Reads a word value from the flash sector
   @param[in] sec - sector (see @ref kved_flash_sector_e)
@@ -49,6 +78,35 @@ void kved_flash_data_write(kved_flash_sector_t sec, uint16_t index, kved_word_t
 */
 kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index);
 
+/**
+@brief Reads several consecutive words from the flash sector. 
+A default implementation, based on @ref kved_flash_data_read, is provided as a weak function.
+  @param[in] sec - sector (see @ref kved_flash_sector_e)
+  @param[in] index - index of the first word
+  @param[out] buf - buffer where words will be stored
+  @param[in] count - number of words to read
+*/
+void kved_flash_data_read_block(kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count);
+
+/**
+@brief Returns the sector base address when the sector is memory mapped, allowing 
+direct reads without calling the flash port. 
+A default implementation, returning NULL (sector not mapped), is provided as a weak function.
+  @param[in] sec - sector (see @ref kved_flash_sector_e)
+  @return sector base address or NULL
+*/
+const kved_word_t *kved_flash_sector_address(kved_flash_sector_t sec);
+
+/**
+@brief Returns true while a flash operation (erasing or programming) is in progress. 
+Ports may return from @ref kved_flash_sector_erase and the write functions before the operation ends, 
+reporting it here: kved waits for the flash before each access, while @ref kved_poll returns immediately, 
+so the application can run other tasks in the meantime.
+A default implementation, returning false (operations end before returning), is provided as a weak function.
+  @return true: flash busy
+*/
+bool kved_flash_busy(void);
+
 /**
 @brief Returns the sector size
   @return Sector size, in bytes
@@ -60,6 +118,45 @@ uint32_t kved_flash_sector_size(void);
 */
 void kved_flash_init(void);
 
+/**
+@brief Flash operations used by a database instance (see @ref kved_init_ex).
+The sectors of each instance are mapped by these operations, allowing several
+instances in the same image. All operations receive the user argument @p arg.
+@p entry_write, @p data_write_block, @p data_read_block, @p sector_address and @p busy are optional (NULL).
+With a shared read lock (see @ref kved_lock_ops_t), @p data_read, @p data_read_block and @p busy 
+may be called by concurrent readers.
+*/
+typedef struct kved_flash_ops_s
+{
+	/** user argument */
+	void *arg;
+	/** see @ref kved_flash_init */
+	void (*init)(void *arg);
+	/** see @ref kved_flash_sector_erase */
+	bool (*sector_erase)(void *arg, kved_flash_sector_t sec);
+	/** see @ref kved_flash_data_write */
+	void (*data_write)(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t data);
+	/** see @ref kved_flash_entry_write (optional) */
+	void (*entry_write)(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value);
+	/** see @ref kved_flash_data_write_block (optional) */
+	void (*data_write_block)(void *arg, kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count);
+	/** see @ref kved_flash_data_read */
+	kved_word_t (*data_read)(void *arg, kved_flash_sector_t sec, uint16_t index);
+	/** see @ref kved_flash_data_read_block (optional) */
+	void (*data_read_block)(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count);
+	/** see @ref kved_flash_sector_address (optional) */
+	const kved_word_t *(*sector_address)(void *arg, kved_flash_sector_t sec);
+	/** see @ref kved_flash_busy (optional) */
+	bool (*busy)(void *arg);
+	/** see @ref kved_flash_sector_size */
+	uint32_t (*sector_size)(void *arg);
+} kved_flash_ops_t;
+
+/**
+@brief Flash operations of the flash port (kved_flash_* functions), used by the default instance.
+*/
+extern const kved_flash_ops_t kved_flash_port_ops;
+
 /**
 @}
 */
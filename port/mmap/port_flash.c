@@ -0,0 +1,191 @@
+/*
+kved (key/value embedded database), a simple key/value database 
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "kved.h"
+#include "kved_flash.h"
+
+static int image_fd = -1;
+static kved_word_t *image = NULL;
+static uint32_t sector_size = 0;
+static uint32_t sector_words = 0;
+static kved_flash_mmap_counters_t counters = { 0 };
+
+static kved_word_t *kved_flash_mmap_sector(kved_flash_sector_t sec)
+{
+	return &image[(size_t)sec*sector_words];
+}
+
+// NOR flash: bits can only be cleared, setting them requires an erase
+static void kved_flash_mmap_word_write(kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	kved_word_t *word = &kved_flash_mmap_sector(sec)[index];
+
+	if(data & ~*word)
+		counters.set_bits++;
+
+	*word &= data;
+	counters.writes++;
+}
+
+bool kved_flash_sector_erase(kved_flash_sector_t sec)
+{
+	memset(kved_flash_mmap_sector(sec),0xFF,sector_size);
+	counters.erases++;
+
+	return true;
+}
+
+void kved_flash_data_write(kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	kved_flash_mmap_word_write(sec,index,data);
+	counters.programs++;
+}
+
+void kved_flash_entry_write(kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	kved_flash_mmap_word_write(sec,index + 1,value);
+	kved_flash_mmap_word_write(sec,index,key);
+	counters.programs++;
+}
+
+void kved_flash_data_write_block(kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	for(uint16_t n = 0 ; n < count ; n++)
+		kved_flash_mmap_word_write(sec,index + n,buf[n]);
+
+	counters.programs++;
+}
+
+kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index)
+{
+	counters.reads++;
+
+	return kved_flash_mmap_sector(sec)[index];
+}
+
+void kved_flash_data_read_block(kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	counters.reads += count;
+
+	memcpy(buf,&kved_flash_mmap_sector(sec)[index],count*sizeof(kved_word_t));
+}
+
+#ifdef KVED_MMAP_MAPPED_READ
+const kved_word_t *kved_flash_sector_address(kved_flash_sector_t sec)
+{
+	return kved_flash_mmap_sector(sec);
+}
+#endif
+
+uint32_t kved_flash_sector_size(void)
+{
+	return sector_size;
+}
+
+void kved_flash_init(void)
+{
+	// default image, when the application did not open one
+	if(image)
+		return;
+
+	if(!kved_flash_mmap_open(KVED_MMAP_IMAGE,KVED_MMAP_SECTOR_SIZE))
+	{
+		fprintf(stderr,"kved: can not map flash image %s\n",KVED_MMAP_IMAGE);
+		exit(EXIT_FAILURE);
+	}
+}
+
+bool kved_flash_mmap_open(const char *path, uint32_t size)
+{
+	if((size % KVED_FLASH_WORD_SIZE) || (size < 2*KVED_HDR_SIZE_IN_WORDS*KVED_FLASH_WORD_SIZE))
+		return false;
+
+	// database indexes are 16 bits wide
+	if((uint32_t)KVED_FLASH_NUM_SECTORS*(size/KVED_FLASH_WORD_SIZE) > (UINT16_MAX + 1UL))
+		return false;
+
+	kved_flash_mmap_close();
+
+	size_t image_size = (size_t)KVED_FLASH_NUM_SECTORS*size;
+	int fd = open(path,O_RDWR | O_CREAT,0644);
+	struct stat st;
+
+	if(fd < 0)
+		return false;
+
+	bool blank = (fstat(fd,&st) == 0) && (st.st_size == 0);
+
+	if(blank && (ftruncate(fd,(off_t)image_size) != 0))
+		blank = false;
+
+	// existing images must have the same geometry
+	if((fstat(fd,&st) != 0) || ((size_t)st.st_size != image_size))
+	{
+		close(fd);
+		return false;
+	}
+
+	void *addr = mmap(NULL,image_size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+
+	if(addr == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	image_fd = fd;
+	image = addr;
+	sector_size = size;
+	sector_words = size/KVED_FLASH_WORD_SIZE;
+
+	if(blank)
+	{
+		for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+			kved_flash_sector_erase(sec);
+	}
+
+	return true;
+}
+
+void kved_flash_mmap_close(void)
+{
+	if(!image)
+		return;
+
+	size_t image_size = (size_t)KVED_FLASH_NUM_SECTORS*sector_size;
+
+	msync(image,image_size,MS_SYNC);
+	munmap(image,image_size);
+	close(image_fd);
+
+	image_fd = -1;
+	image = NULL;
+	sector_size = 0;
+	sector_words = 0;
+}
+
+void kved_flash_mmap_counters_get(kved_flash_mmap_counters_t *cnt)
+{
+	*cnt = counters;
+}
+
+void kved_flash_mmap_counters_reset(void)
+{
+	memset(&counters,0,sizeof(counters));
+}
@@ -0,0 +1,95 @@
+/*
+kved (key/value embedded database), a simple key/value database
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+@brief Flash word size.
+Image port supports 4 or 8 bytes, 8 bytes by default.
+*/
+#ifndef PORT_KVED_FLASH_WORD_SIZE
+#define PORT_KVED_FLASH_WORD_SIZE (8)
+#endif
+
+/**
+@brief Programmed words can be programmed again, clearing more bits (see @ref KVED_FLASH_BIT_CLEAR).
+Image port supports it by default.
+*/
+#ifndef PORT_KVED_FLASH_BIT_CLEAR
+#define PORT_KVED_FLASH_BIT_CLEAR (1)
+#endif
+
+/**
+@brief Number of flash sectors (see @ref KVED_FLASH_NUM_SECTORS), 2 by default.
+*/
+#ifndef PORT_KVED_FLASH_NUM_SECTORS
+#define PORT_KVED_FLASH_NUM_SECTORS (2)
+#endif
+
+/**
+@brief Image file used when no image is opened before @ref kved_flash_init 
+(see @ref kved_flash_mmap_open).
+*/
+#ifndef KVED_MMAP_IMAGE
+#define KVED_MMAP_IMAGE "kved_flash.bin"
+#endif
+
+/**
+@brief Sector size, in bytes, used when no image is opened before @ref kved_flash_init.
+*/
+#ifndef KVED_MMAP_SECTOR_SIZE
+#define KVED_MMAP_SECTOR_SIZE (2048)
+#endif
+
+/**
+@brief Define KVED_MMAP_MAPPED_READ to expose the sectors as memory mapped 
+(see @ref kved_flash_sector_address). Direct reads are not counted.
+*/
+//#define KVED_MMAP_MAPPED_READ
+
+/**
+@brief Flash access counters, useful for profiling.
+*/
+typedef struct kved_flash_mmap_counters_s
+{
+	uint32_t reads;    /**< word reads */
+	uint32_t writes;   /**< word writes */
+	uint32_t programs; /**< program operations (a word, an entry or a block of words) */
+	uint32_t erases;   /**< sector erasures */
+	uint32_t set_bits; /**< word writes trying to set cleared bits (ignored, as in NOR flash) */
+} kved_flash_mmap_counters_t;
+
+/**
+@brief Map a flash image file, with all sectors in sequence. A missing or empty file 
+is created with all sectors erased, otherwise its contents are kept, so the database 
+survives process restarts. Any image already opened is closed before.
+Sectors times words per sector can not exceed 65536 (see @ref KVED_FLASH_NUM_SECTORS).
+  @param[in] path - image file
+  @param[in] sector_size - sector size, in bytes (a multiple of the word size)
+  @return true: image mapped
+  @return false: invalid sector size, file size not matching the sectors or file error
+*/
+bool kved_flash_mmap_open(const char *path, uint32_t sector_size);
+
+/**
+@brief Write the image back to its file and unmap it.
+*/
+void kved_flash_mmap_close(void);
+
+/**
+@brief Get flash access counters since last reset
+  @param[out] cnt - current counters
+*/
+void kved_flash_mmap_counters_get(kved_flash_mmap_counters_t *cnt);
+
+/**
+@brief Reset flash access counters
+*/
+void kved_flash_mmap_counters_reset(void);
@@ -0,0 +1,33 @@
+/*
+kved (key/value embedded database), a simple key/value database 
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+#include <stdint.h>
+#include <pthread.h>
+#include "kved_cpu.h"
+
+// host threads: writers have exclusive access, readers run concurrently
+static pthread_rwlock_t kved_cpu_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+void kved_cpu_write_lock_enter(void)
+{
+	pthread_rwlock_wrlock(&kved_cpu_rwlock);
+}
+
+void kved_cpu_write_lock_leave(void)
+{
+	pthread_rwlock_unlock(&kved_cpu_rwlock);
+}
+
+void kved_cpu_read_lock_enter(void)
+{
+	pthread_rwlock_rdlock(&kved_cpu_rwlock);
+}
+
+void kved_cpu_read_lock_leave(void)
+{
+	pthread_rwlock_unlock(&kved_cpu_rwlock);
+}
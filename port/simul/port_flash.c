@@ -14,37 +14,246 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 
 #define FLASH_NUM_ENTRIES (16)
 #define FLASH_SECTOR_SIZE (FLASH_NUM_ENTRIES*KVED_FLASH_WORD_SIZE)
+#define FLASH_MAX_SECTOR_SIZE (KVED_SIMUL_MAX_NUM_ENTRIES*KVED_FLASH_WORD_SIZE)
 
-kved_word_t data_bank0[FLASH_NUM_ENTRIES];
-kved_word_t data_bank1[FLASH_NUM_ENTRIES];
-kved_word_t *sector_address[KVED_FLASH_NUM_SECTORS] = { data_bank0, data_bank1 };
+kved_word_t sector_address[KVED_FLASH_NUM_SECTORS][KVED_SIMUL_MAX_NUM_ENTRIES];
 
+static uint32_t sector_size = FLASH_SECTOR_SIZE;
+static bool powered_on = false;
+static kved_flash_simul_counters_t counters = { 0 };
+static uint32_t write_busy_polls = 0;
+static uint32_t erase_busy_polls = 0;
+static uint32_t busy_polls = 0;
+
+static const kved_flash_simul_timing_t *timing = NULL;
+static uint64_t clock_us = 0;
+static uint64_t busy_until_us = 0;
+
+static uint32_t sector_erases[KVED_FLASH_NUM_SECTORS];
+static uint32_t word_programs[KVED_FLASH_NUM_SECTORS][KVED_SIMUL_MAX_NUM_ENTRIES];
+static uint16_t word_reprograms[KVED_FLASH_NUM_SECTORS][KVED_SIMUL_MAX_NUM_ENTRIES];
+static uint32_t max_word_reprograms = 0;
+
+const kved_flash_simul_timing_t kved_flash_simul_timing_stm32l4 =
+{
+	.word_program_us = 82,
+	.erase_us = 22020,
+	.poll_us = 1,
+	.background = false,
+};
+
+const kved_flash_simul_timing_t kved_flash_simul_timing_stm32f4 =
+{
+	.word_program_us = 16,
+	.erase_us = 250000,
+	.poll_us = 1,
+	.background = false,
+};
+
+static void kved_flash_simul_operation(uint64_t duration_us)
+{
+	if(!timing)
+		return;
+
+	if(timing->background)
+		busy_until_us = clock_us + duration_us;
+	else
+		clock_us += duration_us;
+}
+
+static void kved_flash_simul_word_write(kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+#if PORT_KVED_FLASH_BIT_CLEAR == 0
+	// flash with ECC: a programmed word only accepts zero, other programs fail
+	if((sector_address[sec][index] != KVED_FLASH_UINT_MAX) && (data != 0))
+		return;
+#endif
+
+	sector_address[sec][index] = data;
+	word_programs[sec][index]++;
+
+	// programs since the last erase
+	if(++word_reprograms[sec][index] > max_word_reprograms)
+		max_word_reprograms = word_reprograms[sec][index];
+}
+
+static void kved_flash_simul_program(uint16_t count)
+{
+	counters.writes += count;
+	counters.programs++;
+	busy_polls = write_busy_polls;
+	kved_flash_simul_operation(timing ? (uint64_t)count*timing->word_program_us : 0);
+}
 
 bool kved_flash_sector_erase(kved_flash_sector_t sec)
 {
-	memset(sector_address[sec],0xFF,FLASH_SECTOR_SIZE);
+	memset(sector_address[sec],0xFF,FLASH_MAX_SECTOR_SIZE);
+	memset(word_reprograms[sec],0,sizeof(word_reprograms[sec]));
+	sector_erases[sec]++;
+	counters.erases++;
+	busy_polls = erase_busy_polls;
+	kved_flash_simul_operation(timing ? timing->erase_us : 0);
 
 	return true;
 }
 
 void kved_flash_data_write(kved_flash_sector_t sec, uint16_t index, kved_word_t data)
 {
-	sector_address[sec][index] = data;
+	kved_flash_simul_word_write(sec,index,data);
+	kved_flash_simul_program(1);
 }
 
+void kved_flash_entry_write(kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	kved_flash_simul_word_write(sec,index + 1,value);
+	kved_flash_simul_word_write(sec,index,key);
+	kved_flash_simul_program(2);
+}
+
+void kved_flash_data_write_block(kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	for(uint16_t n = 0 ; n < count ; n++)
+		kved_flash_simul_word_write(sec,index + n,buf[n]);
+
+	kved_flash_simul_program(count);
+}
+
+// readers may run concurrently (see kved_cpu_read_lock_enter)
 kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index)
 {
+	__atomic_fetch_add(&counters.reads,1,__ATOMIC_RELAXED);
+
 	return sector_address[sec][index];
 }
 
+void kved_flash_data_read_block(kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	__atomic_fetch_add(&counters.reads,count,__ATOMIC_RELAXED);
+
+	memcpy(buf,&sector_address[sec][index],count*sizeof(kved_word_t));
+}
+
+#ifdef KVED_SIMUL_MAPPED_READ
+const kved_word_t *kved_flash_sector_address(kved_flash_sector_t sec)
+{
+	return sector_address[sec];
+}
+#endif
+
+bool kved_flash_busy(void)
+{
+	// time passes while polling
+	if(timing && (clock_us < busy_until_us))
+	{
+		clock_us += timing->poll_us ? timing->poll_us : 1;
+		counters.busy++;
+
+		return true;
+	}
+
+	if(busy_polls == 0)
+		return false;
+
+	busy_polls--;
+	counters.busy++;
+
+	return true;
+}
+
 uint32_t kved_flash_sector_size(void)
 {
 	// sector sizes must be equal
-	return FLASH_SECTOR_SIZE;
+	return sector_size;
 }
 
 void kved_flash_init(void)
 {
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_A);
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_B);
+	// flash contents survive restarts, only a blank device starts erased
+	if(!powered_on)
+	{
+		for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+			kved_flash_sector_erase(sec);
+
+		powered_on = true;
+	}
+}
+
+bool kved_flash_simul_sector_size_set(uint32_t size)
+{
+	if((size > FLASH_MAX_SECTOR_SIZE) || (size < 2*KVED_HDR_SIZE_IN_WORDS*KVED_FLASH_WORD_SIZE))
+		return false;
+
+	sector_size = size;
+
+	for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+		kved_flash_sector_erase(sec);
+
+	powered_on = true;
+
+	return true;
+}
+
+void kved_flash_simul_busy_set(uint32_t write_polls, uint32_t erase_polls)
+{
+	write_busy_polls = write_polls;
+	erase_busy_polls = erase_polls;
+	busy_polls = 0;
+}
+
+void kved_flash_simul_timing_set(const kved_flash_simul_timing_t *t)
+{
+	timing = t;
+	clock_us = 0;
+	busy_until_us = 0;
+}
+
+uint64_t kved_flash_simul_clock_get(void)
+{
+	return clock_us;
+}
+
+void kved_flash_simul_clock_advance(uint32_t us)
+{
+	if(timing)
+		clock_us += us;
+}
+
+void kved_flash_simul_wear_get(kved_flash_simul_wear_t *wear)
+{
+	memset(wear,0,sizeof(kved_flash_simul_wear_t));
+	wear->max_word_reprograms = max_word_reprograms;
+
+	for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+	{
+		wear->sector_erases[sec] = sector_erases[sec];
+
+		for(uint16_t index = 0 ; index < KVED_SIMUL_MAX_NUM_ENTRIES ; index++)
+		{
+			if(word_programs[sec][index] > wear->max_word_programs)
+				wear->max_word_programs = word_programs[sec][index];
+		}
+	}
+}
+
+uint32_t kved_flash_simul_word_programs_get(uint8_t sec, uint16_t index)
+{
+	return word_programs[sec][index];
+}
+
+void kved_flash_simul_wear_reset(void)
+{
+	memset(sector_erases,0,sizeof(sector_erases));
+	memset(word_programs,0,sizeof(word_programs));
+	memset(word_reprograms,0,sizeof(word_reprograms));
+	max_word_reprograms = 0;
+}
+
+void kved_flash_simul_counters_get(kved_flash_simul_counters_t *cnt)
+{
+	*cnt = counters;
+}
+
+void kved_flash_simul_counters_reset(void)
+{
+	memset(&counters,0,sizeof(counters));
 }
@@ -0,0 +1,163 @@
+/*
+kved (key/value embedded database), a simple key/value database
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+@brief Flash word size.
+Simulation port supports 4 or 8 bytes, 8 bytes by default.
+*/
+#ifndef PORT_KVED_FLASH_WORD_SIZE
+#define PORT_KVED_FLASH_WORD_SIZE (8)
+#endif
+
+/**
+@brief Programmed words can be programmed again, clearing more bits (see @ref KVED_FLASH_BIT_CLEAR).
+Simulation port supports it by default. Use 0 to emulate flash with ECC: programs of non zero values over programmed words are rejected.
+*/
+#ifndef PORT_KVED_FLASH_BIT_CLEAR
+#define PORT_KVED_FLASH_BIT_CLEAR (1)
+#endif
+
+/**
+@brief Number of flash sectors (see @ref KVED_FLASH_NUM_SECTORS).
+Simulation port supports up to 16 sectors, 2 by default.
+*/
+#ifndef PORT_KVED_FLASH_NUM_SECTORS
+#define PORT_KVED_FLASH_NUM_SECTORS (2)
+#endif
+
+/**
+@brief Maximum number of words per sector. The sector size can be changed at 
+runtime, up to this limit, using @ref kved_flash_simul_sector_size_set.
+*/
+#ifndef KVED_SIMUL_MAX_NUM_ENTRIES
+#define KVED_SIMUL_MAX_NUM_ENTRIES (8192)
+#endif
+
+/**
+@brief Define KVED_SIMUL_MAPPED_READ to expose the sectors as memory mapped 
+(see @ref kved_flash_sector_address). Direct reads are not counted.
+*/
+//#define KVED_SIMUL_MAPPED_READ
+
+/**
+@brief Flash access counters, useful for profiling.
+*/
+typedef struct kved_flash_simul_counters_s
+{
+	uint32_t reads;    /**< word reads */
+	uint32_t writes;   /**< word writes */
+	uint32_t programs; /**< program operations (a word, an entry or a block of words) */
+	uint32_t erases;   /**< sector erasures */
+	uint32_t busy;     /**< busy flash reported by @ref kved_flash_busy */
+} kved_flash_simul_counters_t;
+
+/**
+@brief Change the simulated sector size. All sectors are erased.
+  @param[in] size - new sector size, in bytes
+  @return true: size changed
+  @return false: size not supported
+*/
+bool kved_flash_simul_sector_size_set(uint32_t size);
+
+/**
+@brief Simulated flash busy time, in number of @ref kved_flash_busy calls: after each operation, 
+the flash is reported as busy for the given number of calls. Operations are done immediately, 
+only the status is simulated. Both times are zero by default (never busy).
+  @param[in] write_polls - busy time after programming (a word, an entry or a block of words)
+  @param[in] erase_polls - busy time after erasing a sector
+*/
+void kved_flash_simul_busy_set(uint32_t write_polls, uint32_t erase_polls);
+
+/**
+@brief Flash timing model, see @ref kved_flash_simul_timing_set.
+*/
+typedef struct kved_flash_simul_timing_s
+{
+	uint32_t word_program_us; /**< time to program one word */
+	uint32_t erase_us;        /**< time to erase one sector */
+	uint32_t poll_us;         /**< time of each @ref kved_flash_busy call while the flash is busy */
+	bool background;          /**< operations return at once and the flash stays busy until their end */
+} kved_flash_simul_timing_t;
+
+/**
+@brief STM32L4 typical timing (datasheet): 82 us per double word (64 bits), 22 ms per page (2 KB).
+*/
+extern const kved_flash_simul_timing_t kved_flash_simul_timing_stm32l4;
+
+/**
+@brief STM32F4 typical timing (datasheet, x32 parallelism): 16 us per word (32 bits), 250 ms per 16 KB sector.
+*/
+extern const kved_flash_simul_timing_t kved_flash_simul_timing_stm32f4;
+
+/**
+@brief Enable the timing model and its virtual clock (see @ref kved_flash_simul_clock_get).
+Each operation advances the clock by its modelled time, so the latency of any kved call 
+is the clock difference before and after the call. With background operations, the 
+clock is advanced by the busy polls instead (see @ref kved_flash_busy) and by the application, 
+using @ref kved_flash_simul_clock_advance. The timing model is disabled by default.
+  @param[in] timing - timing model, NULL to disable it (the clock stops)
+*/
+void kved_flash_simul_timing_set(const kved_flash_simul_timing_t *timing);
+
+/**
+@brief Current time of the virtual clock
+  @return time, in microseconds, since the timing model was enabled
+*/
+uint64_t kved_flash_simul_clock_get(void);
+
+/**
+@brief Advance the virtual clock, modelling the time spent by the application 
+between calls (for instance, other tasks running while @ref kved_poll returns early).
+  @param[in] us - time, in microseconds
+*/
+void kved_flash_simul_clock_advance(uint32_t us);
+
+/**
+@brief Flash wear summary, see @ref kved_flash_simul_wear_get.
+*/
+typedef struct kved_flash_simul_wear_s
+{
+	uint32_t sector_erases[PORT_KVED_FLASH_NUM_SECTORS]; /**< erasures of each sector */
+	uint32_t max_word_programs;                          /**< highest number of programs of a single word */
+	uint32_t max_word_reprograms;                        /**< highest number of programs of a single word between two erasures */
+} kved_flash_simul_wear_t;
+
+/**
+@brief Get the flash wear since last reset. Flash with ECC (like STM32L4) can not program
+the same word twice before erasing it, see @p max_word_reprograms.
+  @param[out] wear - current wear
+*/
+void kved_flash_simul_wear_get(kved_flash_simul_wear_t *wear);
+
+/**
+@brief Number of programs of a word since last wear reset
+  @param[in] sec - sector
+  @param[in] index - word index
+  @return number of programs
+*/
+uint32_t kved_flash_simul_word_programs_get(uint8_t sec, uint16_t index);
+
+/**
+@brief Reset the flash wear counters
+*/
+void kved_flash_simul_wear_reset(void);
+
+/**
+@brief Get flash access counters since last reset
+  @param[out] cnt - current counters
+*/
+void kved_flash_simul_counters_get(kved_flash_simul_counters_t *cnt);
+
+/**
+@brief Reset flash access counters
+*/
+void kved_flash_simul_counters_reset(void);
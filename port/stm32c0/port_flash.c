@@ -16,10 +16,19 @@ Tested on STM32C071RB mcu
 #include "kved_flash.h"
 #include "main.h"
 
+#if KVED_FLASH_NUM_SECTORS != 2
+#error "only two sectors are mapped by this port"
+#endif
+
 // Address of page zero of our flash
 #define FLASH_PAGE_ZERO_ADDRESS  0x08000000   
 #define FLASH_PAGE_SECTOR_SIZE 2048
 
+// database indexes are 16 bits wide
+#if (KVED_FLASH_NUM_SECTORS*(FLASH_PAGE_SECTOR_SIZE/PORT_KVED_FLASH_WORD_SIZE)) > 65536
+#error "sectors times words per sector can not exceed 65536"
+#endif
+
 // Page 31 and 32 are used for sectors A and B respectively, these values can be changed to suit your application
 const uint8_t pages[KVED_FLASH_NUM_SECTORS] = { 31, 32 };
 
@@ -62,6 +71,17 @@ kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index)
 	return *((kved_word_t *)addr);
 }
 
+void kved_flash_data_read_block(kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	uint32_t addr = getHexAddressPage(pages[sec]) + index*sizeof(kved_word_t);
+	memcpy(buf,(void *)addr,count*sizeof(kved_word_t));
+}
+
+const kved_word_t *kved_flash_sector_address(kved_flash_sector_t sec)
+{
+	return (const kved_word_t *)getHexAddressPage(pages[sec]);
+}
+
 uint32_t kved_flash_sector_size(void)
 {
 	return FLASH_PAGE_SECTOR_SIZE;
@@ -11,3 +11,8 @@ Copyright (c) 2022 Fabricio Lucas de Almeida <fabriciolucasfbr@gmail.com>
 @brief Flash word size.
 */
 #define PORT_KVED_FLASH_WORD_SIZE (8)
+
+/**
+@brief Programmed words only accept zero (64 bits words are stored with ECC), see @ref KVED_FLASH_BIT_CLEAR.
+*/
+#define PORT_KVED_FLASH_BIT_CLEAR (0)
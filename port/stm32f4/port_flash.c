@@ -13,11 +13,20 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 #include "kved_flash.h"
 #include "main.h"
 
+#if KVED_FLASH_NUM_SECTORS != 2
+#error "only two sectors are mapped by this port"
+#endif
+
 #define FLASH_KEY1 0x45670123U /*!< Flash key1 */
 #define FLASH_KEY2 0xCDEF89ABU /*!< Flash key2 */
 
 #define FLASH_SECTOR_SIZE 16368
 
+// database indexes are 16 bits wide
+#if (KVED_FLASH_NUM_SECTORS*(FLASH_SECTOR_SIZE/PORT_KVED_FLASH_WORD_SIZE)) > 65536
+#error "sectors times words per sector can not exceed 65536"
+#endif
+
 const uint32_t sector_size[KVED_FLASH_NUM_SECTORS] = { FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE };
 const uint32_t sector_address[KVED_FLASH_NUM_SECTORS] = { 0x08004000, 0x08008000 };
 const uint8_t sector_page[KVED_FLASH_NUM_SECTORS] = { 1, 2 };
@@ -58,6 +67,18 @@ kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index)
 	return *((kved_word_t *)addr);
 }
 
+void kved_flash_data_read_block(kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	uint32_t addr = sector_address[sec] + index*sizeof(kved_word_t);
+
+	memcpy(buf,(void *)addr,count*sizeof(kved_word_t));
+}
+
+const kved_word_t *kved_flash_sector_address(kved_flash_sector_t sec)
+{
+	return (const kved_word_t *)sector_address[sec];
+}
+
 uint32_t kved_flash_sector_size(void)
 {
 	return FLASH_SECTOR_SIZE;
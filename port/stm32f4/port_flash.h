@@ -12,3 +12,8 @@ Copyright (c) 2022 Fabricio Lucas de Almeida <fabriciolucasfbr@gmail.com>
 Max supported is 16 bytes, but used 4 bytes only.
 */
 #define PORT_KVED_FLASH_WORD_SIZE (4)
+
+/**
+@brief Programmed words can be programmed again, clearing more bits, see @ref KVED_FLASH_BIT_CLEAR.
+*/
+#define PORT_KVED_FLASH_BIT_CLEAR (1)
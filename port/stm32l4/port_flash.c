@@ -13,11 +13,20 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 #include "kved_flash.h"
 #include "main.h"
 
+#if KVED_FLASH_NUM_SECTORS != 2
+#error "only two sectors are mapped by this port"
+#endif
+
 #define FLASH_KEY1 0x45670123U /*!< Flash key1 */
 #define FLASH_KEY2 0xCDEF89ABU /*!< Flash key2 */
 
 #define FLASH_SECTOR_SIZE 2048
 
+// database indexes are 16 bits wide
+#if (KVED_FLASH_NUM_SECTORS*(FLASH_SECTOR_SIZE/PORT_KVED_FLASH_WORD_SIZE)) > 65536
+#error "sectors times words per sector can not exceed 65536"
+#endif
+
 const uint32_t sector_size[KVED_FLASH_NUM_SECTORS] = { FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE };
 const uint32_t sector_address[KVED_FLASH_NUM_SECTORS] = { 0x0803F000, 0x0803F800 };
 const uint8_t sector_page[KVED_FLASH_NUM_SECTORS] = { 126, 127 };
@@ -127,10 +136,8 @@ bool kved_flash_sector_erase(kved_flash_sector_t sec)
 	return true;
 }
 
-void kved_flash_data_write(kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+static void kved_flash_program_start(void)
 {
-	uint32_t addr = sector_address[sec] + index*sizeof(kved_word_t);
-
 	kved_flash_unlock();
 	kved_flash_cache_disable();
 
@@ -142,6 +149,11 @@ void kved_flash_data_write(kved_flash_sector_t sec, uint16_t index, kved_word_t
 
 	//  Set the PG bit in the Flash control register (FLASH_CR)
 	SET_BIT(FLASH->CR, FLASH_CR_PG);
+}
+
+static void kved_flash_program_word(kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	uint32_t addr = sector_address[sec] + index*sizeof(kved_word_t);
 
 	// Write a first word in an address aligned with double word
 	// Write the second word
@@ -154,17 +166,48 @@ void kved_flash_data_write(kved_flash_sector_t sec, uint16_t index, kved_word_t
 	/* Program second word */
 	*(__IO uint32_t*)(addr+4U) = (uint32_t)(data >> 32);
 
-	 // Wait until the BSY bit is cleared in the FLASH_SR register
-	 kved_flash_operation_wait();
+	// Wait until the BSY bit is cleared in the FLASH_SR register
+	kved_flash_operation_wait();
+
+	// Check that EOP flag is set in the FLASH_SR register (meaning that the programming operation has succeed), and clear it by software.
+	// (somente se tem interrupcao)
+}
+
+static void kved_flash_program_stop(void)
+{
+	// Clear the PG bit in the FLASH_CR register if there no more programming request anymore.
+	CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+
+	kved_flash_cache_restore();
+	kved_flash_lock();
+}
+
+void kved_flash_data_write(kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	kved_flash_program_start();
+	kved_flash_program_word(sec,index,data);
+	kved_flash_program_stop();
+}
 
-	 // Check that EOP flag is set in the FLASH_SR register (meaning that the programming operation has succeed), and clear it by software.
-	 // (somente se tem interrupcao)
+void kved_flash_entry_write(kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	// PG bit is kept set for both double words, first data, after key
+	kved_flash_program_start();
+	kved_flash_program_word(sec,index + 1,value);
+	kved_flash_program_word(sec,index,key);
+	kved_flash_program_stop();
+}
+
+/* Fast programming (FSTPG) requires a mass erase of the bank, so rows are 
+   programmed with standard double word programming in a single sequence. */
+void kved_flash_data_write_block(kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	kved_flash_program_start();
 
-	 // Clear the PG bit in the FLASH_CR register if there no more programming request anymore.
-	 CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+	for(uint16_t n = 0 ; n < count ; n++)
+		kved_flash_program_word(sec,index + n,buf[n]);
 
-	 kved_flash_cache_restore();
-	 kved_flash_lock();
+	kved_flash_program_stop();
 }
 
 kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index)
@@ -174,6 +217,18 @@ kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index)
 	return *((kved_word_t *)addr);
 }
 
+void kved_flash_data_read_block(kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	uint32_t addr = sector_address[sec] + index*sizeof(kved_word_t);
+
+	memcpy(buf,(void *)addr,count*sizeof(kved_word_t));
+}
+
+const kved_word_t *kved_flash_sector_address(kved_flash_sector_t sec)
+{
+	return (const kved_word_t *)sector_address[sec];
+}
+
 uint32_t kved_flash_sector_size(void)
 {
 	return FLASH_SECTOR_SIZE;
@@ -14,11 +14,20 @@ Copyright (c) 2022 Fabricio Lucas de Almeida <fabriciolucasfbr@gmail.com>
 #include "kved_cpu.h"
 #include "main.h"
 
+#if KVED_FLASH_NUM_SECTORS != 2
+#error "only two sectors are mapped by this port"
+#endif
+
 #define FLASH_KEY1 0x45670123U  /*!< Flash key1 */
 #define FLASH_KEY2 0xCDEF89ABU  /*!< Flash key2 */
 
 #define FLASH_SECTOR_SIZE 4096
 
+// database indexes are 16 bits wide
+#if (KVED_FLASH_NUM_SECTORS*(FLASH_SECTOR_SIZE/PORT_KVED_FLASH_WORD_SIZE)) > 65536
+#error "sectors times words per sector can not exceed 65536"
+#endif
+
 const uint32_t sector_size[KVED_FLASH_NUM_SECTORS] = { FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE };
 const uint32_t sector_address[KVED_FLASH_NUM_SECTORS] = { 0x0807E000, 0x0807F000 };
 const uint8_t sector_page[KVED_FLASH_NUM_SECTORS] = { 126, 127 };
@@ -113,16 +122,19 @@ bool kved_flash_sector_erase(kved_flash_sector_t sec_idx)
 	return true;
 }
 
-/* See AN5289 Rev 7 - pag 36 for more informations */
-void kved_flash_data_write(kved_flash_sector_t sec_idx, uint16_t index, kved_word_t data)
+static void kved_flash_program_start(void)
 {
-	uint32_t addr = sector_address[sec_idx] + index*sizeof(kved_word_t);
-
 #ifdef HAL_HSEM_MODULE_ENABLED
 	while(HAL_HSEM_Take(2, 0) != HAL_OK){}
 #endif
 	kved_flash_unlock();
 	kved_flash_cache_disable();
+}
+
+/* See AN5289 Rev 7 - pag 36 for more informations */
+static void kved_flash_program_word(kved_flash_sector_t sec_idx, uint16_t index, kved_word_t data)
+{
+	uint32_t addr = sector_address[sec_idx] + index*sizeof(kved_word_t);
 
 	while(READ_BIT(FLASH->SR, FLASH_SR_PESD)){}
 
@@ -144,6 +156,10 @@ void kved_flash_data_write(kved_flash_sector_t sec_idx, uint16_t index, kved_wor
 #endif
 	kved_cpu_critical_section_leave();
 	kved_flash_operation_wait();
+}
+
+static void kved_flash_program_stop(void)
+{
 	kved_flash_cache_restore();
 	kved_flash_lock();
 
@@ -152,6 +168,36 @@ void kved_flash_data_write(kved_flash_sector_t sec_idx, uint16_t index, kved_wor
 #endif
 }
 
+void kved_flash_data_write(kved_flash_sector_t sec_idx, uint16_t index, kved_word_t data)
+{
+	kved_flash_program_start();
+	kved_flash_program_word(sec_idx,index,data);
+	kved_flash_program_stop();
+}
+
+/* CPU2 timing constraints are kept per double word (semaphore 7), the flash 
+   semaphore, unlock and cache handling are done once for the whole entry. */
+void kved_flash_entry_write(kved_flash_sector_t sec_idx, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	// first data, after key
+	kved_flash_program_start();
+	kved_flash_program_word(sec_idx,index + 1,value);
+	kved_flash_program_word(sec_idx,index,key);
+	kved_flash_program_stop();
+}
+
+/* Blocks use standard double word programming, keeping the short flash accesses 
+   required by CPU2 (AN5289), with a single flash semaphore and unlock sequence. */
+void kved_flash_data_write_block(kved_flash_sector_t sec_idx, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	kved_flash_program_start();
+
+	for(uint16_t n = 0 ; n < count ; n++)
+		kved_flash_program_word(sec_idx,index + n,buf[n]);
+
+	kved_flash_program_stop();
+}
+
 kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index)
 {
 	uint32_t addr = sector_address[sec] + index*sizeof(kved_word_t);
@@ -159,6 +205,18 @@ kved_word_t kved_flash_data_read(kved_flash_sector_t sec, uint16_t index)
 	return *((kved_word_t *)addr);
 }
 
+void kved_flash_data_read_block(kved_flash_sector_t sec, uint16_t index, kved_word_t *buf, uint16_t count)
+{
+	uint32_t addr = sector_address[sec] + index*sizeof(kved_word_t);
+
+	memcpy(buf,(void *)addr,count*sizeof(kved_word_t));
+}
+
+const kved_word_t *kved_flash_sector_address(kved_flash_sector_t sec)
+{
+	return (const kved_word_t *)sector_address[sec];
+}
+
 uint32_t kved_flash_sector_size(void)
 {
 	return FLASH_SECTOR_SIZE;
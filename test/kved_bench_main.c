@@ -0,0 +1,233 @@
+/*
+kved (key/value embedded database), a simple key/value database
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "kved.h"
+#include "kved_flash.h"
+
+#define BENCH_INIT_ROUNDS 10
+#define BENCH_ITERATION_ROUNDS 10
+#define BENCH_MAX_SWITCH_WRITES 100000
+// 4/3 of the largest database, so duplicated keys are always solved in a single pass
+#define BENCH_SCRATCH_SIZE (4*(KVED_FLASH_NUM_SECTORS - 1)*(KVED_SIMUL_MAX_NUM_ENTRIES/2)/3 + 1)
+
+typedef struct bench_sample_s
+{
+	uint64_t wall_us;
+	uint64_t model_us;
+	kved_flash_simul_counters_t cnt;
+} bench_sample_t;
+
+static const uint8_t bench_fill_levels[] = { 25, 50, 90 };
+static uint16_t bench_scratch[BENCH_SCRATCH_SIZE];
+
+static uint64_t bench_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+
+	return (uint64_t)ts.tv_sec*1000000ULL + ts.tv_nsec/1000;
+}
+
+static void bench_key_make(kved_data_t *data, uint16_t n)
+{
+	memset(data,0,sizeof(kved_data_t));
+	data->key[0] = '!' + (n / 94);
+	data->key[1] = '!' + (n % 94);
+	data->type = KVED_DATA_TYPE_UINT32;
+}
+
+static void bench_start(bench_sample_t *sample)
+{
+	kved_flash_simul_counters_reset();
+	sample->model_us = kved_flash_simul_clock_get();
+	sample->wall_us = bench_time_us();
+}
+
+// one CSV line, all costs per operation
+static void bench_report(const char *op, uint32_t sector_size, uint8_t fill, uint32_t ops, bench_sample_t *sample)
+{
+	uint64_t wall_us = bench_time_us() - sample->wall_us;
+	uint64_t model_us = kved_flash_simul_clock_get() - sample->model_us;
+
+	kved_flash_simul_counters_get(&sample->cnt);
+
+	if(ops == 0)
+		return;
+
+	printf("%s,%lu,%u,%u,%u,%lu,%.3f,%.1f,%.2f,%.4f,%.1f\n",
+		op,
+		(unsigned long)sector_size,
+		fill,
+		kved_total_entries_get(),
+		kved_used_entries_get(),
+		(unsigned long)ops,
+		(double)wall_us/ops,
+		(double)sample->cnt.reads/ops,
+		(double)sample->cnt.writes/ops,
+		(double)sample->cnt.erases/ops,
+		(double)model_us/ops);
+}
+
+static void bench_write(uint16_t first, uint16_t count, uint32_t value)
+{
+	kved_data_t d;
+
+	for(uint16_t n = first ; n < first + count ; n++)
+	{
+		bench_key_make(&d,n);
+		d.value.u32 = value + n;
+		kved_data_write(&d);
+	}
+}
+
+static void bench_read(uint16_t first, uint16_t count)
+{
+	kved_data_t d;
+
+	for(uint16_t n = first ; n < first + count ; n++)
+	{
+		bench_key_make(&d,n);
+		kved_data_read(&d);
+	}
+}
+
+static void bench_run(uint32_t sector_size, uint8_t fill)
+{
+	bench_sample_t sample;
+	kved_data_t d;
+
+	if(!kved_flash_simul_sector_size_set(sector_size))
+		return;
+
+	kved_init();
+
+	uint16_t num_entries = kved_total_entries_get();
+	// live keys, absent keys start after the last possible one
+	uint16_t num_keys = (uint16_t)((uint32_t)num_entries*fill/100);
+	uint16_t absent = num_entries;
+
+	bench_write(0,num_keys,0);
+
+	// boot with live entries only
+	bench_start(&sample);
+
+	for(uint8_t r = 0 ; r < BENCH_INIT_ROUNDS ; r++)
+		kved_init();
+
+	bench_report("init_cold",sector_size,fill,BENCH_INIT_ROUNDS,&sample);
+
+	// same boot, with a scratch buffer instead of the index (or the search of newer entries)
+	bench_start(&sample);
+
+	for(uint8_t r = 0 ; r < BENCH_INIT_ROUNDS ; r++)
+		kved_init_scratch(bench_scratch,BENCH_SCRATCH_SIZE);
+
+	bench_report("init_cold_scratch",sector_size,fill,BENCH_INIT_ROUNDS,&sample);
+
+	bench_start(&sample);
+	bench_read(0,num_keys);
+	bench_report("read_hit",sector_size,fill,num_keys,&sample);
+
+	bench_start(&sample);
+	bench_read(absent,num_keys);
+	bench_report("read_miss",sector_size,fill,num_keys,&sample);
+
+	bench_start(&sample);
+	bench_write(0,num_keys,0);
+	bench_report("write_unchanged",sector_size,fill,num_keys,&sample);
+
+	// changes and new keys use half of the free entries each, without sector switches
+	uint16_t num_changes = (num_entries - num_keys)/2;
+	uint16_t num_new = (num_entries - num_keys - num_changes)/2;
+
+	if(num_changes > num_keys)
+		num_changes = num_keys;
+
+	bench_start(&sample);
+	bench_write(0,num_changes,1);
+	bench_report("write_changed",sector_size,fill,num_changes,&sample);
+
+	bench_start(&sample);
+	bench_write(absent,num_new,0);
+	bench_report("write_new",sector_size,fill,num_new,&sample);
+
+	bench_start(&sample);
+
+	for(uint16_t n = absent ; n < absent + num_new ; n++)
+	{
+		bench_key_make(&d,n);
+		kved_data_delete(&d);
+	}
+
+	bench_report("delete",sector_size,fill,num_new,&sample);
+
+	bench_start(&sample);
+
+	for(uint8_t r = 0 ; r < BENCH_ITERATION_ROUNDS ; r++)
+	{
+		for(uint16_t i = kved_first_used_index_get() ; i != KVED_INDEX_NOT_FOUND ; i = kved_next_used_index_get(i))
+			kved_data_read_by_index(i,&d);
+	}
+
+	bench_report("iteration",sector_size,fill,BENCH_ITERATION_ROUNDS,&sample);
+
+	// boot with deleted entries and old values
+	bench_start(&sample);
+
+	for(uint8_t r = 0 ; r < BENCH_INIT_ROUNDS ; r++)
+		kved_init();
+
+	bench_report("init_dirty",sector_size,fill,BENCH_INIT_ROUNDS,&sample);
+
+	bench_start(&sample);
+
+	for(uint8_t r = 0 ; r < BENCH_INIT_ROUNDS ; r++)
+		kved_init_scratch(bench_scratch,BENCH_SCRATCH_SIZE);
+
+	bench_report("init_dirty_scratch",sector_size,fill,BENCH_INIT_ROUNDS,&sample);
+
+	// changes until a sector switch, the second one is reported (standby sector not erased)
+	uint8_t num_switches = 0;
+
+	for(uint32_t n = 0 ; (n < BENCH_MAX_SWITCH_WRITES) && (num_switches < 2) && (num_keys > 0) ; n++)
+	{
+		bench_key_make(&d,n % num_keys);
+		d.value.u32 = n + 2;
+		bench_start(&sample);
+		kved_data_write(&d);
+		kved_flash_simul_counters_get(&sample.cnt);
+
+		// a change writes one entry and clears the old key, live entries are copied by a switch
+		if((sample.cnt.writes > 3) && (++num_switches == 2))
+			bench_report("sector_switch",sector_size,fill,1,&sample);
+	}
+}
+
+int main(void)
+{
+	// modelled time of STM32L4 flash operations
+	kved_flash_simul_timing_set(&kved_flash_simul_timing_stm32l4);
+
+	printf("op,sector_size,fill,entries,used,ops,wall_us,flash_reads,flash_writes,flash_erases,model_us\n");
+
+	for(uint32_t sector_size = 512 ; sector_size <= KVED_SIMUL_MAX_NUM_ENTRIES*KVED_FLASH_WORD_SIZE ; sector_size *= 2)
+	{
+		for(uint8_t f = 0 ; f < sizeof(bench_fill_levels) ; f++)
+			bench_run(sector_size,bench_fill_levels[f]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+kved (key/value embedded database), a simple key/value database 
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kved.h"
+#include "kved_flash.h"
+
+#define MMAP_NUM_KEYS 16
+
+static void mmap_key_make(kved_data_t *data, uint16_t n)
+{
+	memset(data->key,0,KVED_MAX_KEY_SIZE);
+	data->key[0] = 'k';
+	data->key[1] = 'A' + n;
+	data->type = KVED_DATA_TYPE_UINT32;
+}
+
+// usage: kved_mmap.elf [image [sector_size [writes]]]
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : KVED_MMAP_IMAGE;
+	uint32_t sector_size = argc > 2 ? strtoul(argv[2],NULL,0) : KVED_MMAP_SECTOR_SIZE;
+	uint32_t num_writes = argc > 3 ? strtoul(argv[3],NULL,0) : 1000;
+	kved_flash_mmap_counters_t cnt;
+	kved_word_t boots = 0;
+	kved_data_t d;
+	int errors = 0;
+
+	if(!kved_flash_mmap_open(path,sector_size))
+	{
+		fprintf(stderr,"can not map %s with %lu bytes sectors\n",path,(unsigned long)sector_size);
+		return 1;
+	}
+
+	kved_init();
+
+	uint16_t num_keys = kved_total_entries_get() > 2*MMAP_NUM_KEYS ? MMAP_NUM_KEYS : kved_total_entries_get()/4;
+
+	// values of the previous run must be there
+	if(kved_counter_get("boots",&boots))
+	{
+		for(uint16_t n = 0 ; n < num_keys ; n++)
+		{
+			mmap_key_make(&d,n);
+
+			if(!kved_data_read(&d) || (d.value.u32 != boots))
+				errors++;
+		}
+	}
+
+	kved_counter_inc("boots");
+	kved_counter_get("boots",&boots);
+	kved_flash_mmap_counters_reset();
+
+	for(uint32_t n = 0 ; n < num_writes ; n++)
+	{
+		mmap_key_make(&d,n % num_keys);
+		d.value.u32 = rand();
+
+		if(!kved_data_write(&d))
+			errors++;
+	}
+
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		mmap_key_make(&d,n);
+		d.value.u32 = boots;
+
+		if(!kved_data_write(&d))
+			errors++;
+	}
+
+#ifdef KVED_MMAP_MAPPED_READ
+	// values are also read in place, from the mapped image
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		mmap_key_make(&d,n);
+		const kved_value_t *val = kved_data_view(&d);
+
+		if(!val || (val->u32 != boots))
+			errors++;
+	}
+#endif
+
+	kved_flash_mmap_counters_get(&cnt);
+	kved_flash_mmap_close();
+
+	printf("image,sector_size,boots,entries,used,errors,reads,writes,programs,erases,set_bits\n");
+	printf("%s,%lu,%lu,%u,%u,%d,%lu,%lu,%lu,%lu,%lu\n",
+		path,
+		(unsigned long)sector_size,
+		(unsigned long)boots,
+		kved_total_entries_get(),
+		kved_used_entries_get(),
+		errors,
+		(unsigned long)cnt.reads,
+		(unsigned long)cnt.writes,
+		(unsigned long)cnt.programs,
+		(unsigned long)cnt.erases,
+		(unsigned long)cnt.set_bits);
+
+	// kved never sets cleared bits without erasing
+	return (errors || cnt.set_bits) ? 1 : 0;
+}
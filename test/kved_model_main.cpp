@@ -0,0 +1,417 @@
+/*
+kved (key/value embedded database), a simple key/value database
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kved.h"
+#include "kved_flash.h"
+
+#define MODEL_SECTOR_WORDS 64
+#define MODEL_NUM_KEYS 12
+#define MODEL_NUM_OPS 400
+#define MODEL_NUM_SEEDS 200
+
+// value types only, blobs and counters have their own API
+#if KVED_FLASH_WORD_SIZE == 8
+#define MODEL_NUM_DATA_TYPES (KVED_DATA_TYPE_DOUBLE + 1)
+#else
+#define MODEL_NUM_DATA_TYPES (KVED_DATA_TYPE_STRING + 1)
+#endif
+
+typedef enum model_op_e
+{
+	MODEL_OP_WRITE = 0,
+	MODEL_OP_READ,
+	MODEL_OP_DELETE,
+	MODEL_OP_ITERATE,
+	MODEL_OP_FORMAT,
+	MODEL_OP_INIT,
+	MODEL_NUM_OP_TYPES,
+} model_op_t;
+
+static const char *model_op_names[MODEL_NUM_OP_TYPES] = { "write", "read", "delete", "iterate", "format", "init" };
+
+typedef struct model_step_s
+{
+	model_op_t op;
+	uint8_t key;
+	uint8_t type;
+	uint64_t value;
+} model_step_t;
+
+// expected contents: key name -> type and value
+typedef struct model_entry_s
+{
+	uint8_t type;
+	kved_value_t value;
+} model_entry_t;
+
+typedef std::unordered_map<std::string,model_entry_t> model_t;
+
+static kved_word_t model_flash[KVED_FLASH_NUM_SECTORS][MODEL_SECTOR_WORDS];
+
+static void model_flash_init(void *arg)
+{
+}
+
+static bool model_flash_sector_erase(void *arg, kved_flash_sector_t sec)
+{
+	memset(model_flash[sec],0xFF,sizeof(model_flash[sec]));
+
+	return true;
+}
+
+static void model_flash_data_write(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	// NOR flash: bits can only be cleared
+	model_flash[sec][index] &= data;
+}
+
+static kved_word_t model_flash_data_read(void *arg, kved_flash_sector_t sec, uint16_t index)
+{
+	return model_flash[sec][index];
+}
+
+static uint32_t model_flash_sector_size(void *arg)
+{
+	return MODEL_SECTOR_WORDS*KVED_FLASH_WORD_SIZE;
+}
+
+static kved_flash_ops_t model_flash_ops_get(void)
+{
+	kved_flash_ops_t ops;
+
+	memset(&ops,0,sizeof(ops));
+	ops.init = model_flash_init;
+	ops.sector_erase = model_flash_sector_erase;
+	ops.data_write = model_flash_data_write;
+	ops.data_read = model_flash_data_read;
+	ops.sector_size = model_flash_sector_size;
+
+	return ops;
+}
+
+static const kved_flash_ops_t model_flash_ops = model_flash_ops_get();
+
+// key names from 1 up to KVED_MAX_KEY_SIZE chars, sharing prefixes
+static std::string model_key_name(uint8_t key)
+{
+	std::string name(1,(char)('a' + key % 4));
+
+	for(uint8_t n = key / 4 ; (n > 0) && (name.size() < KVED_MAX_KEY_SIZE) ; n--)
+		name += (char)('0' + n);
+
+	return name;
+}
+
+static void model_key_make(kved_data_t *data, uint8_t key, uint8_t type)
+{
+	std::string name = model_key_name(key);
+
+	memset(data,0,sizeof(kved_data_t));
+	memcpy(data->key,name.data(),name.size());
+	data->type = (kved_data_types_t)type;
+}
+
+// value set as an application would do, only through the field of its type
+static void model_value_make(kved_data_t *data, uint64_t value)
+{
+	switch(data->type)
+	{
+	case KVED_DATA_TYPE_UINT8:
+		data->value.u8 = (uint8_t)value;
+		break;
+	case KVED_DATA_TYPE_INT8:
+		data->value.i8 = (int8_t)value;
+		break;
+	case KVED_DATA_TYPE_UINT16:
+		data->value.u16 = (uint16_t)value;
+		break;
+	case KVED_DATA_TYPE_INT16:
+		data->value.i16 = (int16_t)value;
+		break;
+	case KVED_DATA_TYPE_UINT32:
+		data->value.u32 = (uint32_t)value;
+		break;
+	case KVED_DATA_TYPE_INT32:
+		data->value.i32 = (int32_t)value;
+		break;
+	case KVED_DATA_TYPE_FLOAT:
+	{
+		uint32_t bits = (uint32_t)value;
+		memcpy(&data->value.flt,&bits,sizeof(bits));
+		break;
+	}
+	case KVED_DATA_TYPE_STRING:
+	{
+		// printable chars, from empty up to a string without terminator
+		uint8_t size = (uint8_t)(value % (KVED_MAX_STRING_SIZE + 1));
+
+		for(uint8_t n = 0 ; n < size ; n++)
+			data->value.str[n] = (uint8_t)(' ' + ((value >> (8 + 6*n)) + n) % 95);
+		break;
+	}
+#if KVED_FLASH_WORD_SIZE == 8
+	case KVED_DATA_TYPE_UINT64:
+		data->value.u64 = value;
+		break;
+	case KVED_DATA_TYPE_INT64:
+		data->value.i64 = (int64_t)value;
+		break;
+	case KVED_DATA_TYPE_DOUBLE:
+		memcpy(&data->value.dbl,&value,sizeof(value));
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+static bool model_entry_check(const model_entry_t &expected, const kved_data_t *data)
+{
+	return (expected.type == data->type) && (memcmp(&expected.value,&data->value,sizeof(kved_value_t)) == 0);
+}
+
+static bool model_stats_check(kved_t *kv, const model_t &model, char *msg, size_t size)
+{
+	kved_sector_stat_t *stats = &kv->ctrl.stats;
+
+	if(stats->num_used_entries + stats->num_deleted_entries + stats->num_free_entries != stats->num_total_entries)
+	{
+		snprintf(msg,size,"stats: used %u + deleted %u + free %u != total %u",
+			stats->num_used_entries,stats->num_deleted_entries,stats->num_free_entries,stats->num_total_entries);
+		return false;
+	}
+
+	if(kved_used_entries_get_ex(kv) != model.size())
+	{
+		snprintf(msg,size,"used entries %u, expected %u",kved_used_entries_get_ex(kv),(unsigned)model.size());
+		return false;
+	}
+
+	return true;
+}
+
+// runs one step against the database and the model, false on mismatches
+static bool model_step_run(kved_t *kv, model_t &model, const model_step_t &step, char *msg, size_t size)
+{
+	std::string name = model_key_name(step.key);
+	auto it = model.find(name);
+	kved_data_t d;
+
+	switch(step.op)
+	{
+	case MODEL_OP_WRITE:
+	{
+		model_key_make(&d,step.key,step.type);
+		model_value_make(&d,step.value);
+
+		if(!kved_data_write_ex(kv,&d))
+		{
+			snprintf(msg,size,"write of %s failed",name.c_str());
+			return false;
+		}
+
+		model_entry_t &entry = model[name];
+		entry.type = step.type;
+		entry.value = d.value;
+		break;
+	}
+	case MODEL_OP_READ:
+	{
+		// the stored type is returned, whatever the type asked for
+		model_key_make(&d,step.key,step.type);
+		bool found = kved_data_read_ex(kv,&d);
+
+		if(found != (it != model.end()))
+		{
+			snprintf(msg,size,"read of %s: found %d, expected %d",name.c_str(),found,!found);
+			return false;
+		}
+
+		if(found && !model_entry_check(it->second,&d))
+		{
+			snprintf(msg,size,"read of %s: type %d, expected %d (or value mismatch)",name.c_str(),d.type,it->second.type);
+			return false;
+		}
+		break;
+	}
+	case MODEL_OP_DELETE:
+	{
+		model_key_make(&d,step.key,step.type);
+		bool deleted = kved_data_delete_ex(kv,&d);
+
+		if(deleted != (it != model.end()))
+		{
+			snprintf(msg,size,"delete of %s: result %d, expected %d",name.c_str(),deleted,!deleted);
+			return false;
+		}
+
+		if(deleted)
+			model.erase(it);
+		break;
+	}
+	case MODEL_OP_ITERATE:
+	{
+		model_t seen;
+
+		for(uint16_t i = kved_first_used_index_get_ex(kv) ; i != KVED_INDEX_NOT_FOUND ; i = kved_next_used_index_get_ex(kv,i))
+		{
+			if(!kved_data_read_by_index_ex(kv,i,&d))
+			{
+				snprintf(msg,size,"iterate: read of index %u failed",i);
+				return false;
+			}
+
+			std::string key(reinterpret_cast<char *>(d.key),strnlen(reinterpret_cast<char *>(d.key),KVED_MAX_KEY_SIZE));
+			auto expected = model.find(key);
+
+			if((expected == model.end()) || !model_entry_check(expected->second,&d))
+			{
+				snprintf(msg,size,"iterate: unexpected %s at index %u",key.c_str(),i);
+				return false;
+			}
+
+			if(!seen.emplace(key,expected->second).second)
+			{
+				snprintf(msg,size,"iterate: %s found twice",key.c_str());
+				return false;
+			}
+		}
+
+		if(seen.size() != model.size())
+		{
+			snprintf(msg,size,"iterate: %u keys, expected %u",(unsigned)seen.size(),(unsigned)model.size());
+			return false;
+		}
+		break;
+	}
+	case MODEL_OP_FORMAT:
+		kved_format_ex(kv);
+		model.clear();
+		break;
+	case MODEL_OP_INIT:
+	default:
+		kved_init_ex(kv,&model_flash_ops,NULL);
+		break;
+	}
+
+	return model_stats_check(kv,model,msg,size);
+}
+
+// runs the sequence from an erased flash, returns the index of the failing step or -1
+static int model_run(const std::vector<model_step_t> &steps, char *msg, size_t size)
+{
+	model_t model;
+	kved_t kv;
+
+	memset(model_flash,0xFF,sizeof(model_flash));
+	kved_init_ex(&kv,&model_flash_ops,NULL);
+
+	for(size_t n = 0 ; n < steps.size() ; n++)
+	{
+		if(!model_step_run(&kv,model,steps[n],msg,size))
+			return (int)n;
+	}
+
+	return -1;
+}
+
+static std::vector<model_step_t> model_steps_make(uint32_t seed, uint16_t num_ops)
+{
+	std::mt19937_64 rng(seed);
+	std::vector<model_step_t> steps(num_ops);
+
+	for(model_step_t &step : steps)
+	{
+		// format and init are rare, so the database can grow up to sector switches
+		uint32_t op = rng() % 100;
+
+		step.op = op < 45 ? MODEL_OP_WRITE :
+				  op < 75 ? MODEL_OP_READ :
+				  op < 90 ? MODEL_OP_DELETE :
+				  op < 96 ? MODEL_OP_ITERATE :
+				  op < 97 ? MODEL_OP_FORMAT : MODEL_OP_INIT;
+		step.key = (uint8_t)(rng() % MODEL_NUM_KEYS);
+		step.type = (uint8_t)(rng() % MODEL_NUM_DATA_TYPES);
+		// small values are repeated, testing unchanged writes
+		step.value = rng() % 2 ? rng() % 4 : rng();
+	}
+
+	return steps;
+}
+
+// removes chunks of steps while the sequence still fails (delta debugging)
+static std::vector<model_step_t> model_shrink(std::vector<model_step_t> steps)
+{
+	char msg[128];
+
+	for(size_t chunk = steps.size() / 2 ; chunk > 0 ; chunk /= 2)
+	{
+		for(size_t start = 0 ; start + chunk <= steps.size() ; )
+		{
+			std::vector<model_step_t> candidate(steps);
+			candidate.erase(candidate.begin() + start,candidate.begin() + start + chunk);
+
+			if(model_run(candidate,msg,sizeof(msg)) >= 0)
+				steps = candidate;
+			else
+				start += chunk;
+		}
+	}
+
+	return steps;
+}
+
+static void model_steps_print(const std::vector<model_step_t> &steps)
+{
+	for(size_t n = 0 ; n < steps.size() ; n++)
+	{
+		printf("  %u: %s %s type %u value 0x%llx\n",(unsigned)n,model_op_names[steps[n].op],
+			model_key_name(steps[n].key).c_str(),steps[n].type,(unsigned long long)steps[n].value);
+	}
+}
+
+// usage: kved_model.elf [seeds [operations [first seed]]]
+int main(int argc, char **argv)
+{
+	uint32_t num_seeds = argc > 1 ? strtoul(argv[1],NULL,0) : MODEL_NUM_SEEDS;
+	uint16_t num_ops = argc > 2 ? (uint16_t)strtoul(argv[2],NULL,0) : MODEL_NUM_OPS;
+	uint32_t first = argc > 3 ? strtoul(argv[3],NULL,0) : 1;
+	char msg[128];
+
+	for(uint32_t seed = first ; seed < first + num_seeds ; seed++)
+	{
+		std::vector<model_step_t> steps = model_steps_make(seed,num_ops);
+		int failed = model_run(steps,msg,sizeof(msg));
+
+		if(failed < 0)
+			continue;
+
+		printf("seed %lu: step %d failed: %s\n",(unsigned long)seed,failed,msg);
+
+		steps.resize(failed + 1);
+		steps = model_shrink(steps);
+		model_run(steps,msg,sizeof(msg));
+
+		printf("shrunk to %u steps (%s):\n",(unsigned)steps.size(),msg);
+		model_steps_print(steps);
+
+		return 1;
+	}
+
+	printf("%lu seeds, %u operations each: ok\n",(unsigned long)num_seeds,num_ops);
+
+	return 0;
+}
@@ -0,0 +1,335 @@
+/*
+kved (key/value embedded database), a simple key/value database
+implementation for microcontrollers.
+
+Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "kved.h"
+#include "kved_flash.h"
+
+#define POWERLOSS_SECTOR_WORDS 32
+#define POWERLOSS_NUM_KEYS 4
+#define POWERLOSS_BLOB_SIZE 8
+#define POWERLOSS_NUM_OPS 150
+#define POWERLOSS_NUM_SEEDS 4
+
+typedef enum powerloss_op_e
+{
+	POWERLOSS_OP_WRITE = 0,
+	POWERLOSS_OP_DELETE,
+	POWERLOSS_OP_TXN,
+	POWERLOSS_OP_COUNTER,
+	POWERLOSS_OP_BLOB,
+	POWERLOSS_OP_IDLE,
+	POWERLOSS_OP_GC_STEP,
+	POWERLOSS_NUM_OP_TYPES,
+} powerloss_op_t;
+
+// committed database contents (oracle)
+typedef struct powerloss_state_s
+{
+	uint32_t values[POWERLOSS_NUM_KEYS];
+	bool present[POWERLOSS_NUM_KEYS];
+	kved_word_t counter;
+	uint8_t blob_seed;
+	bool blob_present;
+} powerloss_state_t;
+
+// flash steps are word writes and erasures, steps from cut on are lost
+typedef struct powerloss_flash_s
+{
+	kved_word_t words[KVED_FLASH_NUM_SECTORS][POWERLOSS_SECTOR_WORDS];
+	uint32_t steps;
+	uint32_t cut;
+} powerloss_flash_t;
+
+static powerloss_flash_t flash;
+
+static bool powerloss_flash_off(void)
+{
+	return flash.cut && (flash.steps >= flash.cut);
+}
+
+// true when the step is done before the cut
+static bool powerloss_flash_step(void)
+{
+	if(powerloss_flash_off())
+		return false;
+
+	flash.steps++;
+
+	return !powerloss_flash_off();
+}
+
+static void powerloss_flash_init(void *arg)
+{
+}
+
+static bool powerloss_flash_sector_erase(void *arg, kved_flash_sector_t sec)
+{
+	// cut before starting
+	if(!powerloss_flash_step())
+		return false;
+
+	// cut halfway: the first half is erased, the second one keeps old contents
+	if(!powerloss_flash_step())
+	{
+		memset(flash.words[sec],0xFF,sizeof(flash.words[sec])/2);
+		return false;
+	}
+
+	memset(flash.words[sec],0xFF,sizeof(flash.words[sec]));
+
+	return true;
+}
+
+static void powerloss_flash_data_write(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	// NOR flash: bits can only be cleared
+	if(powerloss_flash_step())
+		flash.words[sec][index] &= data;
+}
+
+static void powerloss_flash_entry_write(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	powerloss_flash_data_write(arg,sec,index + 1,value);
+	powerloss_flash_data_write(arg,sec,index,key);
+}
+
+static void powerloss_flash_data_write_block(void *arg, kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	for(uint16_t n = 0 ; n < count ; n++)
+		powerloss_flash_data_write(arg,sec,index + n,buf[n]);
+}
+
+static kved_word_t powerloss_flash_data_read(void *arg, kved_flash_sector_t sec, uint16_t index)
+{
+	return flash.words[sec][index];
+}
+
+static uint32_t powerloss_flash_sector_size(void *arg)
+{
+	return POWERLOSS_SECTOR_WORDS*KVED_FLASH_WORD_SIZE;
+}
+
+static const kved_flash_ops_t powerloss_flash_ops =
+{
+	.arg = NULL,
+	.init = powerloss_flash_init,
+	.sector_erase = powerloss_flash_sector_erase,
+	.data_write = powerloss_flash_data_write,
+	.entry_write = powerloss_flash_entry_write,
+	.data_write_block = powerloss_flash_data_write_block,
+	.data_read = powerloss_flash_data_read,
+	.sector_size = powerloss_flash_sector_size,
+};
+
+static void powerloss_key_make(kved_data_t *data, uint8_t n)
+{
+	memset(data,0,sizeof(kved_data_t));
+	data->key[0] = 'p';
+	data->key[1] = '0' + n;
+	data->type = KVED_DATA_TYPE_UINT32;
+}
+
+static void powerloss_blob_make(uint8_t *blob, uint8_t seed)
+{
+	for(uint8_t n = 0 ; n < POWERLOSS_BLOB_SIZE ; n++)
+		blob[n] = seed + n;
+}
+
+static bool powerloss_state_check(kved_t *kv, const powerloss_state_t *state)
+{
+	uint8_t blob[POWERLOSS_BLOB_SIZE];
+	uint8_t expected[POWERLOSS_BLOB_SIZE];
+	uint16_t size = sizeof(blob);
+	kved_word_t counter = 0;
+	kved_data_t d;
+
+	for(uint8_t n = 0 ; n < POWERLOSS_NUM_KEYS ; n++)
+	{
+		powerloss_key_make(&d,n);
+		bool found = kved_data_read_ex(kv,&d);
+
+		if((found != state->present[n]) || (found && (d.value.u32 != state->values[n])))
+			return false;
+	}
+
+	if(kved_counter_get_ex(kv,"pc",&counter) != (state->counter != 0) || (counter != state->counter))
+		return false;
+
+	bool found = kved_blob_read_ex(kv,"pb",blob,&size);
+	powerloss_blob_make(expected,state->blob_seed);
+
+	if((found != state->blob_present) || (found && ((size != sizeof(blob)) || memcmp(blob,expected,size))))
+		return false;
+
+	return kv->ctrl.stats.num_used_entries + kv->ctrl.stats.num_deleted_entries +
+		kv->ctrl.stats.num_free_entries == kv->ctrl.stats.num_total_entries;
+}
+
+// runs one operation, updating the expected state
+static bool powerloss_op_run(kved_t *kv, powerloss_op_t op, uint8_t key, uint32_t value, powerloss_state_t *state)
+{
+	uint8_t blob[POWERLOSS_BLOB_SIZE];
+	kved_txn_t txn;
+	kved_data_t d;
+	bool result;
+
+	switch(op)
+	{
+	case POWERLOSS_OP_WRITE:
+		powerloss_key_make(&d,key);
+		d.value.u32 = value;
+		state->values[key] = value;
+		state->present[key] = true;
+		return kved_data_write_ex(kv,&d);
+	case POWERLOSS_OP_DELETE:
+		powerloss_key_make(&d,key);
+		result = kved_data_delete_ex(kv,&d) == state->present[key];
+		state->present[key] = false;
+		return result;
+	case POWERLOSS_OP_TXN:
+		kved_txn_begin(&txn);
+
+		// two keys, all values or none of them
+		for(uint8_t n = 0 ; n < 2 ; n++)
+		{
+			uint8_t k = (key + n) % POWERLOSS_NUM_KEYS;
+
+			powerloss_key_make(&d,k);
+			d.value.u32 = value + n;
+			kved_txn_put(&txn,&d);
+			state->values[k] = value + n;
+			state->present[k] = true;
+		}
+
+		return kved_txn_commit_ex(kv,&txn);
+	case POWERLOSS_OP_COUNTER:
+		state->counter++;
+		return kved_counter_inc_ex(kv,"pc");
+	case POWERLOSS_OP_BLOB:
+		powerloss_blob_make(blob,(uint8_t)value);
+		state->blob_seed = (uint8_t)value;
+		state->blob_present = true;
+		return kved_blob_write_ex(kv,"pb",blob,sizeof(blob));
+	case POWERLOSS_OP_IDLE:
+		kved_idle_ex(kv);
+		return true;
+	case POWERLOSS_OP_GC_STEP:
+	default:
+		kved_gc_step_ex(kv,1 + value % 8);
+		return true;
+	}
+}
+
+// replays the workload up to the cut, returns the number of cut points (0 on failure)
+static uint32_t powerloss_run(uint32_t seed, uint16_t num_ops)
+{
+	uint32_t cut;
+	kved_t kv;
+	uint16_t scratch[KVED_FLASH_NUM_SECTORS*POWERLOSS_SECTOR_WORDS];
+
+	for(cut = 1 ; ; cut++)
+	{
+		powerloss_state_t before = { 0 };
+		powerloss_state_t after = { 0 };
+		powerloss_op_t op = POWERLOSS_OP_WRITE;
+		uint16_t op_index;
+
+		memset(&flash,0,sizeof(flash));
+		memset(flash.words,0xFF,sizeof(flash.words));
+		kved_init_ex(&kv,&powerloss_flash_ops,NULL);
+		kved_format_ex(&kv);
+
+		srand(seed);
+		flash.steps = 0;
+		flash.cut = cut;
+
+		for(op_index = 0 ; op_index < num_ops ; op_index++)
+		{
+			op = (powerloss_op_t)(rand() % POWERLOSS_NUM_OP_TYPES);
+			uint8_t key = (uint8_t)(rand() % POWERLOSS_NUM_KEYS);
+			uint32_t value = (uint32_t)rand();
+
+			after = before;
+			bool result = powerloss_op_run(&kv,op,key,value,&after);
+
+			if(powerloss_flash_off())
+				break;
+
+			if(!result || !powerloss_state_check(&kv,&after))
+			{
+				printf("seed %lu: op %u (type %d) failed without power loss\n",(unsigned long)seed,op_index,op);
+				return 0;
+			}
+
+			before = after;
+		}
+
+		// whole workload done before the cut
+		if(op_index == num_ops)
+			return cut - 1;
+
+		// power on: the interrupted operation is done or not, also after a second reset.
+		// duplicated keys are solved with the scratch buffer on odd cuts, by searching newer entries on even ones
+		flash.cut = 0;
+		kved_init_scratch_ex(&kv,&powerloss_flash_ops,NULL,scratch,(cut % 2) ? sizeof(scratch)/sizeof(scratch[0]) : 0);
+		bool done = powerloss_state_check(&kv,&after);
+
+		if(!done && !powerloss_state_check(&kv,&before))
+		{
+			printf("seed %lu: cut %lu at op %u (type %d), state lost\n",(unsigned long)seed,(unsigned long)cut,op_index,op);
+			return 0;
+		}
+
+		kved_init_ex(&kv,&powerloss_flash_ops,NULL);
+
+		if(!powerloss_state_check(&kv,done ? &after : &before))
+		{
+			printf("seed %lu: cut %lu at op %u, state changed by a second reset\n",(unsigned long)seed,(unsigned long)cut,op_index);
+			return 0;
+		}
+
+		// database still usable
+		powerloss_state_t state = done ? after : before;
+
+		if(!powerloss_op_run(&kv,POWERLOSS_OP_WRITE,0,cut,&state) || !powerloss_state_check(&kv,&state))
+		{
+			printf("seed %lu: cut %lu at op %u, write failed after power on\n",(unsigned long)seed,(unsigned long)cut,op_index);
+			return 0;
+		}
+	}
+}
+
+// usage: kved_powerloss.elf [seeds [operations]]
+int main(int argc, char **argv)
+{
+	uint32_t num_seeds = argc > 1 ? strtoul(argv[1],NULL,0) : POWERLOSS_NUM_SEEDS;
+	uint16_t num_ops = argc > 2 ? (uint16_t)strtoul(argv[2],NULL,0) : POWERLOSS_NUM_OPS;
+	uint32_t total = 0;
+
+	printf("seed,ops,cut_points\n");
+
+	for(uint32_t seed = 1 ; seed <= num_seeds ; seed++)
+	{
+		uint32_t num_cuts = powerloss_run(seed,num_ops);
+
+		if(num_cuts == 0)
+			return 1;
+
+		printf("%lu,%u,%lu\n",(unsigned long)seed,num_ops,(unsigned long)num_cuts);
+		total += num_cuts;
+	}
+
+	printf("total,%u,%lu\n",num_ops,(unsigned long)total);
+
+	return 0;
+}
@@ -10,6 +10,7 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "kved.h"
 #include "kved_cpu.h"
@@ -90,6 +91,12 @@ void kved_value_test(void)
 	assert(v.str[2] == d.value.str[2]);
 	assert(v.str[3] == d.value.str[3]);
 
+	// new type with the same value bits
+	d.type = KVED_DATA_TYPE_UINT32;
+	kved_data_write(&d);
+	kved_data_read(&d);
+	assert(d.type == KVED_DATA_TYPE_UINT32);
+
 	// Forcing roll over (sector a)
 	d.type = KVED_DATA_TYPE_UINT32;
 	for(size_t n = 0 ; n < (kved_flash_sector_size()/(2*sizeof(kved_word_t))) ; n++)
@@ -166,14 +173,19 @@ void kved_value_test(void)
 #endif
 }
 
+static void kved_test_sectors_erase(void)
+{
+	for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+		kved_flash_sector_erase(sec);
+}
+
 void kved_header_test(void)
 {
 	kved_init();
     kved_dump();
 
     // test sector selection by newer counter
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_A);
-    kved_flash_sector_erase(KVED_FLASH_SECTOR_B);
+	kved_test_sectors_erase();
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,0,KVED_SIGNATURE_ENTRY);
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,1,10);
 	kved_flash_data_write(KVED_FLASH_SECTOR_B,0,KVED_SIGNATURE_ENTRY);
@@ -183,8 +195,7 @@ void kved_header_test(void)
     kved_dump();
 
     // test error condition when max counter is reached
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_A);
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_B);
+	kved_test_sectors_erase();
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,0,KVED_SIGNATURE_ENTRY);
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,1,KVED_FLASH_UINT_MAX);
     kved_flash_data_write(KVED_FLASH_SECTOR_B,0,KVED_SIGNATURE_ENTRY);
@@ -194,10 +205,9 @@ void kved_header_test(void)
     kved_dump();
 
     // test sector roll over
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_A);
+	kved_test_sectors_erase();
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,0,KVED_SIGNATURE_ENTRY);
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,1,KVED_FLASH_UINT_MAX-1);
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_B);
 	kved_flash_data_write(KVED_FLASH_SECTOR_B,0,KVED_SIGNATURE_ENTRY);
 	kved_flash_data_write(KVED_FLASH_SECTOR_B,1,0);
 
@@ -207,8 +217,7 @@ void kved_header_test(void)
 
 void kved_key_test(void)
 {      
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_A);
-	kved_flash_sector_erase(KVED_FLASH_SECTOR_B);
+	kved_test_sectors_erase();
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,0,KVED_SIGNATURE_ENTRY);
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,1,0);
 
@@ -243,15 +252,1753 @@ void kved_key_test(void)
     kved_dump();
 	kved_init();
 
+	// newest copy must win
+	assert(kved_used_entries_get() == 3);
+	assert(kved_data_read(&d2));
+	assert(d2.value.u8 == 0x45);
+
 	// invalid entry (key not written)
 	kved_flash_data_write(KVED_FLASH_SECTOR_A,11,0x12345);
 
 	kved_dump();
 	kved_init();
 
+	assert(kved_used_entries_get() == 3);
+
 	d2.type = KVED_DATA_TYPE_INT16;
 	d2.value.i16 = -1;
 	kved_data_write(&d2);
 
 	kved_init();
+
+	assert(kved_used_entries_get() == 3);
+	assert(kved_data_read(&d2));
+	assert(d2.value.i16 == -1);
+
+	// duplicated keys solved with a scratch buffer, then with a buffer too small for the used entries
+	uint16_t scratch[4];
+
+	for(uint8_t n = 0 ; n < 2 ; n++)
+	{
+		kved_test_sectors_erase();
+		kved_flash_data_write(KVED_FLASH_SECTOR_A,0,KVED_SIGNATURE_ENTRY);
+		kved_flash_data_write(KVED_FLASH_SECTOR_A,1,0);
+
+		kved_init();
+
+		d1.value.u32 = 1;
+		kved_data_write(&d1);
+		kved_data_write(&d3);
+
+		// newer copy of c1, the old one was not deleted
+		kved_flash_data_write(KVED_FLASH_SECTOR_A,7,2);
+		kved_flash_data_write(KVED_FLASH_SECTOR_A,6,kved_key_encode(&d1));
+
+		kved_init_scratch(scratch,n == 0 ? 4 : 2);
+
+		assert(kved_used_entries_get() == 2);
+		assert(kved_data_read(&d1));
+		assert(d1.value.u32 == 2);
+		assert(kved_data_read(&d3));
+	}
+}
+
+static void kved_test_key_make(kved_data_t *data, uint16_t n)
+{
+	// two printable chars, enough for 32 bits flash keys
+	memset(data->key,0,KVED_MAX_KEY_SIZE);
+	data->key[0] = '!' + (n / 94);
+	data->key[1] = '!' + (n % 94);
+}
+
+void kved_index_test(void)
+{
+	kved_data_t d = { .type = KVED_DATA_TYPE_UINT32 };
+	uint16_t num_keys = kved_total_entries_get();
+
+	kved_format();
+
+	// fill the whole sector with distinct keys, exceeding the RAM index when it is small
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		kved_test_key_make(&d,n);
+		d.type = KVED_DATA_TYPE_UINT32;
+		d.value.u32 = n;
+		assert(kved_data_write(&d));
+	}
+
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		kved_test_key_make(&d,n);
+		assert(kved_data_read(&d));
+		assert(d.value.u32 == n);
+	}
+
+	// delete even keys and update odd ones, forcing a sector switch
+	for(uint16_t n = 0 ; n < num_keys ; n += 2)
+	{
+		kved_test_key_make(&d,n);
+		assert(kved_data_delete(&d));
+		assert(!kved_data_read(&d));
+	}
+
+	for(uint16_t n = 1 ; n < num_keys ; n += 2)
+	{
+		kved_test_key_make(&d,n);
+		d.type = KVED_DATA_TYPE_UINT32;
+		d.value.u32 = n + 100;
+		assert(kved_data_write(&d));
+	}
+
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		kved_test_key_make(&d,n);
+
+		if(n & 1)
+		{
+			assert(kved_data_read(&d));
+			assert(d.value.u32 == (uint32_t)(n + 100));
+		}
+		else
+		{
+			assert(!kved_data_read(&d));
+		}
+	}
+
+	kved_format();
+}
+
+void kved_iteration_test(void)
+{
+	kved_data_t d = { .type = KVED_DATA_TYPE_UINT16 };
+	uint16_t num_keys = kved_total_entries_get() - 1;
+	uint16_t found = 0;
+
+	kved_format();
+
+	assert(kved_first_used_index_get() == KVED_INDEX_NOT_FOUND);
+
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		kved_test_key_make(&d,n);
+		d.type = KVED_DATA_TYPE_UINT16;
+		d.value.u16 = n;
+		assert(kved_data_write(&d));
+	}
+
+	// sparse database: only multiples of 3 are kept
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		if(n % 3)
+		{
+			kved_test_key_make(&d,n);
+			assert(kved_data_delete(&d));
+		}
+	}
+
+	uint16_t index = kved_first_used_index_get();
+
+	while(index != KVED_INDEX_NOT_FOUND)
+	{
+		assert(kved_data_read_by_index(index,&d));
+		assert((d.value.u16 % 3) == 0);
+		found++;
+		index = kved_next_used_index_get(index);
+	}
+
+	assert(found == kved_used_entries_get());
+	assert(found == (num_keys + 2)/3);
+
+	kved_format();
+}
+
+void kved_view_test(void)
+{
+	kved_data_t d = { .key = "v1", .type = KVED_DATA_TYPE_UINT32, .value.u32 = 0xCAFE };
+	kved_data_t v = { .key = "v1" };
+
+	kved_format();
+
+	assert(kved_data_view(&v) == NULL);
+	assert(kved_data_write(&d));
+
+	const kved_value_t *val = kved_data_view(&v);
+
+#ifdef KVED_SIMUL_MAPPED_READ
+	assert(val != NULL);
+	assert(v.type == KVED_DATA_TYPE_UINT32);
+	assert(val->u32 == 0xCAFE);
+
+	// the view points to the newest entry
+	d.value.u32 = 0xBEEF;
+	assert(kved_data_write(&d));
+	val = kved_data_view(&v);
+	assert(val != NULL);
+	assert(val->u32 == 0xBEEF);
+#else
+	// only available for memory mapped flash ports
+	assert(val == NULL);
+#endif
+
+	kved_format();
+}
+
+void kved_encoded_test(void)
+{
+	kved_data_t d = { .key = "e1", .type = KVED_DATA_TYPE_UINT16, .value.u16 = 0x1234 };
+	kved_data_t r = { 0 };
+	kved_word_t key = kved_key_encode(&d);
+	uint16_t hint = KVED_INDEX_NOT_FOUND;
+
+	kved_format();
+
+	assert(!kved_encoded_data_read(key,&hint,&r));
+	assert(hint == KVED_INDEX_NOT_FOUND);
+	assert(kved_encoded_data_write(key,&d));
+
+	// first read finds the key and updates the hint
+	assert(kved_encoded_data_read(key,&hint,&r));
+	assert(hint != KVED_INDEX_NOT_FOUND);
+	assert(r.type == KVED_DATA_TYPE_UINT16);
+	assert(r.value.u16 == 0x1234);
+
+	// stale hint after an update
+	uint16_t old_hint = hint;
+	d.value.u16 = 0x4321;
+	assert(kved_data_write(&d));
+	assert(kved_encoded_data_read(key,&hint,&r));
+	assert(hint != old_hint);
+	assert(r.value.u16 == 0x4321);
+
+	// invalid hints
+	hint = 1;
+	assert(kved_encoded_data_read(key,&hint,&r));
+	assert(r.value.u16 == 0x4321);
+	hint = 0xFFFF;
+	assert(kved_encoded_data_read(key,&hint,&r));
+	assert(r.value.u16 == 0x4321);
+	assert(kved_encoded_data_read(key,NULL,&r));
+
+	kved_format();
+}
+
+void kved_bloom_test(void)
+{
+	kved_data_t d = { .type = KVED_DATA_TYPE_UINT8 };
+	kved_bloom_stats_t stats;
+	uint16_t num_keys = kved_total_entries_get()/2;
+	uint16_t num_absent = 200;
+
+	kved_format();
+	kved_bloom_stats_get(&stats);
+	assert(stats.lookups == 0);
+
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		kved_test_key_make(&d,n);
+		d.type = KVED_DATA_TYPE_UINT8;
+		d.value.u8 = (uint8_t)n;
+		assert(kved_data_write(&d));
+	}
+
+	kved_bloom_stats_get(&stats);
+	uint32_t lookups = stats.lookups;
+	uint32_t absent = stats.rejected + stats.false_positives;
+
+	// stored keys are never rejected
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		kved_test_key_make(&d,n);
+		assert(kved_data_read(&d));
+		assert(d.value.u8 == (uint8_t)n);
+	}
+
+	for(uint16_t n = num_keys ; n < num_keys + num_absent ; n++)
+	{
+		kved_test_key_make(&d,n);
+		assert(!kved_data_read(&d));
+		assert(!kved_data_delete(&d));
+	}
+
+	kved_bloom_stats_get(&stats);
+
+	// filter disabled: nothing is counted
+	if(stats.lookups)
+	{
+		assert(stats.lookups == lookups + num_keys + 2*num_absent);
+		assert(stats.rejected + stats.false_positives == absent + 2*num_absent);
+		assert(stats.false_positive_rate <= 1000);
+		printf("bloom: %u lookups, %u rejected, %u false positives (%u/1000)\r\n",
+			(unsigned int)stats.lookups,(unsigned int)stats.rejected,
+			(unsigned int)stats.false_positives,(unsigned int)stats.false_positive_rate);
+	}
+	else
+	{
+		assert(stats.rejected == 0 && stats.false_positives == 0);
+	}
+
+	kved_format();
+}
+
+#define KVED_TEST_RAM_FLASH_WORDS 32
+
+typedef struct kved_test_ram_flash_s
+{
+	kved_word_t words[KVED_FLASH_NUM_SECTORS][KVED_TEST_RAM_FLASH_WORDS];
+	uint32_t locks;
+	uint32_t erases;
+	uint32_t writes;
+	uint32_t max_writes;
+	uint32_t programs;
+} kved_test_ram_flash_t;
+
+static void kved_test_ram_flash_init(void *arg)
+{
+}
+
+static bool kved_test_ram_flash_sector_erase(void *arg, kved_flash_sector_t sec)
+{
+	kved_test_ram_flash_t *flash = arg;
+
+	memset(flash->words[sec],0xFF,sizeof(flash->words[sec]));
+	flash->erases++;
+
+	return true;
+}
+
+static void kved_test_ram_flash_word_write(kved_test_ram_flash_t *flash, kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	// power loss simulation: writes after max_writes are lost
+	if(flash->max_writes && (flash->writes >= flash->max_writes))
+		return;
+
+	flash->writes++;
+
+#if !KVED_FLASH_BIT_CLEAR
+	// flash with ECC: a programmed word only accepts zero
+	assert((flash->words[sec][index] == KVED_FLASH_UINT_MAX) || (data == 0));
+#endif
+
+	// NOR flash: bits can only be cleared
+	flash->words[sec][index] &= data;
+}
+
+static void kved_test_ram_flash_data_write(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t data)
+{
+	kved_test_ram_flash_t *flash = arg;
+
+	flash->programs++;
+	kved_test_ram_flash_word_write(flash,sec,index,data);
+}
+
+static void kved_test_ram_flash_entry_write(void *arg, kved_flash_sector_t sec, uint16_t index, kved_word_t key, kved_word_t value)
+{
+	kved_test_ram_flash_t *flash = arg;
+
+	flash->programs++;
+	kved_test_ram_flash_word_write(flash,sec,index + 1,value);
+	kved_test_ram_flash_word_write(flash,sec,index,key);
+}
+
+static void kved_test_ram_flash_data_write_block(void *arg, kved_flash_sector_t sec, uint16_t index, const kved_word_t *buf, uint16_t count)
+{
+	kved_test_ram_flash_t *flash = arg;
+
+	flash->programs++;
+
+	for(uint16_t n = 0 ; n < count ; n++)
+		kved_test_ram_flash_word_write(flash,sec,index + n,buf[n]);
+}
+
+static kved_word_t kved_test_ram_flash_data_read(void *arg, kved_flash_sector_t sec, uint16_t index)
+{
+	kved_test_ram_flash_t *flash = arg;
+
+	return flash->words[sec][index];
+}
+
+static uint32_t kved_test_ram_flash_sector_size(void *arg)
+{
+	return KVED_TEST_RAM_FLASH_WORDS*KVED_FLASH_WORD_SIZE;
+}
+
+static void kved_test_ram_flash_lock(void *arg)
+{
+	kved_test_ram_flash_t *flash = arg;
+
+	flash->locks++;
+}
+
+static void kved_test_ram_flash_unlock(void *arg)
+{
+}
+
+void kved_instance_test(void)
+{
+	static kved_test_ram_flash_t ram_flash[2];
+	const kved_flash_ops_t flash_ops[2] = 
+	{
+		{ .arg = &ram_flash[0], .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		  .data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		  .sector_size = kved_test_ram_flash_sector_size },
+		{ .arg = &ram_flash[1], .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		  .data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		  .sector_size = kved_test_ram_flash_sector_size },
+	};
+	const kved_lock_ops_t lock_ops = { .arg = &ram_flash[0], .enter = kved_test_ram_flash_lock, .leave = kved_test_ram_flash_unlock };
+	kved_t kv[2];
+	kved_data_t d = { .key = "in", .type = KVED_DATA_TYPE_UINT32 };
+
+	memset(ram_flash,0,sizeof(ram_flash));
+	kved_format();
+
+	kved_init_ex(&kv[0],&flash_ops[0],&lock_ops);
+	kved_init_ex(&kv[1],&flash_ops[1],NULL);
+
+	// same key, one value per instance
+	d.value.u32 = 0;
+	assert(kved_data_write_ex(&kv[0],&d));
+	d.value.u32 = 1;
+	assert(kved_data_write_ex(&kv[1],&d));
+	assert(ram_flash[0].locks == 1);
+
+	assert(kved_data_read_ex(&kv[0],&d) && d.value.u32 == 0);
+	assert(kved_data_read_ex(&kv[1],&d) && d.value.u32 == 1);
+	assert(!kved_data_read(&d));
+	assert(kved_used_entries_get() == 0);
+
+	// several sector switches in the first instance only
+	for(uint32_t n = 0 ; n < 4*KVED_TEST_RAM_FLASH_WORDS ; n++)
+	{
+		d.type = KVED_DATA_TYPE_UINT32;
+		d.value.u32 = n;
+		assert(kved_data_write_ex(&kv[0],&d));
+	}
+
+	assert(kved_used_entries_get_ex(&kv[0]) == 1);
+	assert(kved_used_entries_get_ex(&kv[1]) == 1);
+	assert(kved_total_entries_get_ex(&kv[0]) == (KVED_FLASH_NUM_SECTORS - 1)*(KVED_TEST_RAM_FLASH_WORDS - KVED_HDR_SIZE_IN_WORDS)/KVED_ENTRY_SIZE_IN_WORDS);
+
+	// instances are restored from their own flash
+	kved_init_ex(&kv[0],&flash_ops[0],NULL);
+	kved_init_ex(&kv[1],&flash_ops[1],NULL);
+
+	assert(kved_data_read_ex(&kv[0],&d) && d.value.u32 == 4*KVED_TEST_RAM_FLASH_WORDS - 1);
+	assert(kved_data_read_ex(&kv[1],&d) && d.value.u32 == 1);
+	assert(kved_first_used_index_get_ex(&kv[1]) != KVED_INDEX_NOT_FOUND);
+
+	kved_format_ex(&kv[1]);
+	assert(!kved_data_read_ex(&kv[1],&d));
+	assert(kved_data_read_ex(&kv[0],&d));
+}
+
+void kved_standby_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	kved_data_t d = { .key = "sb", .type = KVED_DATA_TYPE_UINT32 };
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+	// both sectors erased by format
+	assert(kved_idle_ex(&kv));
+
+	uint16_t num_entries = kved_total_entries_get_ex(&kv);
+	ram_flash.erases = 0;
+
+	// filling all sectors, one sector switch without erasing (done by format)
+	for(uint16_t n = 0 ; n <= num_entries ; n++)
+	{
+		d.value.u32 = n;
+		assert(kved_data_write_ex(&kv,&d));
+	}
+
+	assert(ram_flash.erases == 0);
+
+	// old sector is erased by the idle hook only
+	assert(kved_idle_ex(&kv));
+	assert(kved_idle_ex(&kv));
+	assert(ram_flash.erases == 1);
+
+	// after a reset, the blank standby sector is only checked
+	kved_init_ex(&kv,&flash_ops,NULL);
+	ram_flash.erases = 0;
+	assert(kved_idle_ex(&kv));
+	assert(ram_flash.erases == 0);
+
+	kved_flash_sector_t sector = kv.ctrl.sector;
+	uint32_t value = 1000;
+
+	while(kv.ctrl.sector == sector)
+	{
+		d.value.u32 = value++;
+		assert(kved_data_write_ex(&kv,&d));
+	}
+
+	assert(ram_flash.erases == 0);
+
+	// switching without the idle hook still works (erasing during the write)
+	sector = kv.ctrl.sector;
+
+	while(kv.ctrl.sector == sector)
+	{
+		d.value.u32 = value++;
+		assert(kved_data_write_ex(&kv,&d));
+	}
+
+	assert(ram_flash.erases == 1);
+	assert(kved_data_read_ex(&kv,&d));
+	assert(d.value.u32 == value - 1);
+}
+
+#if KVED_FLASH_NUM_SECTORS == 2
+#define KVED_TEST_GC_KEYS 6
+
+static void kved_test_gc_check(kved_t *kv, const uint32_t *values, const bool *present)
+{
+	kved_data_t d;
+
+	for(uint16_t n = 0 ; n < KVED_TEST_GC_KEYS ; n++)
+	{
+		kved_test_key_make(&d,n);
+		d.type = KVED_DATA_TYPE_UINT32;
+		assert(kved_data_read_ex(kv,&d) == present[n]);
+		assert(!present[n] || (d.value.u32 == values[n]));
+	}
+}
+
+static void kved_test_gc_write(kved_t *kv, uint32_t *values, bool *present, uint16_t n, uint32_t value)
+{
+	kved_data_t d = { .type = KVED_DATA_TYPE_UINT32, .value.u32 = value };
+
+	kved_test_key_make(&d,n);
+	assert(kved_data_write_ex(kv,&d));
+	values[n] = value;
+	present[n] = true;
+}
+#endif
+
+void kved_gc_test(void)
+{
+	// collection steps below assume two sectors (see kved_ring_test)
+#if KVED_FLASH_NUM_SECTORS == 2
+	static kved_test_ram_flash_t ram_flash;
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	uint32_t values[KVED_TEST_GC_KEYS] = { 0 };
+	bool present[KVED_TEST_GC_KEYS] = { false };
+	kved_data_t d = { .type = KVED_DATA_TYPE_UINT32 };
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+
+	uint16_t num_entries = kved_total_entries_get_ex(&kv);
+
+	// nothing to collect yet
+	for(uint16_t n = 0 ; n < KVED_TEST_GC_KEYS ; n++)
+		kved_test_gc_write(&kv,values,present,n,n);
+
+	assert(!kved_gc_step_ex(&kv,4));
+
+	// more garbage than free space
+	for(uint16_t n = 0 ; n < 6 ; n++)
+		kved_test_gc_write(&kv,values,present,n % 2,100 + n);
+
+	ram_flash.erases = 0;
+
+	// copy two entries per step, updating and deleting entries already copied or not
+	assert(kved_gc_step_ex(&kv,4));
+	assert(kved_gc_step_ex(&kv,4));
+	kved_test_gc_write(&kv,values,present,0,200);
+	kved_test_gc_write(&kv,values,present,5,201);
+	kved_test_key_make(&d,1);
+	assert(kved_data_delete_ex(&kv,&d));
+	present[1] = false;
+	kved_test_gc_check(&kv,values,present);
+
+	uint16_t steps = 0;
+
+	while(kved_gc_step_ex(&kv,4))
+	{
+		assert(++steps < num_entries);
+		kved_test_gc_check(&kv,values,present);
+	}
+
+	// switched without erasing (done by format) and with the free space recovered
+	assert(ram_flash.erases == 0);
+	assert(kved_used_entries_get_ex(&kv) == KVED_TEST_GC_KEYS - 1);
+	assert(kv.ctrl.stats.num_free_entries > kv.ctrl.stats.num_deleted_entries);
+	kved_test_gc_check(&kv,values,present);
+
+	// reset in the middle of a collection: standby sector without header is ignored
+	while(!kved_gc_step_ex(&kv,2))
+		kved_test_gc_write(&kv,values,present,2,values[2] + 1);
+
+	while(!kv.ctrl.gc.active)
+		assert(kved_gc_step_ex(&kv,2));
+
+	assert(kved_gc_step_ex(&kv,2));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_test_gc_check(&kv,values,present);
+
+	// erase step, then copy and a foreground write finishing the collection
+	ram_flash.erases = 0;
+	assert(kved_gc_step_ex(&kv,2));
+	assert(ram_flash.erases == 1);
+	assert(kved_gc_step_ex(&kv,2));
+	assert(kved_gc_step_ex(&kv,2));
+	kved_test_gc_write(&kv,values,present,0,values[0] + 1);
+
+	while(kv.ctrl.stats.num_free_entries > 0)
+		kved_test_gc_write(&kv,values,present,3,values[3] + 1);
+
+	kved_test_gc_write(&kv,values,present,0,values[0] + 1);
+	kved_test_gc_write(&kv,values,present,1,300);
+	assert(ram_flash.erases == 1);
+	kved_test_gc_check(&kv,values,present);
+
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_test_gc_check(&kv,values,present);
+#endif
+}
+
+void kved_ring_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	const uint16_t sector_entries = (KVED_TEST_RAM_FLASH_WORDS - KVED_HDR_SIZE_IN_WORDS)/KVED_ENTRY_SIZE_IN_WORDS;
+	uint16_t hints[KVED_FLASH_NUM_SECTORS];
+	kved_data_t d = { .key = "rg", .type = KVED_DATA_TYPE_UINT32 };
+	kved_data_t r = { 0 };
+	uint32_t value = 0;
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+
+	// one sector is kept as standby
+	assert(kved_total_entries_get_ex(&kv) == (KVED_FLASH_NUM_SECTORS - 1)*sector_entries);
+
+	// one static key per sector, filled with updates of another key
+	for(uint8_t sec = 0 ; sec < (KVED_FLASH_NUM_SECTORS - 1) ; sec++)
+	{
+		kved_data_t s = { .type = KVED_DATA_TYPE_UINT32, .value.u32 = sec };
+
+		kved_test_key_make(&s,sec);
+		assert(kved_data_write_ex(&kv,&s));
+
+		while(kv.ctrl.first_free_index != 0)
+		{
+			d.value.u32 = value++;
+			assert(kved_data_write_ex(&kv,&d));
+		}
+	}
+
+	assert(kv.ctrl.num_sectors == (KVED_FLASH_NUM_SECTORS - 1));
+
+	for(uint8_t sec = 0 ; sec < (KVED_FLASH_NUM_SECTORS - 1) ; sec++)
+	{
+		kved_test_key_make(&r,sec);
+		hints[sec] = KVED_INDEX_NOT_FOUND;
+		assert(kved_encoded_data_read_ex(&kv,kved_key_encode(&r),&hints[sec],&r));
+		assert(r.value.u32 == sec);
+	}
+
+	// only the oldest sector is compacted, without erasing (done by format)
+	ram_flash.erases = 0;
+	d.value.u32 = value++;
+	assert(kved_data_write_ex(&kv,&d));
+	assert(ram_flash.erases == 0);
+	assert(kv.ctrl.first_free_index == KVED_HDR_SIZE_IN_WORDS + 2*KVED_ENTRY_SIZE_IN_WORDS);
+
+	for(uint8_t sec = 1 ; sec < (KVED_FLASH_NUM_SECTORS - 1) ; sec++)
+	{
+		uint16_t hint = hints[sec];
+
+		kved_test_key_make(&r,sec);
+		assert(kved_encoded_data_read_ex(&kv,kved_key_encode(&r),&hint,&r));
+		assert(hint == hints[sec]);
+	}
+
+	// reset before invalidating the old sector header: the copy was done, the old sector is dropped
+	kved_flash_sector_t old_sector = (kved_flash_sector_t)((kv.ctrl.sector + 1) % KVED_FLASH_NUM_SECTORS);
+
+	ram_flash.words[old_sector][0] = KVED_SIGNATURE_ENTRY;
+	kved_init_ex(&kv,&flash_ops,NULL);
+	assert(ram_flash.words[old_sector][0] != KVED_SIGNATURE_ENTRY);
+	assert(kv.ctrl.num_sectors == (KVED_FLASH_NUM_SECTORS - 1));
+	assert(kved_used_entries_get_ex(&kv) == KVED_FLASH_NUM_SECTORS);
+
+	// many laps, all sectors are iterated
+	for(uint16_t n = 0 ; n < 4*KVED_FLASH_NUM_SECTORS*sector_entries ; n++)
+	{
+		d.value.u32 = value++;
+		assert(kved_data_write_ex(&kv,&d));
+	}
+
+	kved_init_ex(&kv,&flash_ops,NULL);
+	assert(kved_data_read_ex(&kv,&d));
+	assert(d.value.u32 == value - 1);
+
+	uint16_t found = 0;
+
+	for(uint16_t index = kved_first_used_index_get_ex(&kv) ; index != KVED_INDEX_NOT_FOUND ; index = kved_next_used_index_get_ex(&kv,index))
+	{
+		assert(kved_data_read_by_index_ex(&kv,index,&r));
+
+		if(r.key[0] != 'r')
+			assert(r.value.u32 == (uint32_t)(r.key[1] - '!'));
+
+		found++;
+	}
+
+	assert(found == KVED_FLASH_NUM_SECTORS);
+}
+
+#define KVED_TEST_BATCH_KEYS 12
+
+void kved_batch_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	kved_data_t items[KVED_TEST_BATCH_KEYS];
+	kved_data_t d = { .key = "bt", .type = KVED_DATA_TYPE_UINT32 };
+	kved_data_t r = { 0 };
+	uint32_t value = 0;
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+
+	for(uint16_t n = 0 ; n < KVED_TEST_BATCH_KEYS ; n++)
+	{
+		memset(&items[n],0,sizeof(items[n]));
+		kved_test_key_make(&items[n],n);
+		items[n].type = KVED_DATA_TYPE_UINT32;
+		items[n].value.u32 = n;
+	}
+
+	assert(kved_data_write_batch_ex(&kv,items,KVED_TEST_BATCH_KEYS));
+	assert(kved_used_entries_get_ex(&kv) == KVED_TEST_BATCH_KEYS);
+
+	// unchanged values are not written again
+	uint16_t first_free_index = kv.ctrl.first_free_index;
+
+	assert(kved_data_write_batch_ex(&kv,items,KVED_TEST_BATCH_KEYS));
+	assert(kv.ctrl.first_free_index == first_free_index);
+
+	// the last value of a repeated key is written
+	kved_data_t twice[2] = { d, d };
+
+	twice[0].value.u32 = 1;
+	twice[1].value.u32 = 2;
+	assert(kved_data_write_batch_ex(&kv,twice,2));
+	assert(kved_data_read_ex(&kv,&d) && d.value.u32 == 2);
+	assert(kv.ctrl.first_free_index == first_free_index + KVED_ENTRY_SIZE_IN_WORDS);
+
+	// all sectors in use and a single free entry in the newest one
+	while((kv.ctrl.num_sectors < (KVED_FLASH_NUM_SECTORS - 1)) || (kv.ctrl.first_free_index != kv.ctrl.last_index))
+	{
+		d.value.u32 = value++;
+		assert(kved_data_write_ex(&kv,&d));
+	}
+
+	while(!kved_idle_ex(&kv))
+		;
+
+	// batch keys are in the oldest sector, updated while it is compacted: one sector switch, no erasing
+	kved_flash_sector_t sector = kv.ctrl.sector;
+
+	ram_flash.erases = 0;
+
+	for(uint16_t n = 0 ; n < KVED_TEST_BATCH_KEYS ; n++)
+		items[n].value.u32 = 100 + n;
+
+	assert(kved_data_write_batch_ex(&kv,items,KVED_TEST_BATCH_KEYS));
+	assert(ram_flash.erases == 0);
+	assert(kv.ctrl.sector == (kved_flash_sector_t)((sector + 1) % KVED_FLASH_NUM_SECTORS));
+
+	kved_init_ex(&kv,&flash_ops,NULL);
+
+	for(uint16_t n = 0 ; n < KVED_TEST_BATCH_KEYS ; n++)
+	{
+		kved_test_key_make(&r,n);
+		assert(kved_data_read_ex(&kv,&r) && r.value.u32 == 100u + n);
+	}
+
+	// no room for all new keys: nothing is written
+	uint16_t num_used = kved_used_entries_get_ex(&kv);
+
+	while(num_used < (kved_total_entries_get_ex(&kv) - 1))
+	{
+		kved_test_key_make(&d,KVED_TEST_BATCH_KEYS + num_used);
+		assert(kved_data_write_ex(&kv,&d));
+		num_used++;
+	}
+
+	kved_test_key_make(&items[0],KVED_TEST_BATCH_KEYS + num_used);
+	kved_test_key_make(&items[1],KVED_TEST_BATCH_KEYS + num_used + 1);
+	assert(!kved_data_write_batch_ex(&kv,items,2));
+	assert(kved_used_entries_get_ex(&kv) == num_used);
+	assert(kved_data_write_batch_ex(&kv,items,1));
+	assert(kved_used_entries_get_ex(&kv) == num_used + 1);
+}
+
+#define KVED_TEST_TXN_KEYS 4
+
+static uint16_t kved_test_txn_check(kved_t *kv)
+{
+	kved_data_t r = { 0 };
+	uint16_t num_committed = 0;
+
+	for(uint16_t n = 0 ; n < KVED_TEST_TXN_KEYS ; n++)
+	{
+		kved_test_key_make(&r,n);
+		assert(kved_data_read_ex(kv,&r));
+		assert(r.value.u32 == n || r.value.u32 == 100u + n);
+
+		if(r.value.u32 == 100u + n)
+			num_committed++;
+	}
+
+	assert(kved_used_entries_get_ex(kv) == KVED_TEST_TXN_KEYS + 1);
+
+	return num_committed;
+}
+
+void kved_txn_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	static kved_word_t saved_words[KVED_FLASH_NUM_SECTORS][KVED_TEST_RAM_FLASH_WORDS];
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	kved_data_t d = { .key = "tx", .type = KVED_DATA_TYPE_UINT32 };
+	kved_data_t items[KVED_TEST_TXN_KEYS];
+	kved_txn_t txn;
+	uint32_t value = 0;
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+
+	kved_txn_begin(&txn);
+
+	for(uint16_t n = 0 ; n < KVED_TEST_TXN_KEYS ; n++)
+	{
+		memset(&items[n],0,sizeof(items[n]));
+		kved_test_key_make(&items[n],n);
+		items[n].type = KVED_DATA_TYPE_UINT32;
+		items[n].value.u32 = n;
+		assert(kved_txn_put(&txn,&items[n]));
+	}
+
+	// nothing is visible before the commit
+	assert(!kved_data_read_ex(&kv,&items[0]));
+	assert(kved_txn_commit_ex(&kv,&txn));
+	assert(kved_data_write_ex(&kv,&d));
+	assert(kved_test_txn_check(&kv) == 0);
+
+	// failed put: nothing is written
+	kved_txn_begin(&txn);
+	assert(kved_txn_put(&txn,&items[0]));
+	memset(d.key,0,sizeof(d.key));
+	assert(!kved_txn_put(&txn,&d));
+	assert(!kved_txn_commit_ex(&kv,&txn));
+	memcpy(d.key,"tx",2);
+
+	// power loss after each flash write of the commit, with room in the newest sector or not
+	for(uint8_t full = 0 ; full < 2 ; full++)
+	{
+		while(full && (kv.ctrl.first_free_index != kv.ctrl.last_index))
+		{
+			d.value.u32 = value++;
+			assert(kved_data_write_ex(&kv,&d));
+		}
+
+		memcpy(saved_words,ram_flash.words,sizeof(saved_words));
+		uint32_t num_writes = 0;
+		uint16_t num_committed;
+
+		do
+		{
+			memcpy(ram_flash.words,saved_words,sizeof(saved_words));
+			kved_init_ex(&kv,&flash_ops,NULL);
+
+			kved_txn_begin(&txn);
+
+			for(uint16_t n = 0 ; n < KVED_TEST_TXN_KEYS ; n++)
+			{
+				items[n].value.u32 = 100 + n;
+				assert(kved_txn_put(&txn,&items[n]));
+			}
+
+			ram_flash.writes = 0;
+			ram_flash.max_writes = ++num_writes;
+			assert(kved_txn_commit_ex(&kv,&txn));
+			ram_flash.max_writes = 0;
+
+			// all values or none of them, also after a second reset
+			kved_init_ex(&kv,&flash_ops,NULL);
+			num_committed = kved_test_txn_check(&kv);
+			assert(num_committed == 0 || num_committed == KVED_TEST_TXN_KEYS);
+
+			kved_init_ex(&kv,&flash_ops,NULL);
+			assert(kved_test_txn_check(&kv) == num_committed);
+		} while(ram_flash.writes >= num_writes);
+
+		assert(num_committed == KVED_TEST_TXN_KEYS);
+
+		// old values again, for the next round
+		kved_txn_begin(&txn);
+
+		for(uint16_t n = 0 ; n < KVED_TEST_TXN_KEYS ; n++)
+		{
+			items[n].value.u32 = n;
+			assert(kved_txn_put(&txn,&items[n]));
+		}
+
+		assert(kved_txn_commit_ex(&kv,&txn));
+		assert(kved_test_txn_check(&kv) == 0);
+	}
+}
+
+#define KVED_TEST_BLOB_SIZE 20
+#define KVED_TEST_BLOB_FRAGS ((KVED_TEST_BLOB_SIZE + KVED_BLOB_FRAG_SIZE - 1)/KVED_BLOB_FRAG_SIZE)
+
+static uint8_t kved_test_blob_check(kved_t *kv)
+{
+	uint8_t blob[2*KVED_TEST_BLOB_SIZE];
+	uint16_t size = sizeof(blob);
+
+	assert(kved_blob_read_ex(kv,"bl",blob,&size));
+	assert(size == KVED_TEST_BLOB_SIZE);
+
+	for(uint16_t n = 1 ; n < KVED_TEST_BLOB_SIZE ; n++)
+		assert(blob[n] == (uint8_t)(blob[0] + n));
+
+	// blob and an extra key
+	assert(kved_used_entries_get_ex(kv) == KVED_TEST_BLOB_FRAGS + 2);
+
+	return blob[0];
+}
+
+static void kved_test_blob_make(uint8_t *blob, uint8_t seed)
+{
+	for(uint16_t n = 0 ; n < KVED_TEST_BLOB_SIZE ; n++)
+		blob[n] = (uint8_t)(seed + n);
+}
+
+void kved_blob_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	static kved_word_t saved_words[KVED_FLASH_NUM_SECTORS][KVED_TEST_RAM_FLASH_WORDS];
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	kved_data_t d = { .key = "x", .type = KVED_DATA_TYPE_UINT32 };
+	uint8_t blob[KVED_TEST_BLOB_SIZE];
+	uint16_t size = 4;
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+
+	kved_test_blob_make(blob,0);
+	assert(!kved_blob_write_ex(&kv,"",blob,sizeof(blob)));
+	assert(kved_blob_write_ex(&kv,"bl",blob,sizeof(blob)));
+	assert(kved_data_write_ex(&kv,&d));
+	assert(kved_test_blob_check(&kv) == 0);
+
+	// small buffer, only the size is returned
+	assert(!kved_blob_read_ex(&kv,"bl",blob,&size));
+	assert(size == KVED_TEST_BLOB_SIZE);
+
+	// blob headers are not read as values
+	kved_data_t h = { .key = "bl" };
+	assert(!kved_data_read_ex(&kv,&h));
+
+	// no flash writes for the same blob
+	uint32_t num_writes = ram_flash.writes;
+	assert(kved_blob_write_ex(&kv,"bl",blob,sizeof(blob)));
+	assert(ram_flash.writes == num_writes);
+
+	// blobs are moved as a unit by sector switches
+	for(uint8_t seed = 1 ; seed < 50 ; seed++)
+	{
+		kved_test_blob_make(blob,seed);
+		assert(kved_blob_write_ex(&kv,"bl",blob,sizeof(blob)));
+		d.value.u32 = seed;
+		assert(kved_data_write_ex(&kv,&d));
+		assert(kved_test_blob_check(&kv) == seed);
+
+		if(seed % 8 == 0)
+		{
+			kved_init_ex(&kv,&flash_ops,NULL);
+			assert(kved_test_blob_check(&kv) == seed);
+		}
+	}
+
+	// power loss after each flash write: old or new blob, also after a second reset
+	memcpy(saved_words,ram_flash.words,sizeof(saved_words));
+	num_writes = 0;
+	uint8_t seed;
+
+	do
+	{
+		memcpy(ram_flash.words,saved_words,sizeof(saved_words));
+		kved_init_ex(&kv,&flash_ops,NULL);
+
+		kved_test_blob_make(blob,100);
+		ram_flash.writes = 0;
+		ram_flash.max_writes = ++num_writes;
+		assert(kved_blob_write_ex(&kv,"bl",blob,sizeof(blob)));
+		ram_flash.max_writes = 0;
+
+		kved_init_ex(&kv,&flash_ops,NULL);
+		seed = kved_test_blob_check(&kv);
+		assert(seed == 49 || seed == 100);
+
+		kved_init_ex(&kv,&flash_ops,NULL);
+		assert(kved_test_blob_check(&kv) == seed);
+	} while(ram_flash.writes >= num_writes);
+
+	assert(seed == 100);
+
+	// fragments are removed with the header
+	kved_data_t b = { .key = "bl", .type = KVED_DATA_TYPE_BLOB };
+	assert(kved_data_delete_ex(&kv,&b));
+	assert(kved_used_entries_get_ex(&kv) == 1);
+	assert(!kved_blob_read_ex(&kv,"bl",blob,&size));
+
+	kved_init_ex(&kv,&flash_ops,NULL);
+	assert(kved_used_entries_get_ex(&kv) == 1);
+}
+
+void kved_long_key_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	const char *names[] = { "uart.console.baudrate", "uart.console.parity" };
+	kved_data_t d = { .type = KVED_DATA_TYPE_UINT32 };
+	kved_data_t r = { 0 };
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+
+	for(uint8_t n = 0 ; n < 2 ; n++)
+	{
+		d.value.u32 = 115200 + n;
+		assert(kved_long_key_data_write_ex(&kv,names[n],&d));
+	}
+
+	assert(!kved_long_key_data_write_ex(&kv,"a.name.longer.than.thirty.two.chars",&d));
+
+	kved_init_ex(&kv,&flash_ops,NULL);
+
+	for(uint8_t n = 0 ; n < 2 ; n++)
+	{
+		assert(kved_long_key_data_read_ex(&kv,names[n],&r));
+		assert(r.type == KVED_DATA_TYPE_UINT32);
+		assert(r.value.u32 == 115200u + n);
+	}
+
+	assert(!kved_long_key_data_read_ex(&kv,"uart.console.stopbits",&r));
+
+#if KVED_LONG_KEY_NAMES > 0
+	// names of long keys found during iteration
+	uint8_t num_found = 0;
+
+	for(uint16_t index = kved_first_used_index_get_ex(&kv) ; index != KVED_INDEX_NOT_FOUND ; index = kved_next_used_index_get_ex(&kv,index))
+	{
+		char name[KVED_LONG_KEY_SIZE + 1];
+
+		assert(kved_data_read_by_index_ex(&kv,index,&r));
+
+		if((r.key[0] & KVED_LONG_KEY_MARKER_MSK) != KVED_LONG_KEY_MARKER)
+			continue;
+
+		assert(kved_long_key_name_get_ex(&kv,&r,name,sizeof(name)));
+		assert(strcmp(name,names[r.value.u32 - 115200]) == 0);
+		assert(!kved_long_key_name_get_ex(&kv,&r,name,4));
+		num_found++;
+	}
+
+	assert(num_found == 2);
+
+	// hash collision: the stored name of "x.y" is another one
+	char name_key[KVED_MAX_KEY_SIZE + 1] = { 0 };
+
+	kved_key_decode(&r,kved_long_key_encode("x.y",KVED_DATA_TYPE_BLOB));
+	memcpy(name_key,r.key,KVED_MAX_KEY_SIZE);
+	name_key[0] = (char)(KVED_LONG_KEY_NAME_MARKER | (name_key[0] & ~KVED_LONG_KEY_MARKER_MSK));
+	assert(kved_blob_write_ex(&kv,name_key,"x.z",3));
+	assert(!kved_long_key_data_write_ex(&kv,"x.y",&d));
+	assert(!kved_long_key_data_read_ex(&kv,"x.y",&r));
+
+	// value of "x.z" stored with the same hash: not returned for "x.y"
+	assert(kved_encoded_data_write_ex(&kv,kved_long_key_encode("x.y",KVED_DATA_TYPE_UINT32),&d));
+	assert(!kved_long_key_data_read_ex(&kv,"x.y",&r));
+
+	// neither deleted by "x.y"
+	assert(!kved_long_key_data_delete_ex(&kv,"x.y"));
+	kved_key_decode(&r,kved_long_key_encode("x.y",KVED_DATA_TYPE_UINT32));
+	assert(kved_data_delete_ex(&kv,&r));
+	memcpy(r.key,name_key,KVED_MAX_KEY_SIZE);
+	assert(kved_data_delete_ex(&kv,&r));
+#endif
+
+	// names are deleted with the values
+	for(uint8_t n = 0 ; n < 2 ; n++)
+		assert(kved_long_key_data_delete_ex(&kv,names[n]));
+
+	assert(!kved_long_key_data_delete_ex(&kv,names[0]));
+	assert(!kved_long_key_data_delete_ex(&kv,"a.name.longer.than.thirty.two.chars"));
+	assert(kved_used_entries_get_ex(&kv) == 0);
+}
+
+void kved_counter_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	static kved_word_t saved_words[KVED_FLASH_NUM_SECTORS][KVED_TEST_RAM_FLASH_WORDS];
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	kved_data_t d = { .key = "bts", .type = KVED_DATA_TYPE_UINT32 };
+	kved_data_t r = { .key = "bts" };
+	kved_word_t count = 0;
+	kved_word_t value;
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+
+	assert(!kved_counter_get_ex(&kv,"bts",&value));
+	assert(kved_counter_inc_ex(&kv,"bts"));
+	assert(kved_counter_get_ex(&kv,"bts",&value) && (value == 1));
+	assert(kved_used_entries_get_ex(&kv) == 2);
+
+	// only single word values are written by kved_data_write
+	d.type = KVED_DATA_TYPE_COUNTER;
+	assert(!kved_data_write_ex(&kv,&d));
+	d.type = KVED_DATA_TYPE_UINT32;
+	memcpy(d.key,"x",2);
+	assert(kved_data_write_ex(&kv,&d));
+	assert(!kved_counter_inc_ex(&kv,"x"));
+
+	// increments in place, one word write each (new entries without bit clearing)
+	for(count = 2 ; count <= KVED_COUNTER_BITS + 1 ; count++)
+	{
+		ram_flash.writes = 0;
+		assert(kved_counter_inc_ex(&kv,"bts"));
+#if KVED_FLASH_BIT_CLEAR
+		assert(ram_flash.writes == 1);
+#else
+		assert(ram_flash.writes > 1);
+#endif
+		assert(kved_counter_get_ex(&kv,"bts",&value) && (value == count));
+	}
+
+	// new entries when all bits are cleared
+	ram_flash.writes = 0;
+	assert(kved_counter_inc_ex(&kv,"bts"));
+	assert(ram_flash.writes > 1);
+	assert(kved_data_read_ex(&kv,&r));
+	assert(r.type == KVED_DATA_TYPE_COUNTER);
+	assert(r.value.u32 == (uint32_t)count);
+
+	// sector switches, garbage collection and resets
+	for(uint16_t n = 0 ; n < 1000 ; n++)
+	{
+		assert(kved_counter_inc_ex(&kv,"bts"));
+		count++;
+
+		if(n % 7 == 0)
+			kved_gc_step_ex(&kv,4);
+
+		if(n % 97 == 0)
+			kved_init_ex(&kv,&flash_ops,NULL);
+
+		assert(kved_counter_get_ex(&kv,"bts",&value) && (value == count));
+		assert(kved_used_entries_get_ex(&kv) == 3);
+	}
+
+	// power loss after each flash write of an increment with new entries
+	do
+	{
+		ram_flash.writes = 0;
+		assert(kved_counter_inc_ex(&kv,"bts"));
+		count++;
+	} while(ram_flash.writes == 1);
+
+	for(uint16_t n = 0 ; n < KVED_COUNTER_BITS ; n++)
+	{
+		assert(kved_counter_inc_ex(&kv,"bts"));
+		count++;
+	}
+
+	memcpy(saved_words,ram_flash.words,sizeof(saved_words));
+	uint32_t num_writes = 0;
+
+	do
+	{
+		memcpy(ram_flash.words,saved_words,sizeof(saved_words));
+		kved_init_ex(&kv,&flash_ops,NULL);
+
+		ram_flash.writes = 0;
+		ram_flash.max_writes = ++num_writes;
+		assert(kved_counter_inc_ex(&kv,"bts"));
+		ram_flash.max_writes = 0;
+
+		kved_init_ex(&kv,&flash_ops,NULL);
+		assert(kved_counter_get_ex(&kv,"bts",&value) && ((value == count) || (value == count + 1)));
+		assert(kved_used_entries_get_ex(&kv) == 3);
+	} while(ram_flash.writes >= num_writes);
+
+	assert(value == count + 1);
+
+	assert(kved_data_delete_ex(&kv,&r));
+	assert(kved_used_entries_get_ex(&kv) == 1);
+
+	// misplaced header: the entry before it is a value, its bits are neither counted nor cleared
+	kved_format_ex(&kv);
+	assert(kved_counter_inc_ex(&kv,"bts"));
+
+	uint16_t index = kved_first_used_index_get_ex(&kv);
+	kved_flash_sector_t sec = (kved_flash_sector_t)(index/KVED_TEST_RAM_FLASH_WORDS);
+
+	assert(kved_data_read_by_index_ex(&kv,index,&r) && (r.type == KVED_DATA_TYPE_COUNTER));
+	d.value.u32 = 0x12345678;
+	ram_flash.words[sec][index % KVED_TEST_RAM_FLASH_WORDS - 2] = kved_key_encode(&d);
+	ram_flash.words[sec][index % KVED_TEST_RAM_FLASH_WORDS - 1] = d.value.u32;
+
+	assert(kved_counter_get_ex(&kv,"bts",&value) && (value == 1));
+	assert(kved_counter_inc_ex(&kv,"bts"));
+	assert(kved_counter_get_ex(&kv,"bts",&value) && (value == 2));
+	assert(ram_flash.words[sec][index % KVED_TEST_RAM_FLASH_WORDS - 2] == kved_key_encode(&d));
+	assert(ram_flash.words[sec][index % KVED_TEST_RAM_FLASH_WORDS - 1] == d.value.u32);
+}
+
+void kved_write_back_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	kved_data_t d = { .key = "tmp", .type = KVED_DATA_TYPE_UINT32 };
+	kved_data_t r = { .key = "tmp" };
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	kved_init_ex(&kv,&flash_ops,NULL);
+	kved_format_ex(&kv);
+
+	// fast changing key: only the last value is written
+	ram_flash.writes = 0;
+
+	for(uint32_t n = 0 ; n < 100 ; n++)
+	{
+		d.value.u32 = n;
+		assert(kved_data_write_deferred_ex(&kv,&d));
+		assert(kved_data_read_ex(&kv,&r) && (r.value.u32 == n));
+	}
+
+#if KVED_WRITE_BACK_SIZE > 0
+	assert(ram_flash.writes == 0);
+	assert(kved_used_entries_get_ex(&kv) == 0);
+#endif
+
+	assert(kved_flush_ex(&kv));
+	assert(kved_used_entries_get_ex(&kv) == 1);
+	assert(kved_flush_ex(&kv));
+
+	kved_init_ex(&kv,&flash_ops,NULL);
+	assert(kved_data_read_ex(&kv,&r) && (r.value.u32 == 99));
+
+	// pending values are lost on a reset
+	d.value.u32 = 100;
+	assert(kved_data_write_deferred_ex(&kv,&d));
+	kved_init_ex(&kv,&flash_ops,NULL);
+#if KVED_WRITE_BACK_SIZE > 0
+	assert(kved_data_read_ex(&kv,&r) && (r.value.u32 == 99));
+#endif
+
+	// direct writes and deletes drop pending values
+	d.value.u32 = 101;
+	assert(kved_data_write_deferred_ex(&kv,&d));
+	d.value.u32 = 102;
+	assert(kved_data_write_ex(&kv,&d));
+	assert(kved_flush_ex(&kv));
+	assert(kved_data_read_ex(&kv,&r) && (r.value.u32 == 102));
+
+	d.value.u32 = 103;
+	assert(kved_data_write_deferred_ex(&kv,&d));
+	assert(kved_data_delete_ex(&kv,&d));
+	assert(!kved_data_read_ex(&kv,&r));
+	assert(kved_flush_ex(&kv));
+	assert(!kved_data_read_ex(&kv,&r));
+
+	// a full table is written before a new key is added
+	for(uint16_t n = 0 ; n <= KVED_WRITE_BACK_SIZE ; n++)
+	{
+		kved_test_key_make(&d,n);
+		d.value.u32 = n;
+		assert(kved_data_write_deferred_ex(&kv,&d));
+	}
+
+	assert(kved_used_entries_get_ex(&kv) == (KVED_WRITE_BACK_SIZE > 0 ? KVED_WRITE_BACK_SIZE : 1));
+	assert(kved_flush_ex(&kv));
+	assert(kved_used_entries_get_ex(&kv) == KVED_WRITE_BACK_SIZE + 1);
+
+	for(uint16_t n = 0 ; n <= KVED_WRITE_BACK_SIZE ; n++)
+	{
+		kved_test_key_make(&r,n);
+		assert(kved_data_read_ex(&kv,&r) && (r.value.u32 == n));
+	}
+
+#if KVED_WRITE_BACK_SIZE > 0
+	// writes failing for lack of room keep pending values
+	kved_data_t items[2];
+	kved_txn_t txn;
+	uint16_t num_keys = kved_total_entries_get_ex(&kv);
+
+	kved_format_ex(&kv);
+
+	for(uint16_t n = 0 ; n < num_keys ; n++)
+	{
+		kved_test_key_make(&d,n);
+		d.type = KVED_DATA_TYPE_UINT32;
+		d.value.u32 = n;
+		assert(kved_data_write_ex(&kv,&d));
+	}
+
+	kved_test_key_make(&d,0);
+	d.value.u32 = 1000;
+	assert(kved_data_write_deferred_ex(&kv,&d));
+
+	items[0] = d;
+	items[0].value.u32 = 1001;
+	items[1] = d;
+	kved_test_key_make(&items[1],num_keys);
+	items[1].type = KVED_DATA_TYPE_UINT32;
+
+	kved_txn_begin(&txn);
+	assert(kved_txn_put(&txn,&items[0]) && kved_txn_put(&txn,&items[1]));
+	assert(!kved_txn_commit_ex(&kv,&txn));
+	assert(!kved_data_write_batch_ex(&kv,items,2));
+	assert(!kved_data_write_ex(&kv,&items[1]));
+
+	kved_test_key_make(&r,0);
+	assert(kved_data_read_ex(&kv,&r) && (r.value.u32 == 1000));
+#endif
+}
+
+void kved_flash_hooks_test(void)
+{
+	static kved_test_ram_flash_t ram_flash[2];
+	const kved_flash_ops_t flash_ops[2] = 
+	{
+		{ .arg = &ram_flash[0], .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		  .data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		  .sector_size = kved_test_ram_flash_sector_size },
+		{ .arg = &ram_flash[1], .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		  .data_write = kved_test_ram_flash_data_write, .entry_write = kved_test_ram_flash_entry_write,
+		  .data_write_block = kved_test_ram_flash_data_write_block, .data_read = kved_test_ram_flash_data_read,
+		  .sector_size = kved_test_ram_flash_sector_size },
+	};
+	kved_data_t d = { .type = KVED_DATA_TYPE_UINT32 };
+	kved_data_t r = { .key = "pc" };
+	uint8_t blob[6] = { 1, 2, 3, 4, 5, 6 };
+	kved_t kv[2];
+
+	memset(ram_flash,0,sizeof(ram_flash));
+
+	for(uint8_t i = 0 ; i < 2 ; i++)
+	{
+		kved_init_ex(&kv[i],&flash_ops[i],NULL);
+		kved_format_ex(&kv[i]);
+	}
+
+	// a new entry is a single program operation
+	for(uint8_t i = 0 ; i < 2 ; i++)
+	{
+		ram_flash[i].writes = 0;
+		ram_flash[i].programs = 0;
+	}
+
+	kved_test_key_make(&d,0);
+	assert(kved_data_write_ex(&kv[1],&d));
+	assert((ram_flash[1].writes == 2) && (ram_flash[1].programs == 1));
+	assert(kved_data_write_ex(&kv[0],&d));
+
+	// same flash contents with or without hooks, after several sector switches
+	for(uint32_t n = 0 ; n < 8*KVED_TEST_RAM_FLASH_WORDS ; n++)
+	{
+		kved_test_key_make(&d,n % 5);
+		d.value.u32 = n;
+		blob[0] = n;
+
+		for(uint8_t i = 0 ; i < 2 ; i++)
+		{
+			assert(kved_data_write_ex(&kv[i],&d));
+
+			if((n % 7) == 0)
+				kved_gc_step_ex(&kv[i],3);
+
+			if((n % 11) == 0)
+				assert(kved_blob_write_ex(&kv[i],"hb",blob,sizeof(blob)));
+
+			if((n % 13) == 0)
+				assert(kved_counter_inc_ex(&kv[i],"hc"));
+		}
+	}
+
+	assert(memcmp(ram_flash[0].words,ram_flash[1].words,sizeof(ram_flash[0].words)) == 0);
+	assert(ram_flash[0].writes == ram_flash[1].writes);
+	assert(ram_flash[0].programs == ram_flash[0].writes);
+	assert(ram_flash[1].programs < ram_flash[0].programs);
+
+	// power loss after the value word: the entry is not valid
+	d = r;
+	d.type = KVED_DATA_TYPE_UINT32;
+	ram_flash[1].max_writes = ram_flash[1].writes + 1;
+	assert(kved_data_write_ex(&kv[1],&d));
+	ram_flash[1].max_writes = 0;
+
+	kved_init_ex(&kv[1],&flash_ops[1],NULL);
+	assert(!kved_data_read_ex(&kv[1],&r));
+	assert(kved_used_entries_get_ex(&kv[1]) == kved_used_entries_get_ex(&kv[0]));
+}
+
+static uint16_t kved_test_async_done = 0;
+
+static void kved_test_async_cb(void *ctx, bool result)
+{
+	uint16_t *order = ctx;
+
+	assert(result);
+	*order = ++kved_test_async_done;
+}
+
+void kved_async_test(void)
+{
+	kved_data_t d = { .type = KVED_DATA_TYPE_UINT32 };
+	kved_flash_simul_counters_t cnt[2];
+	uint16_t num_requests = KVED_ASYNC_SIZE > 0 ? KVED_ASYNC_SIZE : 1;
+	uint16_t order[KVED_ASYNC_SIZE + 1] = { 0 };
+	uint32_t num_polls = 0;
+	bool more;
+
+	kved_format();
+	kved_test_async_done = 0;
+	kved_flash_simul_busy_set(3,100);
+
+	// requests are written by kved_poll, in order
+	for(uint16_t n = 0 ; n < num_requests ; n++)
+	{
+		kved_test_key_make(&d,n);
+		d.type = KVED_DATA_TYPE_UINT32;
+		d.value.u32 = n;
+		assert(kved_data_write_async(&d,kved_test_async_cb,&order[n]));
+	}
+
+#if KVED_ASYNC_SIZE > 0
+	assert(kved_test_async_done == 0);
+	assert(!kved_data_read(&d));
+
+	kved_test_key_make(&d,num_requests);
+	assert(!kved_data_write_async(&d,kved_test_async_cb,&order[num_requests]));
+#endif
+
+	while(kved_poll())
+		num_polls++;
+
+	// flash busy after each write: polls returned without waiting
+#if KVED_ASYNC_SIZE > 0
+	assert(num_polls >= 4*num_requests);
+#endif
+
+	for(uint16_t n = 0 ; n < num_requests ; n++)
+	{
+		assert(order[n] == n + 1);
+		kved_test_key_make(&d,n);
+		assert(kved_data_read(&d) && (d.value.u32 == n));
+	}
+
+	// sector switches: erasing is a step by itself and polls never wait for it
+	kved_flash_simul_busy_set(0,100);
+	kved_flash_simul_counters_reset();
+
+	for(uint32_t n = 0 ; n < 4*kved_total_entries_get() ; n++)
+	{
+		kved_test_key_make(&d,n % 3);
+		d.type = KVED_DATA_TYPE_UINT32;
+		d.value.u32 = n;
+		assert(kved_data_write_async(&d,NULL,NULL));
+
+		do
+		{
+			kved_flash_simul_counters_get(&cnt[0]);
+			more = kved_poll();
+			kved_flash_simul_counters_get(&cnt[1]);
+			assert((cnt[1].busy - cnt[0].busy) <= 1);
+		} while(more);
+
+		assert(kved_data_read(&d) && (d.value.u32 == n));
+	}
+
+	assert((cnt[1].erases > 0) && (cnt[1].busy == 100*cnt[1].erases));
+	kved_flash_simul_busy_set(0,0);
+}
+
+typedef struct kved_test_rw_lock_s
+{
+	uint32_t writes;
+	uint32_t reads;
+	uint32_t readers;
+	bool writer;
+} kved_test_rw_lock_t;
+
+static void kved_test_rw_lock_write_enter(void *arg)
+{
+	kved_test_rw_lock_t *lock = arg;
+
+	assert(!lock->writer && (lock->readers == 0));
+	lock->writer = true;
+	lock->writes++;
+}
+
+static void kved_test_rw_lock_write_leave(void *arg)
+{
+	kved_test_rw_lock_t *lock = arg;
+
+	lock->writer = false;
+}
+
+static void kved_test_rw_lock_read_enter(void *arg)
+{
+	kved_test_rw_lock_t *lock = arg;
+
+	assert(!lock->writer);
+	lock->readers++;
+	lock->reads++;
+}
+
+static void kved_test_rw_lock_read_leave(void *arg)
+{
+	kved_test_rw_lock_t *lock = arg;
+
+	lock->readers--;
+}
+
+static bool kved_test_readers_stop;
+
+static void *kved_test_reader(void *arg)
+{
+	kved_data_t d = { .key = "rw", .type = KVED_DATA_TYPE_UINT32 };
+	uint32_t last = 0;
+	uint32_t *num_reads = arg;
+
+	// values are written in increasing order
+	while(!__atomic_load_n(&kved_test_readers_stop,__ATOMIC_RELAXED))
+	{
+		assert(kved_data_read(&d) && (d.value.u32 >= last));
+		assert(kved_used_entries_get() == 1);
+		last = d.value.u32;
+		(*num_reads)++;
+	}
+
+	return NULL;
+}
+
+void kved_lock_test(void)
+{
+	static kved_test_ram_flash_t ram_flash;
+	static kved_test_rw_lock_t rw_lock;
+	const kved_flash_ops_t flash_ops = 
+	{ 
+		.arg = &ram_flash, .init = kved_test_ram_flash_init, .sector_erase = kved_test_ram_flash_sector_erase,
+		.data_write = kved_test_ram_flash_data_write, .data_read = kved_test_ram_flash_data_read,
+		.sector_size = kved_test_ram_flash_sector_size 
+	};
+	const kved_lock_ops_t lock_ops = 
+	{ 
+		.arg = &rw_lock, .enter = kved_test_rw_lock_write_enter, .leave = kved_test_rw_lock_write_leave,
+		.read_enter = kved_test_rw_lock_read_enter, .read_leave = kved_test_rw_lock_read_leave 
+	};
+	kved_data_t d = { .key = "lk", .type = KVED_DATA_TYPE_UINT32, .value.u32 = 1 };
+	kved_t kv;
+
+	memset(&ram_flash,0,sizeof(ram_flash));
+	memset(&rw_lock,0,sizeof(rw_lock));
+	kved_init_ex(&kv,&flash_ops,&lock_ops);
+	kved_format_ex(&kv);
+
+	// changes use the write lock
+	assert(kved_data_write_ex(&kv,&d));
+	assert(kved_data_delete_ex(&kv,&d));
+	assert(kved_data_write_ex(&kv,&d));
+	assert(kved_idle_ex(&kv));
+	assert((rw_lock.writes == 5) && (rw_lock.reads == 0));
+
+	// reads use the read lock only
+	assert(kved_data_read_ex(&kv,&d) && (d.value.u32 == 1));
+	assert(kved_used_entries_get_ex(&kv) == 1);
+
+	uint16_t index = kved_first_used_index_get_ex(&kv);
+	assert(kved_data_read_by_index_ex(&kv,index,&d));
+	assert(kved_next_used_index_get_ex(&kv,index) == KVED_INDEX_NOT_FOUND);
+	assert((rw_lock.writes == 5) && (rw_lock.reads == 5));
+	assert(!rw_lock.writer && (rw_lock.readers == 0));
+
+	// concurrent readers of the default instance (pthread read/write lock of the simulation port)
+	pthread_t readers[4];
+	uint32_t num_reads[4] = { 0 };
+
+	kved_format();
+	d = (kved_data_t) { .key = "rw", .type = KVED_DATA_TYPE_UINT32, .value.u32 = 0 };
+	assert(kved_data_write(&d));
+	__atomic_store_n(&kved_test_readers_stop,false,__ATOMIC_RELAXED);
+
+	for(int n = 0 ; n < 4 ; n++)
+		assert(pthread_create(&readers[n],NULL,kved_test_reader,&num_reads[n]) == 0);
+
+	// several sector switches while reading
+	for(uint32_t n = 1 ; n <= 8*kved_total_entries_get() ; n++)
+	{
+		d.value.u32 = n;
+		assert(kved_data_write(&d));
+	}
+
+	__atomic_store_n(&kved_test_readers_stop,true,__ATOMIC_RELAXED);
+
+	for(int n = 0 ; n < 4 ; n++)
+	{
+		assert(pthread_join(readers[n],NULL) == 0);
+		printf("reader %d: %u reads\r\n",n,(unsigned int)num_reads[n]);
+	}
+
+	assert(kved_data_read(&d) && (d.value.u32 == 8*kved_total_entries_get()));
+}
+
+void kved_timing_test(void)
+{
+	const kved_flash_simul_timing_t *l4 = &kved_flash_simul_timing_stm32l4;
+	kved_flash_simul_timing_t background = *l4;
+	kved_flash_simul_counters_t cnt;
+	kved_flash_simul_wear_t wear;
+	kved_data_t d = { .key = "tm", .type = KVED_DATA_TYPE_UINT32, .value.u32 = 0 };
+	uint64_t start;
+
+	kved_format();
+	kved_flash_simul_timing_set(l4);
+	kved_flash_simul_wear_reset();
+	kved_flash_simul_counters_reset();
+
+	// new key: one entry
+	start = kved_flash_simul_clock_get();
+	assert(kved_data_write(&d));
+	assert(kved_flash_simul_clock_get() - start == 2*l4->word_program_us);
+
+	// changed value: one entry plus the old key word
+	d.value.u32 = 1;
+	start = kved_flash_simul_clock_get();
+	assert(kved_data_write(&d));
+	assert(kved_flash_simul_clock_get() - start == 3*l4->word_program_us);
+
+	// unchanged value: no flash programming
+	start = kved_flash_simul_clock_get();
+	assert(kved_data_write(&d));
+	assert(kved_flash_simul_clock_get() == start);
+
+	// several sector switches, each one with its erasing time
+	for(uint32_t n = 0 ; n < 4*kved_total_entries_get() ; n++)
+	{
+		d.value.u32 = n + 2;
+		assert(kved_data_write(&d));
+	}
+
+	kved_flash_simul_counters_get(&cnt);
+	kved_flash_simul_wear_get(&wear);
+	assert(cnt.erases > 0);
+	assert(kved_flash_simul_clock_get() == (uint64_t)cnt.writes*l4->word_program_us + (uint64_t)cnt.erases*l4->erase_us);
+
+	uint32_t erases = 0;
+
+	for(uint8_t sec = 0 ; sec < KVED_FLASH_NUM_SECTORS ; sec++)
+		erases += wear.sector_erases[sec];
+
+	// key words are programmed again when deleted
+	assert(erases == cnt.erases);
+	assert(wear.max_word_reprograms == 2);
+	assert(wear.max_word_programs >= wear.max_word_reprograms);
+	printf("clock %lu us, %lu erases, word programs: %lu max, %lu max before erasing\r\n",
+		(unsigned long)kved_flash_simul_clock_get(),(unsigned long)erases,
+		(unsigned long)wear.max_word_programs,(unsigned long)wear.max_word_reprograms);
+
+	// background operations: the flash is busy after returning and kved waits for it before the next access
+	background.background = true;
+	kved_flash_simul_timing_set(&background);
+
+	d.value.u32 = 0;
+	assert(kved_data_write(&d));
+	assert(kved_flash_simul_clock_get() <= 3*l4->word_program_us);
+	kved_flash_simul_clock_advance(3*l4->word_program_us);
+	assert(!kved_flash_busy());
+
+	d.value.u32 = 1;
+	start = kved_flash_simul_clock_get();
+	assert(kved_data_write(&d));
+	assert(kved_flash_simul_clock_get() - start >= 2*l4->word_program_us);
+	assert(kved_flash_simul_clock_get() - start <= 3*l4->word_program_us);
+
+	kved_flash_simul_timing_set(NULL);
+	assert(!kved_flash_busy());
 }
@@ -10,3 +10,22 @@ Copyright (c) 2022 Marcelo Barros de Almeida <marcelobarrosalmeida@gmail.com>
 void kved_value_test(void);
 void kved_header_test(void);
 void kved_key_test(void);
+void kved_index_test(void);
+void kved_iteration_test(void);
+void kved_view_test(void);
+void kved_encoded_test(void);
+void kved_bloom_test(void);
+void kved_instance_test(void);
+void kved_standby_test(void);
+void kved_gc_test(void);
+void kved_ring_test(void);
+void kved_batch_test(void);
+void kved_txn_test(void);
+void kved_blob_test(void);
+void kved_long_key_test(void);
+void kved_counter_test(void);
+void kved_write_back_test(void);
+void kved_flash_hooks_test(void);
+void kved_async_test(void);
+void kved_lock_test(void);
+void kved_timing_test(void);
@@ -21,6 +21,44 @@ int main(void)
 	kved_header_test();
 	printf("------------ key test ------------\r\n");
 	kved_key_test();
+	printf("------------ index test ------------\r\n");
+	kved_index_test();
+	printf("------------ iteration test ------------\r\n");
+	kved_iteration_test();
+	printf("------------ view test ------------\r\n");
+	kved_view_test();
+	printf("------------ encoded key test ------------\r\n");
+	kved_encoded_test();
+	printf("------------ bloom test ------------\r\n");
+	kved_bloom_test();
+	printf("------------ instance test ------------\r\n");
+	kved_instance_test();
+	printf("------------ standby sector test ------------\r\n");
+	kved_standby_test();
+	printf("------------ garbage collection test ------------\r\n");
+	kved_gc_test();
+	printf("------------ sector ring test ------------\r\n");
+	kved_ring_test();
+	printf("------------ batch write test ------------\r\n");
+	kved_batch_test();
+	printf("------------ transaction test ------------\r\n");
+	kved_txn_test();
+	printf("------------ blob test ------------\r\n");
+	kved_blob_test();
+	printf("------------ long key test ------------\r\n");
+	kved_long_key_test();
+	printf("------------ counter test ------------\r\n");
+	kved_counter_test();
+	printf("------------ write-back test ------------\r\n");
+	kved_write_back_test();
+	printf("------------ flash hooks test ------------\r\n");
+	kved_flash_hooks_test();
+	printf("------------ async write test ------------\r\n");
+	kved_async_test();
+	printf("------------ lock test ------------\r\n");
+	kved_lock_test();
+	printf("------------ timing and wear test ------------\r\n");
+	kved_timing_test();
 
 	return 0;
 }